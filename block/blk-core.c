@@ -1264,6 +1264,49 @@ void init_request_from_bio(struct request *req, struct bio *bio)
 	blk_rq_bio_prep(req->q, req, bio);
 }
 
+/*
+ * Queue @bio on this cpu's staging list.  If nobody is draining that
+ * list, drain it ourselves under a plug, so the bios staged meanwhile
+ * by other tasks reach the elevator as one batch.  Bios submitted under
+ * a plug are batched already, and interrupt context must not sleep in
+ * get_request_wait() on behalf of others.
+ */
+static bool blk_stage_bio(struct request_queue *q, struct bio *bio)
+{
+	struct blk_sw_queue *swq;
+	struct bio_list bios;
+	struct blk_plug plug;
+
+	if (!blk_queue_staging(q) || current->plug || in_interrupt())
+		return false;
+
+	swq = per_cpu_ptr(q->sw_queues, raw_smp_processor_id());
+	spin_lock(&swq->lock);
+	bio_list_add(&swq->bios, bio);
+	if (swq->draining) {
+		spin_unlock(&swq->lock);
+		return true;
+	}
+	swq->draining = true;
+
+	blk_start_plug(&plug);
+	while (!bio_list_empty(&swq->bios)) {
+		bios = swq->bios;
+		bio_list_init(&swq->bios);
+		spin_unlock(&swq->lock);
+
+		while ((bio = bio_list_pop(&bios)))
+			__make_request(q, bio);
+
+		spin_lock(&swq->lock);
+	}
+	swq->draining = false;
+	spin_unlock(&swq->lock);
+	blk_finish_plug(&plug);
+
+	return true;
+}
+
 static int __make_request(struct request_queue *q, struct bio *bio)
 {
 	const bool sync = !!(bio->bi_rw & REQ_SYNC);
@@ -1272,6 +1315,9 @@ static int __make_request(struct request_queue *q, struct bio *bio)
 	struct request *req;
 	unsigned int request_count = 0;
 
+	if (blk_stage_bio(q, bio))
+		return 0;
+
 	/*
 	 * low level driver can indicate that it wants pages above a
 	 * certain limit bounced to low memory (ie for highmem, or even
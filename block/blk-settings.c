@@ -99,6 +99,55 @@ void blk_queue_lld_busy(struct request_queue *q, lld_busy_fn *fn)
 }
 EXPORT_SYMBOL_GPL(blk_queue_lld_busy);
 
+/*
+ * Staging is used while the driver asked for it and the elevator copes
+ * with requests allocated by a task other than the one that submitted
+ * the bio.  Called with the queue lock held or before the queue is live.
+ */
+void blk_queue_update_staging(struct request_queue *q)
+{
+	if (q->sw_queues && q->elevator &&
+	    q->elevator->elevator_type->elevator_staging)
+		queue_flag_set_unlocked(QUEUE_FLAG_STAGING, q);
+	else
+		queue_flag_clear_unlocked(QUEUE_FLAG_STAGING, q);
+}
+
+/**
+ * blk_queue_enable_staging - stage bios per cpu in front of the queue
+ * @q:		the request queue for the device
+ *
+ * Description:
+ *   Bios submitted outside of a plug are collected on a per-cpu list
+ *   and fed to the queue in batches under one plug, so the queue lock
+ *   is taken and the queue run once per batch instead of once per bio.
+ *   Only in effect while the elevator sets elevator_staging; cfq does
+ *   not, as it charges each request to the allocating task's io_context.
+ *   Call before the queue goes live.
+ **/
+int blk_queue_enable_staging(struct request_queue *q)
+{
+	int cpu;
+
+	q->sw_queues = alloc_percpu(struct blk_sw_queue);
+	if (!q->sw_queues)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct blk_sw_queue *swq = per_cpu_ptr(q->sw_queues, cpu);
+
+		spin_lock_init(&swq->lock);
+		bio_list_init(&swq->bios);
+		swq->draining = false;
+	}
+
+	spin_lock_irq(q->queue_lock);
+	blk_queue_update_staging(q);
+	spin_unlock_irq(q->queue_lock);
+	return 0;
+}
+EXPORT_SYMBOL(blk_queue_enable_staging);
+
 /**
  * blk_urgent_request() - Set an urgent_request handler function for queue
  * @q:		queue
@@ -20,6 +20,18 @@ void __blk_queue_free_tags(struct request_queue *q);
 bool __blk_end_bidi_request(struct request *rq, int error,
 			    unsigned int nr_bytes, unsigned int bidi_bytes);
 
+/*
+ * Bios staged on one cpu for a queue with QUEUE_FLAG_STAGING.  Whoever
+ * finds the list idle drains it into the queue under a single plug.
+ */
+struct blk_sw_queue {
+	spinlock_t		lock;
+	struct bio_list		bios;
+	bool			draining;
+};
+
+void blk_queue_update_staging(struct request_queue *q);
+
 void blk_rq_timed_out_timer(unsigned long data);
 void blk_delete_timer(struct request *);
 void blk_add_timer(struct request *);
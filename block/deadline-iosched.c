@@ -444,6 +444,7 @@ static struct elevator_type iosched_deadline = {
 	.elevator_attrs = deadline_attrs,
 	.elevator_name = "deadline",
 	.elevator_owner = THIS_MODULE,
+	.elevator_staging = true,
 };
 
 static int __init deadline_init(void)
@@ -175,6 +175,7 @@ static void elevator_attach(struct request_queue *q, struct elevator_queue *eq,
 {
 	q->elevator = eq;
 	eq->elevator_data = data;
+	blk_queue_update_staging(q);
 }
 
 static char chosen_elevator[16];
@@ -1042,6 +1043,7 @@ fail_register:
 	elv_register_queue(q);
 
 	spin_lock_irq(q->queue_lock);
+	blk_queue_update_staging(q);
 	queue_flag_clear(QUEUE_FLAG_ELVSWITCH, q);
 	spin_unlock_irq(q->queue_lock);
 
@@ -90,6 +90,7 @@ static struct elevator_type elevator_noop = {
 	},
 	.elevator_name = "noop",
 	.elevator_owner = THIS_MODULE,
+	.elevator_staging = true,
 };
 
 static int __init noop_init(void)
@@ -26,6 +26,7 @@
 #include <linux/compiler.h>
 #include <linux/blktrace_api.h>
 #include <linux/jiffies.h>
+#include <linux/log2.h>
 
 /*
  * enum row_queue_prio - Priorities of the ROW queues
@@ -69,6 +70,17 @@ static const bool urgent_queues[] = {
 	false,	/* ROWQ_PRIO_LOW_SWRITE */
 };
 
+/* Names of the queues, as used in the sysfs attributes */
+static const char * const queue_name[] = {
+	"hp_read",	/* ROWQ_PRIO_HIGH_READ */
+	"rp_read",	/* ROWQ_PRIO_REG_READ */
+	"hp_swrite",	/* ROWQ_PRIO_HIGH_SWRITE */
+	"rp_swrite",	/* ROWQ_PRIO_REG_SWRITE */
+	"rp_write",	/* ROWQ_PRIO_REG_WRITE */
+	"lp_read",	/* ROWQ_PRIO_LOW_READ */
+	"lp_swrite"	/* ROWQ_PRIO_LOW_SWRITE */
+};
+
 /* Default values for row queues quantums in each dispatch cycle */
 static const int queue_quantum[] = {
 	100,	/* ROWQ_PRIO_HIGH_READ */
@@ -80,6 +92,38 @@ static const int queue_quantum[] = {
 	1	/* ROWQ_PRIO_LOW_SWRITE */
 };
 
+/*
+ * Default latency targets (in msec) of the row queues, used when the
+ * latency target mode is enabled. Queues without a target (0) are
+ * background queues: they are throttled while a queue with a target
+ * misses it, and get their full quantum back once the targets are met.
+ */
+static const int queue_latency_target[] = {
+	10,	/* ROWQ_PRIO_HIGH_READ */
+	10,	/* ROWQ_PRIO_REG_READ */
+	50,	/* ROWQ_PRIO_HIGH_SWRITE */
+	100,	/* ROWQ_PRIO_REG_SWRITE */
+	0,	/* ROWQ_PRIO_REG_WRITE */
+	0,	/* ROWQ_PRIO_LOW_READ */
+	0	/* ROWQ_PRIO_LOW_SWRITE */
+};
+
+/* Latency percentile that has to stay within the target */
+#define ROW_TARGET_PCT		99
+/* Quanta are adapted once per window (in msec)... */
+#define ROW_TARGET_WINDOW_MSEC	100
+/* ...judging only queues with this many completions in it */
+#define ROW_TARGET_MIN_SAMPLES	8
+/* Largest target that can be set; keeps target_ms * USEC_PER_MSEC in a long */
+#define ROW_TARGET_MAX_MSEC	60000
+/* Max log2 of the factor a missing queue's quantum is scaled up by */
+#define ROW_MAX_BOOST		2
+/* Max throttle level of background queues, see row_rowq_throttled() */
+#define ROW_MAX_THROTTLE	10
+
+/* Completion latency histogram: <1, <2, <4, ... <1024, >=1024 msec */
+#define ROW_HIST_BUCKETS	12
+
 /* Default values for idling on read queues (in msec) */
 #define ROW_IDLE_TIME_MSEC 5
 #define ROW_READ_FREQ_MSEC 20
@@ -96,6 +140,25 @@ struct rowq_idling_data {
 	bool			begin_idling;
 };
 
+/**
+ * struct rowq_latency - completion latency of the queue's requests
+ * @target_ms:		latency target (msec), 0 for a background queue
+ * @boost:		log2 of the factor the quantum is scaled up by
+ * @nr:			requests completed in the current window
+ * @over_target:	of which took longer than target_ms
+ * @over_half:		of which took longer than target_ms / 2
+ * @hist:		histogram of all completions since the last reset
+ *
+ */
+struct rowq_latency {
+	unsigned int		target_ms;
+	unsigned int		boost;
+	unsigned int		nr;
+	unsigned int		over_target;
+	unsigned int		over_half;
+	unsigned long		hist[ROW_HIST_BUCKETS];
+};
+
 /**
  * struct row_queue - requests grouping structure
  * @rdata:		parent row_data structure
@@ -105,6 +168,7 @@ struct rowq_idling_data {
  *			the current dispatch cycle
  * @slice:		number of requests to dispatch in a cycle
  * @idle_data:		data for idling on queues
+ * @latency:		completion latency and target
  *
  */
 struct row_queue {
@@ -117,6 +181,8 @@ struct row_queue {
 
 	/* used only for READ queues */
 	struct rowq_idling_data	idle_data;
+
+	struct rowq_latency	latency;
 };
 
 /**
@@ -135,6 +201,19 @@ struct idling_data {
 	struct delayed_work		idle_work;
 };
 
+/**
+ * struct row_target_data - state of the latency target mode
+ * @enabled:		adapt quanta to the queues' latency targets
+ * @throttle:		how far background queues are held back
+ * @window_start:	start of the current measurement window
+ *
+ */
+struct row_target_data {
+	bool				enabled;
+	unsigned int			throttle;
+	ktime_t				window_start;
+};
+
 /**
  * struct row_queue - Per block device rqueue structure
  * @dispatch_queue:	dispatch rqueue
@@ -147,6 +226,8 @@ struct idling_data {
  *			scheduler, nr_reqs[1] holds the number of all WRITE
  *			requests in scheduler
  * @cycle_flags:	used for marking unserved queueus
+ * @cycle:		number of dispatch cycles started
+ * @target:		latency target mode
  *
  */
 struct row_data {
@@ -163,9 +244,14 @@ struct row_data {
 	unsigned int			nr_reqs[2];
 
 	unsigned int			cycle_flags;
+	unsigned int			cycle;
+
+	struct row_target_data		target;
 };
 
 #define RQ_ROWQ(rq) ((struct row_queue *) ((rq)->elevator_private[0]))
+/* Insertion time in usec, truncated to what fits the pointer */
+#define RQ_INSERT_US(rq) ((unsigned long) ((rq)->elevator_private[1]))
 
 #define row_log(q, fmt, args...)   \
 	blk_add_trace_msg(q, "%s():" fmt , __func__, ##args)
@@ -238,6 +324,7 @@ static inline void row_restart_disp_cycle(struct row_data *rd)
 		rd->row_queues[i].rqueue.nr_dispatched = 0;
 
 	rd->curr_queue = ROWQ_PRIO_HIGH_READ;
+	rd->cycle++;
 	row_log(rd->dispatch_queue, "Restarting cycle");
 }
 
@@ -248,6 +335,124 @@ static inline void row_get_next_queue(struct row_data *rd)
 		row_restart_disp_cycle(rd);
 }
 
+/*
+ * row_rowq_quantum() - dispatch quantum of a queue
+ * @rd:		pointer to struct row_data
+ * @qnum:	queue to get the quantum of
+ *
+ * In latency target mode the configured quantum is scaled up for queues
+ * that miss their target and down for background queues.
+ */
+static int row_rowq_quantum(struct row_data *rd, enum row_queue_prio qnum)
+{
+	struct rowq_latency *lat = &rd->row_queues[qnum].rqueue.latency;
+	int quantum = rd->row_queues[qnum].disp_quantum;
+
+	if (!rd->target.enabled)
+		return quantum;
+	if (lat->target_ms)
+		return min(quantum, INT_MAX >> lat->boost) << lat->boost;
+	return max(quantum >> rd->target.throttle, 1);
+}
+
+static bool row_target_pending(struct row_data *rd)
+{
+	int i;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++)
+		if (rd->row_queues[i].rqueue.latency.target_ms &&
+		    !list_empty(&rd->row_queues[i].rqueue.fifo))
+			return true;
+	return false;
+}
+
+/*
+ * row_rowq_throttled() - check whether to pass over a queue this cycle
+ * @rd:		pointer to struct row_data
+ * @qnum:	queue to check
+ *
+ * Once throttling has cut a background queue's quantum down to a single
+ * request, each further level halves how often it is served: at one
+ * level above that it sits out every other cycle, and so on. It is only
+ * ever passed over in favour of a queue with a target that has requests
+ * waiting, so throttling never leaves the device idle.
+ */
+static bool row_rowq_throttled(struct row_data *rd, enum row_queue_prio qnum)
+{
+	int skip;
+
+	if (!rd->target.enabled || !rd->target.throttle ||
+	    rd->row_queues[qnum].rqueue.latency.target_ms)
+		return false;
+
+	skip = (int)rd->target.throttle -
+		ilog2(rd->row_queues[qnum].disp_quantum);
+	if (skip <= 0)
+		return false;
+
+	return (rd->cycle & ((1U << skip) - 1)) && row_target_pending(rd);
+}
+
+static void row_target_reset(struct row_data *rd)
+{
+	struct rowq_latency *lat;
+	int i;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		lat = &rd->row_queues[i].rqueue.latency;
+		lat->boost = 0;
+		lat->nr = lat->over_target = lat->over_half = 0;
+	}
+	rd->target.throttle = 0;
+	rd->target.window_start = ktime_get();
+}
+
+/*
+ * row_target_adapt() - adapt the quanta at the end of a window
+ * @rd:	pointer to struct row_data
+ *
+ * A queue misses its target when more than (100 - ROW_TARGET_PCT)% of
+ * its requests in the window took longer than the target. A missing
+ * queue gets a bigger quantum and the background queues are throttled
+ * one more level. When every queue with enough samples met half its
+ * target, the boosts and the throttling are wound back one step, so
+ * that the background queues get whatever bandwidth is left over.
+ */
+static void row_target_adapt(struct row_data *rd)
+{
+	bool miss = false, slack = true;
+	struct rowq_latency *lat;
+	int i;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		lat = &rd->row_queues[i].rqueue.latency;
+		if (!lat->target_ms || lat->nr < ROW_TARGET_MIN_SAMPLES)
+			goto next;
+
+		if (lat->over_target * 100 > lat->nr * (100 - ROW_TARGET_PCT)) {
+			miss = true;
+			slack = false;
+			if (lat->boost < ROW_MAX_BOOST)
+				lat->boost++;
+			row_log_rowq(rd, i, "missed %ums target, boost %u",
+				     lat->target_ms, lat->boost);
+		} else if (lat->over_half * 100 >
+			   lat->nr * (100 - ROW_TARGET_PCT)) {
+			slack = false;
+		} else if (lat->boost) {
+			lat->boost--;
+		}
+next:
+		lat->nr = lat->over_target = lat->over_half = 0;
+	}
+
+	if (miss && rd->target.throttle < ROW_MAX_THROTTLE)
+		rd->target.throttle++;
+	else if (slack && rd->target.throttle)
+		rd->target.throttle--;
+	row_log(rd->dispatch_queue, "throttle %u", rd->target.throttle);
+}
+
 /******************* Elevator callback functions *********************/
 
 /*
@@ -265,6 +470,8 @@ static void row_add_request(struct request_queue *q,
 	list_add_tail(&rq->queuelist, &rqueue->fifo);
 	rd->nr_reqs[rq_data_dir(rq)]++;
 	rq_set_fifo_time(rq, jiffies); /* for statistics*/
+	rq->elevator_private[1] =
+		(void *)(unsigned long)ktime_to_us(ktime_get());
 
 	if (queue_idling_enabled[rqueue->prio]) {
 		if (delayed_work_pending(&rd->read_idle.idle_work))
@@ -360,6 +567,45 @@ static void row_remove_request(struct request_queue *q,
 	rd->nr_reqs[rq_data_dir(rq)]--;
 }
 
+/*
+ * row_completed_request() - account the latency of a completed request
+ * @q:	requests queue
+ * @rq:	request that completed
+ *
+ * The latency is from insertion into the scheduler to completion by the
+ * device.
+ */
+static void row_completed_request(struct request_queue *q,
+				  struct request *rq)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+	struct rowq_latency *lat = &RQ_ROWQ(rq)->latency;
+	ktime_t now = ktime_get();
+	unsigned long us;
+	int bucket;
+
+	us = (unsigned long)ktime_to_us(now) - RQ_INSERT_US(rq);
+	bucket = us < USEC_PER_MSEC ? 0 : ilog2(us / USEC_PER_MSEC) + 1;
+	lat->hist[min(bucket, ROW_HIST_BUCKETS - 1)]++;
+
+	if (!rd->target.enabled)
+		return;
+
+	if (lat->target_ms) {
+		lat->nr++;
+		if (us > lat->target_ms * USEC_PER_MSEC)
+			lat->over_target++;
+		if (us > lat->target_ms * USEC_PER_MSEC / 2)
+			lat->over_half++;
+	}
+
+	if (ktime_to_ms(ktime_sub(now, rd->target.window_start)) >=
+	    ROW_TARGET_WINDOW_MSEC) {
+		row_target_adapt(rd);
+		rd->target.window_start = now;
+	}
+}
+
 /*
  * row_dispatch_insert() - move request to dispatch queue
  * @rd:	pointer to struct row_data
@@ -404,10 +650,12 @@ static int row_choose_queue(struct row_data *rd)
 	 * Loop over all queues to find the next queue that is not empty.
 	 * Stop when you get back to curr_queue
 	 */
-	while (list_empty(&rd->row_queues[rd->curr_queue].rqueue.fifo)
+	while ((list_empty(&rd->row_queues[rd->curr_queue].rqueue.fifo) ||
+		row_rowq_throttled(rd, rd->curr_queue))
 	       && rd->curr_queue != prev_curr_queue) {
-		/* Mark rqueue as unserved */
-		row_mark_rowq_unserved(rd, rd->curr_queue);
+		/* Mark rqueue as unserved, unless it was throttled */
+		if (list_empty(&rd->row_queues[rd->curr_queue].rqueue.fifo))
+			row_mark_rowq_unserved(rd, rd->curr_queue);
 		row_get_next_queue(rd);
 	}
 
@@ -447,7 +695,7 @@ static int row_dispatch_requests(struct request_queue *q, int force)
 	}
 
 	if (rd->row_queues[currq].rqueue.nr_dispatched >=
-	    rd->row_queues[currq].disp_quantum) {
+	    row_rowq_quantum(rd, currq)) {
 		rd->row_queues[currq].rqueue.nr_dispatched = 0;
 		row_log_rowq(rd, currq, "Expiring rqueue");
 		ret = row_choose_queue(rd);
@@ -527,7 +775,10 @@ static void *row_init_queue(struct request_queue *q)
 		rdata->row_queues[i].rqueue.idle_data.begin_idling = false;
 		rdata->row_queues[i].rqueue.idle_data.last_insert_time =
 			ktime_set(0, 0);
+		rdata->row_queues[i].rqueue.latency.target_ms =
+			queue_latency_target[i];
 	}
+	row_target_reset(rdata);
 
 	/*
 	 * Currently idling is enabled only for READ queues. If we want to
@@ -670,6 +921,21 @@ SHOW_FUNCTION(row_lp_swrite_quantum_show,
 	rowd->row_queues[ROWQ_PRIO_LOW_SWRITE].disp_quantum, 0);
 SHOW_FUNCTION(row_read_idle_show, rowd->read_idle.idle_time, 1);
 SHOW_FUNCTION(row_read_idle_freq_show, rowd->read_idle.freq, 0);
+SHOW_FUNCTION(row_hp_read_target_show,
+	rowd->row_queues[ROWQ_PRIO_HIGH_READ].rqueue.latency.target_ms, 0);
+SHOW_FUNCTION(row_rp_read_target_show,
+	rowd->row_queues[ROWQ_PRIO_REG_READ].rqueue.latency.target_ms, 0);
+SHOW_FUNCTION(row_hp_swrite_target_show,
+	rowd->row_queues[ROWQ_PRIO_HIGH_SWRITE].rqueue.latency.target_ms, 0);
+SHOW_FUNCTION(row_rp_swrite_target_show,
+	rowd->row_queues[ROWQ_PRIO_REG_SWRITE].rqueue.latency.target_ms, 0);
+SHOW_FUNCTION(row_rp_write_target_show,
+	rowd->row_queues[ROWQ_PRIO_REG_WRITE].rqueue.latency.target_ms, 0);
+SHOW_FUNCTION(row_lp_read_target_show,
+	rowd->row_queues[ROWQ_PRIO_LOW_READ].rqueue.latency.target_ms, 0);
+SHOW_FUNCTION(row_lp_swrite_target_show,
+	rowd->row_queues[ROWQ_PRIO_LOW_SWRITE].rqueue.latency.target_ms, 0);
+SHOW_FUNCTION(row_latency_target_show, rowd->target.enabled, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -710,9 +976,94 @@ STORE_FUNCTION(row_lp_swrite_quantum_store,
 			1, INT_MAX, 1);
 STORE_FUNCTION(row_read_idle_store, &rowd->read_idle.idle_time, 1, INT_MAX, 1);
 STORE_FUNCTION(row_read_idle_freq_store, &rowd->read_idle.freq, 1, INT_MAX, 0);
+STORE_FUNCTION(row_hp_read_target_store,
+		&rowd->row_queues[ROWQ_PRIO_HIGH_READ].rqueue.latency.target_ms,
+		0, ROW_TARGET_MAX_MSEC, 0);
+STORE_FUNCTION(row_rp_read_target_store,
+		&rowd->row_queues[ROWQ_PRIO_REG_READ].rqueue.latency.target_ms,
+		0, ROW_TARGET_MAX_MSEC, 0);
+STORE_FUNCTION(row_hp_swrite_target_store,
+		&rowd->row_queues[ROWQ_PRIO_HIGH_SWRITE].rqueue.latency.target_ms,
+		0, ROW_TARGET_MAX_MSEC, 0);
+STORE_FUNCTION(row_rp_swrite_target_store,
+		&rowd->row_queues[ROWQ_PRIO_REG_SWRITE].rqueue.latency.target_ms,
+		0, ROW_TARGET_MAX_MSEC, 0);
+STORE_FUNCTION(row_rp_write_target_store,
+		&rowd->row_queues[ROWQ_PRIO_REG_WRITE].rqueue.latency.target_ms,
+		0, ROW_TARGET_MAX_MSEC, 0);
+STORE_FUNCTION(row_lp_read_target_store,
+		&rowd->row_queues[ROWQ_PRIO_LOW_READ].rqueue.latency.target_ms,
+		0, ROW_TARGET_MAX_MSEC, 0);
+STORE_FUNCTION(row_lp_swrite_target_store,
+		&rowd->row_queues[ROWQ_PRIO_LOW_SWRITE].rqueue.latency.target_ms,
+		0, ROW_TARGET_MAX_MSEC, 0);
 
 #undef STORE_FUNCTION
 
+static ssize_t row_latency_target_store(struct elevator_queue *e,
+					const char *page, size_t count)
+{
+	struct row_data *rowd = e->elevator_data;
+	struct request_queue *q = rowd->dispatch_queue;
+	int enable;
+	int ret = row_var_store(&enable, page, count);
+
+	spin_lock_irq(q->queue_lock);
+	if (!!enable != rowd->target.enabled) {
+		rowd->target.enabled = !!enable;
+		row_target_reset(rowd);
+	}
+	spin_unlock_irq(q->queue_lock);
+
+	return ret;
+}
+
+/*
+ * One line per queue with its completion latency histogram, bucketed by
+ * powers of two of a msec. Writing anything clears the histograms.
+ */
+static ssize_t row_latency_hist_show(struct elevator_queue *e, char *page)
+{
+	struct row_data *rowd = e->elevator_data;
+	unsigned long *hist;
+	int i, b, len;
+
+	len = scnprintf(page, PAGE_SIZE, "%-10s", "msec");
+	for (b = 0; b < ROW_HIST_BUCKETS - 1; b++)
+		len += scnprintf(page + len, PAGE_SIZE - len, " %7s%u",
+				 "<", 1U << b);
+	len += scnprintf(page + len, PAGE_SIZE - len, " %6s%u\n",
+			 ">=", 1U << (ROW_HIST_BUCKETS - 2));
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		hist = rowd->row_queues[i].rqueue.latency.hist;
+		len += scnprintf(page + len, PAGE_SIZE - len, "%-10s",
+				 queue_name[i]);
+		for (b = 0; b < ROW_HIST_BUCKETS; b++)
+			len += scnprintf(page + len, PAGE_SIZE - len,
+					 " %8lu", hist[b]);
+		len += scnprintf(page + len, PAGE_SIZE - len, "\n");
+	}
+
+	return len;
+}
+
+static ssize_t row_latency_hist_store(struct elevator_queue *e,
+				      const char *page, size_t count)
+{
+	struct row_data *rowd = e->elevator_data;
+	struct request_queue *q = rowd->dispatch_queue;
+	int i;
+
+	spin_lock_irq(q->queue_lock);
+	for (i = 0; i < ROWQ_MAX_PRIO; i++)
+		memset(rowd->row_queues[i].rqueue.latency.hist, 0,
+		       sizeof(rowd->row_queues[i].rqueue.latency.hist));
+	spin_unlock_irq(q->queue_lock);
+
+	return count;
+}
+
 #define ROW_ATTR(name) \
 	__ATTR(name, S_IRUGO|S_IWUSR, row_##name##_show, \
 				      row_##name##_store)
@@ -727,6 +1078,15 @@ static struct elv_fs_entry row_attrs[] = {
 	ROW_ATTR(lp_swrite_quantum),
 	ROW_ATTR(read_idle),
 	ROW_ATTR(read_idle_freq),
+	ROW_ATTR(hp_read_target),
+	ROW_ATTR(rp_read_target),
+	ROW_ATTR(hp_swrite_target),
+	ROW_ATTR(rp_swrite_target),
+	ROW_ATTR(rp_write_target),
+	ROW_ATTR(lp_read_target),
+	ROW_ATTR(lp_swrite_target),
+	ROW_ATTR(latency_target),
+	ROW_ATTR(latency_hist),
 	__ATTR_NULL
 };
 
@@ -736,6 +1096,7 @@ static struct elevator_type iosched_row = {
 		.elevator_dispatch_fn		= row_dispatch_requests,
 		.elevator_add_req_fn		= row_add_request,
 		.elevator_reinsert_req_fn	= row_reinsert_req,
+		.elevator_completed_req_fn	= row_completed_request,
 		.elevator_is_urgent_fn		= row_urgent_pending,
 		.elevator_former_req_fn		= elv_rb_former_request,
 		.elevator_latter_req_fn		= elv_rb_latter_request,
@@ -747,6 +1108,7 @@ static struct elevator_type iosched_row = {
 	.elevator_attrs = row_attrs,
 	.elevator_name = "row",
 	.elevator_owner = THIS_MODULE,
+	.elevator_staging = true,
 };
 
 static int __init row_init(void)
@@ -0,0 +1,379 @@
+/*
+ * Simulated eMMC device, for comparing I/O schedulers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * emmcsim0 is a block device with a request queue, so any elevator can
+ * be put in front of it, but no storage behind it: writes are dropped
+ * and reads return zeroes.  That lets it take the offsets of a trace
+ * captured on a real, multi-gigabyte eMMC.  What it does model is the
+ * timing of an eMMC behind mmcqd:
+ *
+ *  - one command on the bus at a time, dispatched in elevator order;
+ *  - reads cost read_us plus the transfer at read_kbps;
+ *  - writes that continue the previous write cost write_seq_us, any
+ *    other write write_rand_us, plus the transfer at write_kbps;
+ *  - every gc_kb of random writes the device stalls for gc_us, the way
+ *    a managed NAND device garbage collects;
+ *  - flushes cost flush_us and discards discard_us.
+ *
+ * All of these are module parameters that can be changed at run time
+ * under /sys/module/emmc_sim/parameters; a new value applies from the
+ * next command.  Counters are in debugfs, emmc_sim/stats, and writing
+ * to that file resets them.  tools/iosched/iosched-bench replays
+ * blktrace captures against the device.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/highmem.h>
+#include <linux/hrtimer.h>
+#include <linux/delay.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
+
+#define SECTOR_SHIFT		9
+
+static unsigned int size_mb = 4096;
+module_param(size_mb, uint, S_IRUGO);
+MODULE_PARM_DESC(size_mb, "Capacity of the device in megabytes");
+
+static unsigned int read_us = 300;
+module_param(read_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(read_us, "Access time of a read command");
+
+static unsigned int read_kbps = 80000;
+module_param(read_kbps, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(read_kbps, "Read transfer rate in KB/s");
+
+static unsigned int write_seq_us = 300;
+module_param(write_seq_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(write_seq_us, "Access time of a write continuing the last one");
+
+static unsigned int write_rand_us = 3000;
+module_param(write_rand_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(write_rand_us, "Access time of any other write");
+
+static unsigned int write_kbps = 20000;
+module_param(write_kbps, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(write_kbps, "Write transfer rate in KB/s");
+
+static unsigned int gc_kb = 8192;
+module_param(gc_kb, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(gc_kb, "Random writes, in KB, between garbage collection stalls (0 = never)");
+
+static unsigned int gc_us = 30000;
+module_param(gc_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(gc_us, "Length of a garbage collection stall");
+
+static unsigned int flush_us = 1000;
+module_param(flush_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(flush_us, "Time to complete a flush");
+
+static unsigned int discard_us = 2000;
+module_param(discard_us, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(discard_us, "Time to complete a discard");
+
+struct emmc_sim_stats {
+	unsigned long		reads;
+	unsigned long		seq_writes;
+	unsigned long		rand_writes;
+	unsigned long		flushes;
+	unsigned long		discards;
+	unsigned long		gc_stalls;
+	unsigned long long	read_bytes;
+	unsigned long long	write_bytes;
+	unsigned long long	busy_us;
+	ktime_t			since;
+};
+
+struct emmc_sim {
+	spinlock_t		lock;
+	struct request_queue	*queue;
+	struct gendisk		*disk;
+	int			major;
+
+	struct request		*rq;		/* the command on the "bus" */
+	struct hrtimer		timer;		/* ... and when it is done */
+	sector_t		next_write;	/* where a sequential write starts */
+	unsigned int		gc_debt_kb;	/* random writes since the last gc */
+
+	struct emmc_sim_stats	stats;
+	struct dentry		*debugfs;
+};
+
+static struct emmc_sim *emmc_sim_dev;
+
+static unsigned int emmc_sim_xfer_us(unsigned int bytes, unsigned int kbps)
+{
+	if (!kbps)
+		return 0;
+	return div_u64((u64)bytes * USEC_PER_SEC, (u64)kbps << 10);
+}
+
+/* How long @rq keeps the device busy; updates the write and gc state. */
+static unsigned int emmc_sim_service_us(struct emmc_sim *sim,
+					struct request *rq)
+{
+	struct emmc_sim_stats *stats = &sim->stats;
+	unsigned int bytes = blk_rq_bytes(rq);
+	unsigned int us;
+
+	if (rq->cmd_flags & REQ_DISCARD) {
+		stats->discards++;
+		return discard_us;
+	}
+
+	if (rq->cmd_flags & REQ_FLUSH && !bytes) {
+		stats->flushes++;
+		return flush_us;
+	}
+
+	if (rq_data_dir(rq) == READ) {
+		stats->reads++;
+		stats->read_bytes += bytes;
+		return read_us + emmc_sim_xfer_us(bytes, read_kbps);
+	}
+
+	stats->write_bytes += bytes;
+	us = emmc_sim_xfer_us(bytes, write_kbps);
+	if (blk_rq_pos(rq) == sim->next_write) {
+		stats->seq_writes++;
+		us += write_seq_us;
+	} else {
+		stats->rand_writes++;
+		us += write_rand_us;
+		sim->gc_debt_kb += bytes >> 10;
+		if (gc_kb && sim->gc_debt_kb >= gc_kb) {
+			sim->gc_debt_kb = 0;
+			stats->gc_stalls++;
+			us += gc_us;
+		}
+	}
+	sim->next_write = blk_rq_pos(rq) + blk_rq_sectors(rq);
+
+	return us;
+}
+
+static void emmc_sim_zero_fill(struct request *rq)
+{
+	struct req_iterator iter;
+	struct bio_vec *bvec;
+	void *addr;
+
+	rq_for_each_segment(bvec, rq, iter) {
+		addr = kmap_atomic(bvec->bv_page, KM_USER0);
+		memset(addr + bvec->bv_offset, 0, bvec->bv_len);
+		kunmap_atomic(addr, KM_USER0);
+		flush_dcache_page(bvec->bv_page);
+	}
+}
+
+/*
+ * Start the next command if the bus is free.  Called with the queue
+ * lock held, from the request function and from the completion timer.
+ */
+static void emmc_sim_request(struct request_queue *q)
+{
+	struct emmc_sim *sim = q->queuedata;
+	struct request *rq;
+	unsigned int us;
+
+	while (!sim->rq) {
+		rq = blk_fetch_request(q);
+		if (!rq)
+			return;
+
+		if (rq->cmd_type != REQ_TYPE_FS) {
+			__blk_end_request_all(rq, -EIO);
+			continue;
+		}
+
+		if (rq_data_dir(rq) == READ)
+			emmc_sim_zero_fill(rq);
+
+		us = emmc_sim_service_us(sim, rq);
+		sim->stats.busy_us += us;
+		sim->rq = rq;
+		hrtimer_start(&sim->timer, ns_to_ktime((u64)us * NSEC_PER_USEC),
+			      HRTIMER_MODE_REL);
+	}
+}
+
+static enum hrtimer_restart emmc_sim_done(struct hrtimer *timer)
+{
+	struct emmc_sim *sim = container_of(timer, struct emmc_sim, timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	__blk_end_request_all(sim->rq, 0);
+	sim->rq = NULL;
+	if (!blk_queue_stopped(sim->queue))
+		emmc_sim_request(sim->queue);
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+static const struct block_device_operations emmc_sim_fops = {
+	.owner		= THIS_MODULE,
+};
+
+static int emmc_sim_stats_show(struct seq_file *s, void *unused)
+{
+	struct emmc_sim *sim = s->private;
+	struct emmc_sim_stats stats;
+	s64 ms;
+
+	spin_lock_irq(&sim->lock);
+	stats = sim->stats;
+	spin_unlock_irq(&sim->lock);
+
+	ms = ktime_to_ms(ktime_sub(ktime_get(), stats.since));
+	seq_printf(s, "elapsed_ms     %lld\n", ms);
+	seq_printf(s, "busy_ms        %llu\n",
+		   div_u64(stats.busy_us, USEC_PER_MSEC));
+	seq_printf(s, "reads          %lu\n", stats.reads);
+	seq_printf(s, "read_kb        %llu\n", stats.read_bytes >> 10);
+	seq_printf(s, "seq_writes     %lu\n", stats.seq_writes);
+	seq_printf(s, "rand_writes    %lu\n", stats.rand_writes);
+	seq_printf(s, "write_kb       %llu\n", stats.write_bytes >> 10);
+	seq_printf(s, "gc_stalls      %lu\n", stats.gc_stalls);
+	seq_printf(s, "flushes        %lu\n", stats.flushes);
+	seq_printf(s, "discards       %lu\n", stats.discards);
+
+	return 0;
+}
+
+static int emmc_sim_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, emmc_sim_stats_show, inode->i_private);
+}
+
+static ssize_t emmc_sim_stats_write(struct file *file, const char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	struct emmc_sim *sim = file->f_path.dentry->d_inode->i_private;
+
+	spin_lock_irq(&sim->lock);
+	memset(&sim->stats, 0, sizeof(sim->stats));
+	sim->stats.since = ktime_get();
+	spin_unlock_irq(&sim->lock);
+
+	return count;
+}
+
+static const struct file_operations emmc_sim_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= emmc_sim_stats_open,
+	.read		= seq_read,
+	.write		= emmc_sim_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int __init emmc_sim_init(void)
+{
+	struct request_queue *q;
+	struct gendisk *disk;
+	int ret = -ENOMEM;
+
+	emmc_sim_dev = kzalloc(sizeof(*emmc_sim_dev), GFP_KERNEL);
+	if (!emmc_sim_dev)
+		return -ENOMEM;
+
+	spin_lock_init(&emmc_sim_dev->lock);
+	hrtimer_init(&emmc_sim_dev->timer, CLOCK_MONOTONIC,
+		     HRTIMER_MODE_REL);
+	emmc_sim_dev->timer.function = emmc_sim_done;
+	emmc_sim_dev->stats.since = ktime_get();
+
+	emmc_sim_dev->major = register_blkdev(0, "emmcsim");
+	if (emmc_sim_dev->major < 0) {
+		ret = emmc_sim_dev->major;
+		goto out_free;
+	}
+
+	q = blk_init_queue(emmc_sim_request, &emmc_sim_dev->lock);
+	emmc_sim_dev->queue = q;
+	if (!q)
+		goto out_unregister;
+	q->queuedata = emmc_sim_dev;
+
+	/* the limits mmc_init_queue() sets up for a typical eMMC host */
+	blk_queue_logical_block_size(q, 512);
+	blk_queue_max_hw_sectors(q, 1024);
+	blk_queue_max_segments(q, 128);
+	blk_queue_bounce_limit(q, BLK_BOUNCE_ANY);
+	blk_queue_flush(q, REQ_FLUSH | REQ_FUA);
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, q);
+	queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, q);
+	q->limits.discard_granularity = 512 << 10;
+	q->limits.max_discard_sectors = UINT_MAX;
+
+	disk = emmc_sim_dev->disk = alloc_disk(1);
+	if (!disk)
+		goto out_queue;
+	disk->major = emmc_sim_dev->major;
+	disk->first_minor = 0;
+	disk->fops = &emmc_sim_fops;
+	disk->private_data = emmc_sim_dev;
+	disk->queue = q;
+	sprintf(disk->disk_name, "emmcsim0");
+	set_capacity(disk, (sector_t)size_mb << (20 - SECTOR_SHIFT));
+
+	emmc_sim_dev->debugfs = debugfs_create_dir("emmc_sim", NULL);
+	if (!IS_ERR_OR_NULL(emmc_sim_dev->debugfs))
+		debugfs_create_file("stats", S_IRUGO | S_IWUSR,
+				    emmc_sim_dev->debugfs, emmc_sim_dev,
+				    &emmc_sim_stats_fops);
+
+	add_disk(disk);
+	printk(KERN_INFO "emmc_sim: %u MB simulated eMMC as %s\n",
+	       size_mb, disk->disk_name);
+	return 0;
+
+out_queue:
+	blk_cleanup_queue(q);
+out_unregister:
+	unregister_blkdev(emmc_sim_dev->major, "emmcsim");
+out_free:
+	kfree(emmc_sim_dev);
+	return ret;
+}
+
+static void __exit emmc_sim_exit(void)
+{
+	struct emmc_sim *sim = emmc_sim_dev;
+
+	debugfs_remove_recursive(sim->debugfs);
+
+	/* Start nothing new and let the command on the bus complete. */
+	spin_lock_irq(&sim->lock);
+	blk_stop_queue(sim->queue);
+	while (sim->rq) {
+		spin_unlock_irq(&sim->lock);
+		msleep(1);
+		spin_lock_irq(&sim->lock);
+	}
+	spin_unlock_irq(&sim->lock);
+	hrtimer_cancel(&sim->timer);
+
+	del_gendisk(sim->disk);
+	blk_cleanup_queue(sim->queue);
+	put_disk(sim->disk);
+	unregister_blkdev(sim->major, "emmcsim");
+	kfree(sim);
+}
+
+module_init(emmc_sim_init);
+module_exit(emmc_sim_exit);
+
+MODULE_DESCRIPTION("Simulated eMMC device for I/O scheduler benchmarks");
+MODULE_LICENSE("GPL");
@@ -34,6 +34,8 @@
 #include <linux/delay.h>
 #include <linux/capability.h>
 #include <linux/compat.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <linux/mmc/ioctl.h>
 #include <linux/mmc/card.h>
@@ -46,6 +48,9 @@
 
 #include "queue.h"
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/mmc.h>
+
 MODULE_ALIAS("mmc:block");
 #ifdef MODULE_PARAM_PREFIX
 #undef MODULE_PARAM_PREFIX
@@ -61,6 +66,13 @@ MODULE_ALIAS("mmc:block");
 
 #define MMC_CMD_RETRIES 	10
 
+#define PACKED_CMD_VER	0x01
+#define PACKED_CMD_WR	0x02
+
+#define mmc_req_rel_wr(req)	(((req->cmd_flags & REQ_FUA) || \
+				  (req->cmd_flags & REQ_META)) && \
+				 (rq_data_dir(req) == WRITE))
+
 #ifdef	CONFIG_MACH_SAMSUNG_P4WIFI
 #define	MAX_BLK_WR_RETRIES	2
 #endif
@@ -95,6 +107,7 @@ struct mmc_blk_data {
 	unsigned int	flags;
 #define MMC_BLK_CMD23	(1 << 0)	/* Can do SET_BLOCK_COUNT for multiblock */
 #define MMC_BLK_REL_WR	(1 << 1)	/* MMC Reliable write support */
+#define MMC_BLK_PACKED_CMD	(1 << 2)	/* MMC packed write support */
 
 	unsigned int	usage;
 	unsigned int	read_only;
@@ -108,6 +121,9 @@ struct mmc_blk_data {
 	 */
 	unsigned int	part_curr;
 	struct device_attribute force_ro;
+#ifdef CONFIG_DEBUG_FS
+	struct dentry	*packed_stats;
+#endif
 };
 
 static DEFINE_MUTEX(open_lock);
@@ -788,15 +804,26 @@ out:
 static int mmc_blk_issue_flush(struct mmc_queue *mq, struct request *req)
 {
 	struct mmc_blk_data *md = mq->data;
+	bool inflight = md->queue.card->host->areq != NULL;
 
 	/*
 	 * No-op, only service this because we need REQ_FUA for reliable
 	 * writes.
+	 *
+	 * With no cache to flush, a flush only covers writes that completed
+	 * before it was issued, and a write only completes once the card
+	 * has left the programming state.  So the write still on the bus
+	 * need not be drained: the flush completes right away and hands its
+	 * slot back, leaving that write the one in flight.
 	 */
 	spin_lock_irq(&md->lock);
 	__blk_end_request_all(req, 0);
 	spin_unlock_irq(&md->lock);
 
+	if (inflight)
+		mq->mqrq_cur->req = NULL;
+	trace_mmc_blk_flush(md->disk->disk_name, inflight);
+
 	return 1;
 }
 
@@ -919,9 +946,21 @@ static int mmc_blk_err_check(struct mmc_card *card,
 		}
 	}
 
-	if (ret == MMC_BLK_SUCCESS &&
-	    blk_rq_bytes(req) != brq->data.bytes_xfered)
-		ret = MMC_BLK_PARTIAL;
+	if (ret == MMC_BLK_SUCCESS) {
+		/*
+		 * A packed transfer carries the header block and every
+		 * entry, not just the first request.  Which entries made
+		 * it on a short one is not known, so send the group again;
+		 * mmc_blk_packed_err_check() turns an indexed error into
+		 * MMC_BLK_PARTIAL.
+		 */
+		if (mmc_packed_cmd(mq_mrq->cmd_type)) {
+			if (brq->data.bytes_xfered != brq->data.blocks << 9)
+				ret = MMC_BLK_RETRY;
+		} else if (brq->data.bytes_xfered != blk_rq_bytes(req)) {
+			ret = MMC_BLK_PARTIAL;
+		}
+	}
 
 	return ret;
 }
@@ -1063,6 +1102,381 @@ static void mmc_blk_rw_rq_prep(struct mmc_queue_req *mqrq,
 	mmc_queue_bounce_pre(mqrq);
 }
 
+static inline void mmc_blk_clear_packed(struct mmc_queue_req *mqrq)
+{
+	struct mmc_packed *packed = mqrq->packed;
+
+	mqrq->cmd_type = MMC_PACKED_NONE;
+	if (!packed)
+		return;
+	packed->nr_entries = MMC_PACKED_NR_ZERO;
+	packed->idx_failure = MMC_PACKED_NR_IDX;
+	packed->retries = 0;
+	packed->blocks = 0;
+}
+
+/*
+ * Collect the write requests queued behind @req into a packed group.  They
+ * are taken off the queue as they are looked at; the first one that cannot
+ * go into the group is put back.  Returns the number of requests in the
+ * group, or 0 if @req is to be issued on its own.
+ */
+static u8 mmc_blk_prep_packed_list(struct mmc_queue *mq, struct request *req)
+{
+	struct request_queue *q = mq->queue;
+	struct mmc_card *card = mq->card;
+	struct request *cur = req, *next = NULL;
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_queue_req *mqrq = mq->mqrq_cur;
+	struct mmc_packed_stats *stats = &mq->packed_stats;
+	bool en_rel_wr = card->ext_csd.rel_param & EXT_CSD_WR_REL_PARAM_EN;
+	unsigned int req_sectors = 0, phys_segments = 0;
+	unsigned int max_blk_count, max_phys_segs;
+	enum mmc_packed_stop stop;
+	bool put_back = true;
+	u8 max_packed_rw;
+	u8 reqs = 0;
+
+	if (!(md->flags & MMC_BLK_PACKED_CMD))
+		goto no_packed;
+
+	if (rq_data_dir(cur) != WRITE)
+		goto no_packed;
+
+	/*
+	 * Legacy reliable writes are limited to rel_sectors per command,
+	 * so only the enhanced variant can be packed.
+	 */
+	if (mmc_req_rel_wr(cur) &&
+	    (md->flags & MMC_BLK_REL_WR) && !en_rel_wr)
+		goto no_packed;
+
+	max_packed_rw = min_t(u8, card->ext_csd.max_packed_writes,
+			      MMC_PACKED_MAX_ENTRIES);
+	mmc_blk_clear_packed(mqrq);
+
+	max_blk_count = min(card->host->max_blk_count,
+			    card->host->max_req_size >> 9);
+	if (unlikely(max_blk_count > 0xffff))
+		max_blk_count = 0xffff;
+
+	max_phys_segs = queue_max_segments(q);
+	/* the header block takes a segment and a block of its own */
+	req_sectors += blk_rq_sectors(cur) + 1;
+	phys_segments += cur->nr_phys_segments + 1;
+
+	do {
+		if (reqs >= max_packed_rw - 1) {
+			stop = MMC_PACKED_STOP_MAX_ENTRIES;
+			put_back = false;
+			break;
+		}
+
+		spin_lock_irq(q->queue_lock);
+		next = blk_fetch_request(q);
+		spin_unlock_irq(q->queue_lock);
+		if (!next) {
+			stop = MMC_PACKED_STOP_EMPTY;
+			put_back = false;
+			break;
+		}
+
+		if (next->cmd_flags & REQ_DISCARD ||
+		    next->cmd_flags & REQ_FLUSH) {
+			stop = MMC_PACKED_STOP_FLUSH_DISCARD;
+			break;
+		}
+
+		if (rq_data_dir(cur) != rq_data_dir(next)) {
+			stop = MMC_PACKED_STOP_NOT_WRITE;
+			break;
+		}
+
+		if (mmc_req_rel_wr(next) &&
+		    (md->flags & MMC_BLK_REL_WR) && !en_rel_wr) {
+			stop = MMC_PACKED_STOP_REL_WR;
+			break;
+		}
+
+		req_sectors += blk_rq_sectors(next);
+		if (req_sectors > max_blk_count) {
+			stop = MMC_PACKED_STOP_SIZE;
+			break;
+		}
+
+		phys_segments += next->nr_phys_segments;
+		if (phys_segments > max_phys_segs) {
+			stop = MMC_PACKED_STOP_SEGS;
+			break;
+		}
+
+		list_add_tail(&next->queuelist, &mqrq->packed->list);
+		cur = next;
+		reqs++;
+	} while (1);
+
+	if (put_back) {
+		spin_lock_irq(q->queue_lock);
+		blk_requeue_request(q, next);
+		spin_unlock_irq(q->queue_lock);
+	}
+
+	stats->stop[stop]++;
+	if (reqs > 0) {
+		list_add(&req->queuelist, &mqrq->packed->list);
+		mqrq->packed->nr_entries = ++reqs;
+		mqrq->packed->retries = reqs;
+		return reqs;
+	}
+
+no_packed:
+	mqrq->cmd_type = MMC_PACKED_NONE;
+	return 0;
+}
+
+static int mmc_blk_packed_err_check(struct mmc_card *card,
+				    struct mmc_async_req *areq)
+{
+	struct mmc_queue_req *mq_rq = container_of(areq, struct mmc_queue_req,
+						    mmc_active);
+	struct request *req = mq_rq->req;
+	struct mmc_packed *packed = mq_rq->packed;
+	int err, check;
+	u32 status;
+	u8 *ext_csd;
+
+	packed->retries--;
+	check = mmc_blk_err_check(card, areq);
+	err = get_card_status(card, &status, 0);
+	if (err) {
+		pr_err("%s: error %d sending status command\n",
+		       req->rq_disk->disk_name, err);
+		return MMC_BLK_ABORT;
+	}
+
+	if (!(status & R1_EXCEPTION_EVENT))
+		return check;
+
+	ext_csd = kzalloc(512, GFP_KERNEL);
+	if (!ext_csd) {
+		pr_err("%s: unable to allocate buffer for ext_csd\n",
+		       req->rq_disk->disk_name);
+		return MMC_BLK_ABORT;
+	}
+
+	err = mmc_send_ext_csd(card, ext_csd);
+	if (err) {
+		pr_err("%s: error %d sending ext_csd\n",
+		       req->rq_disk->disk_name, err);
+		check = MMC_BLK_ABORT;
+		goto free;
+	}
+
+	/*
+	 * With an indexed error, the entries before the failed one were
+	 * written; the rest is retried from the failed entry on.
+	 */
+	if ((ext_csd[EXT_CSD_EXP_EVENTS_STATUS] & EXT_CSD_PACKED_FAILURE) &&
+	    (ext_csd[EXT_CSD_PACKED_CMD_STATUS] &
+	     EXT_CSD_PACKED_GENERIC_ERROR)) {
+		if (ext_csd[EXT_CSD_PACKED_CMD_STATUS] &
+		    EXT_CSD_PACKED_INDEXED_ERROR) {
+			packed->idx_failure =
+				ext_csd[EXT_CSD_PACKED_FAILURE_INDEX] - 1;
+			check = MMC_BLK_PARTIAL;
+		}
+		pr_err("%s: packed cmd status = %02x, index = %d, failure index = %d\n",
+		       req->rq_disk->disk_name,
+		       ext_csd[EXT_CSD_PACKED_CMD_STATUS],
+		       ext_csd[EXT_CSD_PACKED_FAILURE_INDEX],
+		       packed->idx_failure);
+	}
+free:
+	kfree(ext_csd);
+
+	return check;
+}
+
+static void mmc_blk_packed_hdr_wrq_prep(struct mmc_queue_req *mqrq,
+					struct mmc_card *card,
+					struct mmc_queue *mq)
+{
+	struct mmc_blk_request *brq = &mqrq->brq;
+	struct request *req = mqrq->req;
+	struct request *prq;
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_packed *packed = mqrq->packed;
+	__le32 *packed_cmd_hdr;
+	bool do_rel_wr;
+	u32 arg;
+	u8 i = 1;
+
+	mqrq->cmd_type = MMC_PACKED_WRITE;
+	packed->blocks = 0;
+	packed->idx_failure = MMC_PACKED_NR_IDX;
+
+	packed_cmd_hdr = packed->cmd_hdr;
+	memset(packed_cmd_hdr, 0, sizeof(packed->cmd_hdr));
+	packed_cmd_hdr[0] = cpu_to_le32((packed->nr_entries << 16) |
+					(PACKED_CMD_WR << 8) | PACKED_CMD_VER);
+
+	/*
+	 * Argument for each entry of packed group
+	 */
+	list_for_each_entry(prq, &packed->list, queuelist) {
+		BUG_ON(i > MMC_PACKED_MAX_ENTRIES);
+		do_rel_wr = mmc_req_rel_wr(prq) && (md->flags & MMC_BLK_REL_WR);
+		/* Argument of CMD23 */
+		arg = (do_rel_wr ? MMC_CMD23_ARG_REL_WR : 0) |
+			blk_rq_sectors(prq);
+		packed_cmd_hdr[i * 2] = cpu_to_le32(arg);
+		/* Argument of CMD25 */
+		arg = blk_rq_pos(prq);
+		if (!mmc_card_blockaddr(card))
+			arg <<= 9;
+		packed_cmd_hdr[i * 2 + 1] = cpu_to_le32(arg);
+		packed->blocks += blk_rq_sectors(prq);
+		i++;
+	}
+
+	memset(brq, 0, sizeof(struct mmc_blk_request));
+	brq->mrq.cmd = &brq->cmd;
+	brq->mrq.data = &brq->data;
+	brq->mrq.sbc = &brq->sbc;
+	brq->mrq.stop = &brq->stop;
+
+	brq->sbc.opcode = MMC_SET_BLOCK_COUNT;
+	brq->sbc.arg = MMC_CMD23_ARG_PACKED | (packed->blocks + 1);
+	brq->sbc.flags = MMC_RSP_R1 | MMC_CMD_AC;
+
+	brq->cmd.opcode = MMC_WRITE_MULTIPLE_BLOCK;
+	brq->cmd.arg = blk_rq_pos(req);
+	if (!mmc_card_blockaddr(card))
+		brq->cmd.arg <<= 9;
+	brq->cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
+	brq->cmd.retries = MMC_CMD_RETRIES;
+
+	brq->data.blksz = 512;
+	brq->data.blocks = packed->blocks + 1;
+	brq->data.flags |= MMC_DATA_WRITE;
+
+	brq->stop.opcode = MMC_STOP_TRANSMISSION;
+	brq->stop.arg = 0;
+	brq->stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
+
+	mmc_set_data_timeout(&brq->data, card);
+
+	brq->data.sg = mqrq->sg;
+	brq->data.sg_len = mmc_queue_map_sg(mq, mqrq);
+
+	mqrq->mmc_active.mrq = &brq->mrq;
+	mqrq->mmc_active.err_check = mmc_blk_packed_err_check;
+
+	mmc_queue_bounce_pre(mqrq);
+}
+
+/*
+ * Complete the entries of a packed group up to the one that failed, if
+ * any.  Returns 1 when entries are left to be retried: mq_rq->req then
+ * points at the first of them, and a single remaining entry is turned
+ * back into an ordinary request.
+ */
+static int mmc_blk_end_packed_req(struct mmc_blk_data *md,
+				  struct mmc_queue_req *mq_rq)
+{
+	struct mmc_packed *packed = mq_rq->packed;
+	struct request *prq;
+	int idx = packed->idx_failure, i = 0;
+
+	while (!list_empty(&packed->list)) {
+		prq = list_entry_rq(packed->list.next);
+		if (idx == i) {
+			/* retry from error index */
+			packed->nr_entries -= idx;
+			mq_rq->req = prq;
+
+			if (packed->nr_entries == MMC_PACKED_NR_SINGLE) {
+				list_del_init(&prq->queuelist);
+				mmc_blk_clear_packed(mq_rq);
+			}
+			return 1;
+		}
+		list_del_init(&prq->queuelist);
+		spin_lock_irq(&md->lock);
+		__blk_end_request(prq, 0, blk_rq_bytes(prq));
+		spin_unlock_irq(&md->lock);
+		i++;
+	}
+
+	mmc_blk_clear_packed(mq_rq);
+	return 0;
+}
+
+static void mmc_blk_abort_packed_req(struct mmc_blk_data *md,
+				     struct mmc_queue_req *mq_rq)
+{
+	struct mmc_packed *packed = mq_rq->packed;
+	struct request *prq;
+
+	while (!list_empty(&packed->list)) {
+		prq = list_entry_rq(packed->list.next);
+		list_del_init(&prq->queuelist);
+		spin_lock_irq(&md->lock);
+		__blk_end_request(prq, -EIO, blk_rq_bytes(prq));
+		spin_unlock_irq(&md->lock);
+	}
+
+	mmc_blk_clear_packed(mq_rq);
+}
+
+/*
+ * The group was built but never issued: everything except the first
+ * request, which the caller issues on its own, goes back to the queue.
+ */
+static void mmc_blk_revert_packed_req(struct mmc_queue *mq,
+				      struct mmc_queue_req *mq_rq)
+{
+	struct mmc_packed *packed = mq_rq->packed;
+	struct request_queue *q = mq->queue;
+	struct request *prq;
+
+	while (!list_empty(&packed->list)) {
+		prq = list_entry_rq(packed->list.prev);
+		list_del_init(&prq->queuelist);
+		if (prq != mq_rq->req) {
+			spin_lock_irq(q->queue_lock);
+			blk_requeue_request(q, prq);
+			spin_unlock_irq(q->queue_lock);
+		}
+	}
+
+	mmc_blk_clear_packed(mq_rq);
+}
+
+static void mmc_blk_stamp_prep(struct mmc_queue_req *mq_rq, u8 reqs)
+{
+	mq_rq->stamps.prep = sched_clock();
+	mq_rq->stamps.nr_reqs = reqs ? reqs : 1;
+}
+
+static void mmc_blk_trace_rw_done(struct mmc_blk_data *md,
+				  struct mmc_queue_req *mq_rq, int error)
+{
+	struct mmc_queue_stamps *st = &mq_rq->stamps;
+	struct mmc_blk_request *brq = &mq_rq->brq;
+	sector_t sector = brq->cmd.arg;
+
+	if (!mmc_card_blockaddr(md->queue.card))
+		sector >>= 9;
+
+	trace_mmc_blk_rw_done(md->disk->disk_name,
+			      brq->data.flags & MMC_DATA_WRITE, sector,
+			      brq->data.blksz * brq->data.blocks, st->nr_reqs,
+			      error, st->fetch - st->queued,
+			      st->prep - st->fetch, st->start - st->prep,
+			      st->done - st->start, sched_clock() - st->done);
+}
+
 static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 {
 	struct mmc_blk_data *md = mq->data;
@@ -1073,6 +1487,8 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 	struct mmc_queue_req *mq_rq;
 	struct request *req;
 	struct mmc_async_req *areq;
+	struct mmc_packed_stats *stats = &mq->packed_stats;
+	u8 reqs = 0;
 #ifdef	CONFIG_MACH_SAMSUNG_P4WIFI
 	int write_retry = MAX_BLK_WR_RETRIES;
 #endif
@@ -1080,17 +1496,37 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 	if (!rqc && !mq->mqrq_prev->req)
 		return 0;
 
+	if (rqc) {
+		reqs = mmc_blk_prep_packed_list(mq, rqc);
+		if (rq_data_dir(rqc) == WRITE) {
+			stats->write_reqs += reqs ? reqs : 1;
+			stats->write_cmds++;
+		}
+		if (reqs) {
+			stats->packed_cmds++;
+			stats->packed_reqs += reqs;
+			stats->nr_entries[min_t(u8, reqs, MMC_PACKED_HIST)]++;
+		}
+	}
+
 	do {
 		if (rqc) {
-			mmc_blk_rw_rq_prep(mq->mqrq_cur, card, 0, mq);
+			if (reqs)
+				mmc_blk_packed_hdr_wrq_prep(mq->mqrq_cur, card, mq);
+			else
+				mmc_blk_rw_rq_prep(mq->mqrq_cur, card, 0, mq);
+			mmc_blk_stamp_prep(mq->mqrq_cur, reqs);
 			areq = &mq->mqrq_cur->mmc_active;
 		} else
 			areq = NULL;
 		areq = mmc_start_req(card->host, areq, (int *) &status);
+		if (rqc)
+			mq->mqrq_cur->stamps.start = sched_clock();
 		if (!areq)
 			return 0;
 
 		mq_rq = container_of(areq, struct mmc_queue_req, mmc_active);
+		mq_rq->stamps.done = sched_clock();
 		brq = &mq_rq->brq;
 		req = mq_rq->req;
 		mmc_queue_bounce_post(mq_rq);
@@ -1101,6 +1537,10 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 			/*
 			 * A block was successfully transferred.
 			 */
+			if (mmc_packed_cmd(mq_rq->cmd_type)) {
+				ret = mmc_blk_end_packed_req(md, mq_rq);
+				break;
+			}
 			spin_lock_irq(&md->lock);
 			ret = __blk_end_request(req, 0,
 						brq->data.bytes_xfered);
@@ -1155,7 +1595,17 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 			break;
 		}
 
-		if (ret) {
+		if (ret && mmc_packed_cmd(mq_rq->cmd_type)) {
+			/*
+			 * Resend what is left of the packed group, at most
+			 * once per entry it started out with.
+			 */
+			if (!mq_rq->packed->retries)
+				goto cmd_abort;
+			stats->packed_retries++;
+			mmc_blk_packed_hdr_wrq_prep(mq_rq, card, mq);
+			mmc_start_req(card->host, &mq_rq->mmc_active, NULL);
+		} else if (ret) {
 			/*
 			 * In case of a none complete request
 			 * prepare it again and resend.
@@ -1165,12 +1615,17 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 		}
 	} while (ret);
 
+	mmc_blk_trace_rw_done(md, mq_rq, 0);
+
 	if (brq->cmd.resp[0] & R1_URGENT_BKOPS)
 		mmc_card_set_need_bkops(card);
 
 	return 1;
 
  cmd_err:
+	/* which entries of a packed group made it is not known */
+	if (mmc_packed_cmd(mq_rq->cmd_type))
+		goto cmd_abort;
  	/*
  	 * If this is an SD card and we're writing, we can first
  	 * mark the known good sectors as ok.
@@ -1195,15 +1650,31 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 	}
 
  cmd_abort:
-	spin_lock_irq(&md->lock);
-	while (ret)
-		ret = __blk_end_request(req, -EIO, blk_rq_cur_bytes(req));
-	spin_unlock_irq(&md->lock);
+	if (mmc_packed_cmd(mq_rq->cmd_type)) {
+		stats->packed_aborts++;
+		mmc_blk_abort_packed_req(md, mq_rq);
+	} else {
+		spin_lock_irq(&md->lock);
+		while (ret)
+			ret = __blk_end_request(req, -EIO,
+						blk_rq_cur_bytes(req));
+		spin_unlock_irq(&md->lock);
+	}
 
  start_new_req:
+	mmc_blk_trace_rw_done(md, mq_rq, -EIO);
+
 	if (rqc) {
+		/*
+		 * The request that was about to be issued is sent on its
+		 * own; the rest of its packed group goes back to the queue.
+		 */
+		if (mmc_packed_cmd(mq->mqrq_cur->cmd_type))
+			mmc_blk_revert_packed_req(mq, mq->mqrq_cur);
 		mmc_blk_rw_rq_prep(mq->mqrq_cur, card, 0, mq);
+		mmc_blk_stamp_prep(mq->mqrq_cur, 0);
 		mmc_start_req(card->host, &mq->mqrq_cur->mmc_active, NULL);
+		mq->mqrq_cur->stamps.start = sched_clock();
 	}
 
 	return 0;
@@ -1212,6 +1683,35 @@ static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
 static int
 mmc_blk_set_blksize(struct mmc_blk_data *md, struct mmc_card *card);
 
+/*
+ * The erase needs the bus, so the async transfer in flight has to
+ * complete first; the discard then takes its place in the pipeline.
+ */
+static int mmc_blk_issue_ordered_discard(struct mmc_queue *mq,
+					 struct request *req)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_card *card = md->queue.card;
+	sector_t from = blk_rq_pos(req);
+	unsigned int nr = blk_rq_sectors(req);
+	u64 wait, erase;
+	int ret;
+
+	wait = sched_clock();
+	if (card->host->areq)
+		mmc_blk_issue_rw_rq(mq, NULL);
+	erase = sched_clock();
+
+	if (req->cmd_flags & REQ_SECURE)
+		ret = mmc_blk_issue_secdiscard_rq(mq, req);
+	else
+		ret = mmc_blk_issue_discard_rq(mq, req);
+
+	trace_mmc_blk_discard(md->disk->disk_name, from, nr, erase - wait,
+			      sched_clock() - erase);
+	return ret;
+}
+
 static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 {
 	int ret;
@@ -1236,17 +1736,9 @@ static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
 	}
 
 	if (req && req->cmd_flags & REQ_DISCARD) {
-		/* complete ongoing async transfer before issuing discard */
-		if (card->host->areq)
-			mmc_blk_issue_rw_rq(mq, NULL);
-		if (req->cmd_flags & REQ_SECURE)
-			ret = mmc_blk_issue_secdiscard_rq(mq, req);
-		else
-			ret = mmc_blk_issue_discard_rq(mq, req);
+		ret = mmc_blk_issue_ordered_discard(mq, req);
 	} else if (req && req->cmd_flags & REQ_FLUSH) {
-		/* complete ongoing async transfer before issuing flush */
-		if (card->host->areq)
-			mmc_blk_issue_rw_rq(mq, NULL);
+		/* no drain here, see mmc_blk_issue_flush() */
 		ret = mmc_blk_issue_flush(mq, req);
 	} else {
 		/* Abort any current bk ops of eMMC card by issuing HPI */
@@ -1368,6 +1860,14 @@ static struct mmc_blk_data *mmc_blk_alloc_req(struct mmc_card *card,
 		blk_queue_flush(md->queue.queue, REQ_FLUSH | REQ_FUA);
 	}
 
+	/*
+	 * Packed writes go out as CMD23 + CMD25; the queue only has the
+	 * header buffers if the card can report packed failures.
+	 */
+	if (mmc_card_mmc(card) && md->flags & MMC_BLK_CMD23 &&
+	    md->queue.mqrq_cur->packed)
+		md->flags |= MMC_BLK_PACKED_CMD;
+
 	return md;
 
  err_putdisk:
@@ -1469,9 +1969,118 @@ mmc_blk_set_blksize(struct mmc_blk_data *md, struct mmc_card *card)
 	return 0;
 }
 
+#ifdef CONFIG_DEBUG_FS
+static const char * const mmc_packed_stop_names[MMC_PACKED_NR_STOP] = {
+	[MMC_PACKED_STOP_EMPTY]		= "queue_empty",
+	[MMC_PACKED_STOP_MAX_ENTRIES]	= "max_entries",
+	[MMC_PACKED_STOP_NOT_WRITE]	= "not_write",
+	[MMC_PACKED_STOP_FLUSH_DISCARD]	= "flush_discard",
+	[MMC_PACKED_STOP_REL_WR]	= "reliable_write",
+	[MMC_PACKED_STOP_SIZE]		= "max_blocks",
+	[MMC_PACKED_STOP_SEGS]		= "max_segments",
+};
+
+static int mmc_blk_packed_stats_show(struct seq_file *s, void *data)
+{
+	struct mmc_blk_data *md = s->private;
+	struct mmc_packed_stats *st = &md->queue.packed_stats;
+	u64 ms;
+	int i;
+
+	ms = ktime_to_ms(ktime_sub(ktime_get(), st->since));
+	if (!ms)
+		ms = 1;
+
+	seq_printf(s, "packed writes: %s, max %u entries\n",
+		   md->flags & MMC_BLK_PACKED_CMD ? "on" : "off",
+		   md->queue.card->ext_csd.max_packed_writes);
+	seq_printf(s, "elapsed_ms:     %llu\n", (unsigned long long)ms);
+	seq_printf(s, "write_reqs:     %lu\n", st->write_reqs);
+	seq_printf(s, "write_cmds:     %lu\n", st->write_cmds);
+	seq_printf(s, "write_iops:     %llu\n",
+		   div64_u64((u64)st->write_reqs * 1000, ms));
+	seq_printf(s, "packed_cmds:    %lu\n", st->packed_cmds);
+	seq_printf(s, "packed_reqs:    %lu\n", st->packed_reqs);
+	/* write requests per command, in hundredths */
+	seq_printf(s, "packing_ratio:  %lu\n", st->write_cmds ?
+		   st->write_reqs * 100 / st->write_cmds : 0);
+	seq_printf(s, "packed_retries: %lu\n", st->packed_retries);
+	seq_printf(s, "packed_aborts:  %lu\n", st->packed_aborts);
+
+	seq_printf(s, "entries:");
+	for (i = 2; i <= MMC_PACKED_HIST; i++)
+		if (st->nr_entries[i])
+			seq_printf(s, " %d%s:%lu", i,
+				   i == MMC_PACKED_HIST ? "+" : "",
+				   st->nr_entries[i]);
+	seq_printf(s, "\nstopped by:");
+	for (i = 0; i < MMC_PACKED_NR_STOP; i++)
+		seq_printf(s, " %s:%lu", mmc_packed_stop_names[i], st->stop[i]);
+	seq_printf(s, "\n");
+	return 0;
+}
+
+static int mmc_blk_packed_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mmc_blk_packed_stats_show, inode->i_private);
+}
+
+/* any write resets the counters */
+static ssize_t mmc_blk_packed_stats_write(struct file *file,
+					  const char __user *buf,
+					  size_t count, loff_t *ppos)
+{
+	struct mmc_blk_data *md = ((struct seq_file *)
+				   file->private_data)->private;
+	struct mmc_packed_stats *st = &md->queue.packed_stats;
+
+	memset(st, 0, sizeof(*st));
+	st->since = ktime_get();
+	return count;
+}
+
+static const struct file_operations mmc_blk_packed_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= mmc_blk_packed_stats_open,
+	.read		= seq_read,
+	.write		= mmc_blk_packed_stats_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void mmc_blk_add_debugfs(struct mmc_card *card, struct mmc_blk_data *md)
+{
+	char name[DISK_NAME_LEN + 8];
+
+	if (!card->debugfs_root || !mmc_card_mmc(card))
+		return;
+
+	snprintf(name, sizeof(name), "%s_packed", md->disk->disk_name);
+	md->packed_stats = debugfs_create_file(name, S_IRUSR | S_IWUSR,
+					       card->debugfs_root, md,
+					       &mmc_blk_packed_stats_fops);
+}
+
+static void mmc_blk_remove_debugfs(struct mmc_blk_data *md)
+{
+	debugfs_remove(md->packed_stats);
+	md->packed_stats = NULL;
+}
+#else
+static inline void mmc_blk_add_debugfs(struct mmc_card *card,
+				       struct mmc_blk_data *md)
+{
+}
+
+static inline void mmc_blk_remove_debugfs(struct mmc_blk_data *md)
+{
+}
+#endif /* CONFIG_DEBUG_FS */
+
 static void mmc_blk_remove_req(struct mmc_blk_data *md)
 {
 	if (md) {
+		mmc_blk_remove_debugfs(md);
 		if (md->disk->flags & GENHD_FL_UP) {
 			device_remove_file(disk_to_dev(md->disk), &md->force_ro);
 
@@ -1510,10 +2119,13 @@ static int mmc_add_disk(struct mmc_blk_data *md)
 	md->force_ro.attr.name = "force_ro";
 	md->force_ro.attr.mode = S_IRUGO | S_IWUSR;
 	ret = device_create_file(disk_to_dev(md->disk), &md->force_ro);
-	if (ret)
+	if (ret) {
 		del_gendisk(md->disk);
+		return ret;
+	}
 
-	return ret;
+	mmc_blk_add_debugfs(md->queue.card, md);
+	return 0;
 }
 
 static const struct mmc_fixup blk_fixups[] =
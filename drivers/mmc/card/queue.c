@@ -42,6 +42,19 @@ static int mmc_prep_request(struct request_queue *q, struct request *req)
 	return BLKPREP_OK;
 }
 
+static void mmc_queue_stamp_fetch(struct mmc_queue_req *mqrq,
+				  struct request *req)
+{
+	u64 now = sched_clock();
+
+	mqrq->stamps.fetch = now;
+	mqrq->stamps.queued = rq_start_time_ns(req);
+	/* without blk-cgroup the block layer only keeps a jiffies stamp */
+	if (!mqrq->stamps.queued)
+		mqrq->stamps.queued = now - (u64)NSEC_PER_USEC *
+			jiffies_to_usecs(jiffies - req->start_time);
+}
+
 static int mmc_queue_thread(void *d)
 {
 	struct mmc_queue *mq = d;
@@ -60,6 +73,9 @@ static int mmc_queue_thread(void *d)
 		mq->mqrq_cur->req = req;
 		spin_unlock_irq(q->queue_lock);
 
+		if (req)
+			mmc_queue_stamp_fetch(mq->mqrq_cur, req);
+
 		if (req || mq->mqrq_prev->req) {
 			set_current_state(TASK_RUNNING);
 			mq->issue_fn(mq, req);
@@ -79,6 +95,14 @@ static int mmc_queue_thread(void *d)
 			down(&mq->thread_sem);
 		}
 
+		/*
+		 * A request that issue_fn completed while the previous one
+		 * stayed on the bus (a flush) gives its slot back by clearing
+		 * ->req; the previous request then keeps its own slot.
+		 */
+		if (req && !mq->mqrq_cur->req)
+			continue;
+
 		/* Current request becomes previous request and vice versa. */
 		mq->mqrq_prev->brq.mrq.data = NULL;
 		mq->mqrq_prev->req = NULL;
@@ -129,6 +153,48 @@ struct scatterlist *mmc_alloc_sg(int sg_len, int *err)
 	return sg;
 }
 
+/*
+ * Packed writes need the header block in a segment of its own in front of
+ * the data, so they are not used with a bounce buffer.
+ */
+static void mmc_packed_init(struct mmc_queue *mq, struct mmc_card *card)
+{
+	struct mmc_queue_req *mqrq_cur = &mq->mqrq[0];
+	struct mmc_queue_req *mqrq_prev = &mq->mqrq[1];
+
+	if (!mmc_card_mmc(card) || !card->ext_csd.packed_event_en ||
+	    card->ext_csd.data_sector_size != 512 ||
+	    mqrq_cur->bounce_buf)
+		return;
+
+	mqrq_cur->packed = kzalloc(sizeof(struct mmc_packed), GFP_KERNEL);
+	mqrq_prev->packed = kzalloc(sizeof(struct mmc_packed), GFP_KERNEL);
+	if (!mqrq_cur->packed || !mqrq_prev->packed) {
+		printk(KERN_WARNING "%s: unable to allocate packed cmd "
+		       "buffers, not using packed writes\n",
+		       mmc_card_name(card));
+		kfree(mqrq_cur->packed);
+		mqrq_cur->packed = NULL;
+		kfree(mqrq_prev->packed);
+		mqrq_prev->packed = NULL;
+		return;
+	}
+
+	INIT_LIST_HEAD(&mqrq_cur->packed->list);
+	INIT_LIST_HEAD(&mqrq_prev->packed->list);
+}
+
+static void mmc_packed_clean(struct mmc_queue *mq)
+{
+	struct mmc_queue_req *mqrq_cur = &mq->mqrq[0];
+	struct mmc_queue_req *mqrq_prev = &mq->mqrq[1];
+
+	kfree(mqrq_cur->packed);
+	mqrq_cur->packed = NULL;
+	kfree(mqrq_prev->packed);
+	mqrq_prev->packed = NULL;
+}
+
 static void mmc_queue_setup_discard(struct request_queue *q,
 				    struct mmc_card *card)
 {
@@ -184,6 +250,8 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 
 	blk_queue_prep_rq(mq->queue, mmc_prep_request);
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, mq->queue);
+	/* best effort, bios go straight to the elevator without it */
+	blk_queue_enable_staging(mq->queue);
 	if (mmc_can_erase(card))
 		mmc_queue_setup_discard(mq->queue, card);
 
@@ -261,6 +329,9 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 			goto cleanup_queue;
 	}
 
+	mmc_packed_init(mq, card);
+	mq->packed_stats.since = ktime_get();
+
 	sema_init(&mq->thread_sem, 1);
 
 	mq->thread = kthread_run(mmc_queue_thread, mq, "mmcqd/%d%s",
@@ -273,6 +344,8 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 
 	return 0;
  free_bounce_sg:
+	mmc_packed_clean(mq);
+
 	kfree(mqrq_cur->bounce_sg);
 	mqrq_cur->bounce_sg = NULL;
 	kfree(mqrq_prev->bounce_sg);
@@ -330,6 +403,8 @@ void mmc_cleanup_queue(struct mmc_queue *mq)
 	kfree(mqrq_prev->bounce_buf);
 	mqrq_prev->bounce_buf = NULL;
 
+	mmc_packed_clean(mq);
+
 	mq->card = NULL;
 }
 EXPORT_SYMBOL(mmc_cleanup_queue);
@@ -378,6 +453,32 @@ void mmc_queue_resume(struct mmc_queue *mq)
 	}
 }
 
+/*
+ * Map the header block followed by the data of every packed request into
+ * one sg list.  blk_rq_map_sg() marks the end of each request's part, so
+ * the mark is cleared again before the next request is appended.
+ */
+static unsigned int mmc_queue_packed_map_sg(struct mmc_queue *mq,
+					    struct mmc_packed *packed,
+					    struct scatterlist *sg)
+{
+	struct scatterlist *__sg = sg;
+	unsigned int sg_len = 0;
+	struct request *req;
+
+	sg_set_buf(__sg, packed->cmd_hdr, sizeof(packed->cmd_hdr));
+	(__sg++)->page_link &= ~0x02;
+	sg_len++;
+
+	list_for_each_entry(req, &packed->list, queuelist) {
+		sg_len += blk_rq_map_sg(mq->queue, req, __sg);
+		__sg = sg + (sg_len - 1);
+		(__sg++)->page_link &= ~0x02;
+	}
+	sg_mark_end(sg + (sg_len - 1));
+	return sg_len;
+}
+
 /*
  * Prepare the sg list(s) to be handed of to the host driver
  */
@@ -388,6 +489,9 @@ unsigned int mmc_queue_map_sg(struct mmc_queue *mq, struct mmc_queue_req *mqrq)
 	struct scatterlist *sg;
 	int i;
 
+	if (mmc_packed_cmd(mqrq->cmd_type))
+		return mmc_queue_packed_map_sg(mq, mqrq->packed, mqrq->sg);
+
 	if (!mqrq->bounce_buf)
 		return blk_rq_map_sg(mq->queue, mqrq->req, mqrq->sg);
 
@@ -12,6 +12,72 @@ struct mmc_blk_request {
 	struct mmc_data		data;
 };
 
+enum mmc_packed_type {
+	MMC_PACKED_NONE = 0,
+	MMC_PACKED_WRITE,
+};
+
+#define mmc_packed_cmd(type)	((type) != MMC_PACKED_NONE)
+
+#define MMC_PACKED_NR_IDX	-1
+#define MMC_PACKED_NR_ZERO	0
+#define MMC_PACKED_NR_SINGLE	1
+/* header word 0, then two words per entry, in one 512 byte block */
+#define MMC_PACKED_MAX_ENTRIES	63
+
+/*
+ * A packed write: the requests on @list go to the card as one CMD25,
+ * preceded by a header block that holds the CMD23/CMD25 arguments of
+ * each of them.
+ */
+struct mmc_packed {
+	struct list_head	list;		/* requests, via queuelist */
+	__le32			cmd_hdr[128];	/* one 512 byte block */
+	unsigned int		blocks;		/* data blocks, w/o header */
+	u8			nr_entries;
+	u8			retries;
+	s16			idx_failure;	/* first entry that failed */
+};
+
+/* Why a packed group was closed, for the statistics */
+enum mmc_packed_stop {
+	MMC_PACKED_STOP_EMPTY = 0,	/* nothing else queued */
+	MMC_PACKED_STOP_MAX_ENTRIES,	/* card's MAX_PACKED_WRITES */
+	MMC_PACKED_STOP_NOT_WRITE,	/* next is a read */
+	MMC_PACKED_STOP_FLUSH_DISCARD,	/* next is a flush or discard */
+	MMC_PACKED_STOP_REL_WR,		/* next needs legacy reliable write */
+	MMC_PACKED_STOP_SIZE,		/* host's max_blk_count */
+	MMC_PACKED_STOP_SEGS,		/* host's max_segs */
+	MMC_PACKED_NR_STOP,
+};
+
+#define MMC_PACKED_HIST	32
+
+struct mmc_packed_stats {
+	unsigned long		write_reqs;	/* write requests issued */
+	unsigned long		write_cmds;	/* CMD25s they took */
+	unsigned long		packed_cmds;
+	unsigned long		packed_reqs;
+	unsigned long		packed_retries;
+	unsigned long		packed_aborts;
+	unsigned long		nr_entries[MMC_PACKED_HIST + 1];
+	unsigned long		stop[MMC_PACKED_NR_STOP];
+	ktime_t			since;
+};
+
+/*
+ * sched_clock() stamps of the phases a request goes through in mmcqd,
+ * reported by the mmc_blk_rw_done tracepoint.
+ */
+struct mmc_queue_stamps {
+	u64			queued;		/* inserted into the request queue */
+	u64			fetch;		/* taken off it by mmcqd */
+	u64			prep;		/* command and sg list built */
+	u64			start;		/* started on the bus */
+	u64			done;		/* transferred and status checked */
+	unsigned int		nr_reqs;	/* block requests it carries */
+};
+
 struct mmc_queue_req {
 	struct request		*req;
 	struct mmc_blk_request	brq;
@@ -20,6 +86,9 @@ struct mmc_queue_req {
 	struct scatterlist	*bounce_sg;
 	unsigned int		bounce_sg_len;
 	struct mmc_async_req	mmc_active;
+	enum mmc_packed_type	cmd_type;
+	struct mmc_packed	*packed;
+	struct mmc_queue_stamps	stamps;
 };
 
 struct mmc_queue {
@@ -33,6 +102,7 @@ struct mmc_queue {
 	struct mmc_queue_req	mqrq[2];
 	struct mmc_queue_req	*mqrq_cur;
 	struct mmc_queue_req	*mqrq_prev;
+	struct mmc_packed_stats	packed_stats;
 };
 
 extern int mmc_init_queue(struct mmc_queue *, struct mmc_card *, spinlock_t *,
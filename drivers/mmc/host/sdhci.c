@@ -424,6 +424,23 @@ static void sdhci_set_adma_desc(u8 *desc, u32 addr, int len, unsigned cmd)
 	dataddr[0] = cpu_to_le32(addr);
 }
 
+/*
+ * Data of an async request is mapped by sdhci_pre_req() while the
+ * previous request is still on the bus, and unmapped by sdhci_post_req()
+ * once it has completed.  host_cookie then holds the number of mapped
+ * sg entries; a zero cookie means the data is mapped and unmapped
+ * around the transfer itself.
+ */
+static int sdhci_map_data(struct sdhci_host *host, struct mmc_data *data)
+{
+	if (data->host_cookie)
+		return data->host_cookie;
+
+	return dma_map_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+		(data->flags & MMC_DATA_READ) ?
+			DMA_FROM_DEVICE : DMA_TO_DEVICE);
+}
+
 static int sdhci_adma_table_pre(struct sdhci_host *host,
 	struct mmc_data *data)
 {
@@ -461,8 +478,7 @@ static int sdhci_adma_table_pre(struct sdhci_host *host,
 		goto fail;
 	BUG_ON(host->align_addr & 0x3);
 
-	host->sg_count = dma_map_sg(mmc_dev(host->mmc),
-		data->sg, data->sg_len, direction);
+	host->sg_count = sdhci_map_data(host, data);
 	if (host->sg_count == 0)
 		goto unmap_align;
 
@@ -552,8 +568,9 @@ static int sdhci_adma_table_pre(struct sdhci_host *host,
 	return 0;
 
 unmap_entries:
-	dma_unmap_sg(mmc_dev(host->mmc), data->sg,
-		data->sg_len, direction);
+	if (!data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg,
+			data->sg_len, direction);
 unmap_align:
 	dma_unmap_single(mmc_dev(host->mmc), host->align_addr,
 		128 * 4, direction);
@@ -603,8 +620,9 @@ static void sdhci_adma_table_post(struct sdhci_host *host,
 		}
 	}
 
-	dma_unmap_sg(mmc_dev(host->mmc), data->sg,
-		data->sg_len, direction);
+	if (!data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg,
+			data->sg_len, direction);
 }
 
 static u8 sdhci_calc_timeout(struct sdhci_host *host, struct mmc_command *cmd)
@@ -784,11 +802,7 @@ static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_command *cmd)
 		} else {
 			int sg_cnt;
 
-			sg_cnt = dma_map_sg(mmc_dev(host->mmc),
-					data->sg, data->sg_len,
-					(data->flags & MMC_DATA_READ) ?
-						DMA_FROM_DEVICE :
-						DMA_TO_DEVICE);
+			sg_cnt = sdhci_map_data(host, data);
 			if (sg_cnt == 0) {
 				/*
 				 * This only happens when someone fed
@@ -823,6 +837,17 @@ static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_command *cmd)
 	if (!(host->flags & SDHCI_REQ_USE_DMA)) {
 		int flags;
 
+		/*
+		 * The data may have been mapped ahead by sdhci_pre_req();
+		 * hand it back to the CPU before PIO touches the buffers.
+		 */
+		if (data->host_cookie) {
+			dma_unmap_sg(mmc_dev(host->mmc), data->sg,
+				data->sg_len, (data->flags & MMC_DATA_READ) ?
+					DMA_FROM_DEVICE : DMA_TO_DEVICE);
+			data->host_cookie = 0;
+		}
+
 		flags = SG_MITER_ATOMIC;
 		if (host->data->flags & MMC_DATA_READ)
 			flags |= SG_MITER_TO_SG;
@@ -886,7 +911,7 @@ static void sdhci_finish_data(struct sdhci_host *host)
 	if (host->flags & SDHCI_REQ_USE_DMA) {
 		if (host->flags & SDHCI_USE_ADMA)
 			sdhci_adma_table_post(host, data);
-		else {
+		else if (!data->host_cookie) {
 			dma_unmap_sg(mmc_dev(host->mmc), data->sg,
 				data->sg_len, (data->flags & MMC_DATA_READ) ?
 					DMA_FROM_DEVICE : DMA_TO_DEVICE);
@@ -1877,8 +1902,43 @@ int sdhci_disable(struct mmc_host *mmc, int lazy)
 	return 0;
 }
 
+static void sdhci_pre_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			  bool is_first_req)
+{
+	struct sdhci_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (!data || data->host_cookie)
+		return;
+
+	if (!(host->flags & (SDHCI_USE_SDMA | SDHCI_USE_ADMA)))
+		return;
+
+	/* On failure the cookie stays 0 and the transfer maps it itself. */
+	data->host_cookie = dma_map_sg(mmc_dev(host->mmc), data->sg,
+		data->sg_len, (data->flags & MMC_DATA_READ) ?
+			DMA_FROM_DEVICE : DMA_TO_DEVICE);
+}
+
+static void sdhci_post_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			   int err)
+{
+	struct sdhci_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (!data || !data->host_cookie)
+		return;
+
+	dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+		(data->flags & MMC_DATA_READ) ?
+			DMA_FROM_DEVICE : DMA_TO_DEVICE);
+	data->host_cookie = 0;
+}
+
 static const struct mmc_host_ops sdhci_ops = {
 	.request	= sdhci_request,
+	.pre_req	= sdhci_pre_req,
+	.post_req	= sdhci_post_req,
 	.set_ios	= sdhci_set_ios,
 	.get_ro		= sdhci_get_ro,
 	.enable		= sdhci_enable,
@@ -25,6 +25,13 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/err.h>
+#include <linux/lzo.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -81,43 +88,116 @@ static struct struct_marks_ver_mark marks_ver_mark = {
 	.second_start_addr = 0x20000000/* it has dependency on h/w */
 };
 /*}} Mark for GetLog -1/2*/
-
-/*{{ pass platform log to kernel -1/3*/
-static char klog_buf[256];
-/*}} pass platform log to kernel -1/3*/
 #endif
 
 
+/*
+ * Size of the chunks the sync points divide the ring into, see
+ * logger_resync().  Must be a power of two.
+ */
+#define LOGGER_SYNC_SIZE	1024
+
+/* bit in logger_log.wakeup: a writer has woken the readers already */
+#define LOGGER_WAKEUP_PENDING	0
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+/*
+ * Entries are archived a chunk at a time: whole entries, at least this
+ * many bytes of them.  Must be a power of two.
+ */
+#define LOGGER_CHUNK_SIZE	8192
+#define LOGGER_BLOCK_MAX	(LOGGER_CHUNK_SIZE + LOGGER_ENTRY_MAX_LEN)
+
+/*
+ * struct logger_block - the LZO compressed entries in [start, end)
+ */
+struct logger_block {
+	struct list_head	list;	/* entry in logger_archive's blocks */
+	size_t			start;	/* position of the first entry */
+	size_t			end;	/* position after the last entry */
+	size_t			clen;	/* compressed size of data */
+	unsigned char		data[0];
+};
+
+/*
+ * struct logger_archive - the history of a log that the ring has lost
+ *
+ * Writers never touch it.  The archive worker compresses entries out of
+ * the ring before it gets lapped, dropping the oldest blocks to stay
+ * within 'limit', and readers that were lapped read from here.  Protected
+ * by 'mutex'.
+ */
+struct logger_archive {
+	struct mutex		mutex;
+	struct list_head	blocks;	/* oldest first */
+	size_t			pos;	/* entries archived up to here */
+	size_t			used;	/* memory held by blocks */
+	size_t			limit;	/* memory the blocks may use */
+	size_t			orig_size; /* uncompressed size of blocks */
+	size_t			compr_size; /* compressed size of blocks */
+	unsigned long		nr_blocks;
+	/* statistics since boot */
+	u64			total_in;	/* bytes archived */
+	u64			total_out;	/* ... and their compressed size */
+	u64			lost;	/* bytes lapped before being archived */
+	unsigned long		evicted;	/* blocks dropped for space */
+	unsigned long		decompressed;	/* blocks read back */
+	unsigned long		failed;	/* blocks not allocated */
+};
+#endif
+
 /*
  * struct logger_log - represents a specific log, such as 'main' or 'radio'
  *
  * This structure lives from module insertion until module removal, so it does
- * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * not need additional reference counting.
+ *
+ * The ring takes no lock.  Positions are byte counts since the log was
+ * created and only ever grow; logger_offset() turns them into offsets into
+ * 'buffer'.  A writer reserves space by advancing 'w_pos' with cmpxchg,
+ * copies its entry in, and then publishes it by advancing 'c_pos', in the
+ * order the space was reserved.  Everything before 'c_pos' is complete,
+ * and stays intact until 'w_pos' moves more than 'size' past it.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
+	size_t			*sync;	/* first entry at each sync point */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
-	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
-	size_t			w_off;	/* current write head offset */
+	unsigned long		wakeup;	/* LOGGER_WAKEUP_PENDING */
+	size_t			w_pos;	/* space reserved by writers up to here */
+	size_t			c_pos;	/* entries complete up to here */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	struct logger_archive	archive; /* compressed older entries */
+	struct dentry		*debugfs; /* archive statistics */
+#endif
 };
 
 /*
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by 'mutex'.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
-	struct list_head	list;	/* entry in logger_log's list */
-	size_t			r_off;	/* current read head offset */
+	struct mutex		mutex;	/* serializes readers of this file */
+	size_t			r_pos;	/* current read position */
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	unsigned char		*block;	/* last archive block read */
+	size_t			b_start; /* position of the first entry */
+	size_t			b_end;	/* position after the last entry */
+#endif
 };
 
+/*
+ * Writers stage their entry here, so that the copy from user space, which
+ * may fault, is done before any space in the ring is reserved.
+ */
+static DEFINE_PER_CPU(unsigned char [LOGGER_ENTRY_MAX_LEN], logger_scratch);
+
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
@@ -148,7 +228,8 @@ static inline struct logger_log *file_get_log(struct file *file)
  * get_entry_len - Grabs the length of the payload of the next entry starting
  * from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * The result is only meaningful if the writers have not lapped 'off' by
+ * the time logger_lapped() is checked afterwards.
  */
 static __u32 get_entry_len(struct logger_log *log, size_t off)
 {
@@ -166,17 +247,413 @@ static __u32 get_entry_len(struct logger_log *log, size_t off)
 	return sizeof(struct logger_entry) + val;
 }
 
+/*
+ * logger_lapped - has a writer reserved the space of the entry at 'pos'
+ * for a newer one?  Called after reading from the ring, to tell whether
+ * what was read can be trusted.
+ */
+static inline int logger_lapped(struct logger_log *log, size_t pos)
+{
+	smp_rmb();
+	return ACCESS_ONCE(log->w_pos) - pos > log->size;
+}
+
+/*
+ * logger_resync - find the oldest entry that the writers have not lapped.
+ *
+ * Entries are not at fixed offsets, so a reader that was lapped cannot
+ * just skip ahead.  Instead the ring is divided into LOGGER_SYNC_SIZE
+ * chunks, and for each chunk the writers record where the first entry
+ * starting in it or after it is.  A record left from an older pass over
+ * the ring, or from a newer entry that is not complete yet, is told apart
+ * by its position.
+ */
+static size_t logger_resync(struct logger_log *log)
+{
+	size_t c_pos = ACCESS_ONCE(log->c_pos);
+	size_t pos, sync;
+
+	smp_rmb();
+	/* leave some room for the writers that are in flight */
+	pos = ALIGN(ACCESS_ONCE(log->w_pos) - log->size + LOGGER_ENTRY_MAX_LEN,
+		    LOGGER_SYNC_SIZE);
+	while ((long)(c_pos - pos) > 0) {
+		sync = ACCESS_ONCE(log->sync[logger_offset(pos) /
+					     LOGGER_SYNC_SIZE]);
+		if (sync - pos < LOGGER_ENTRY_MAX_LEN &&
+		    (long)(c_pos - sync) >= 0)
+			return sync;
+		pos += LOGGER_SYNC_SIZE;
+	}
+
+	/* c_pos is always at the start of an entry */
+	return c_pos;
+}
+
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+/* only used by logger_archive_work, which never runs concurrently */
+static unsigned char *logger_archive_src;
+static unsigned char *logger_archive_dst;
+static void *logger_archive_wrkmem;
+
+static void logger_archive_all(struct work_struct *work);
+static DECLARE_WORK(logger_archive_work, logger_archive_all);
+
+static __u32 logger_entry_len(const unsigned char *entry)
+{
+	__u16 val;
+
+	memcpy(&val, entry, sizeof(val));
+	return sizeof(struct logger_entry) + val;
+}
+
+/*
+ * logger_archive_kick - called once the entry at 'pos' is committed.  The
+ * archive worker is woken each time the writers fill another chunk.
+ */
+static inline void logger_archive_kick(struct logger_log *log, size_t pos,
+				       size_t count)
+{
+	if (((pos + count) ^ pos) >= LOGGER_CHUNK_SIZE)
+		queue_work(system_nrt_wq, &logger_archive_work);
+}
+
+static void logger_archive_evict(struct logger_archive *arch)
+{
+	struct logger_block *block;
+
+	block = list_first_entry(&arch->blocks, struct logger_block, list);
+	list_del(&block->list);
+	arch->used -= sizeof(*block) + block->clen;
+	arch->orig_size -= block->end - block->start;
+	arch->compr_size -= block->clen;
+	arch->nr_blocks--;
+	kfree(block);
+}
+
+/*
+ * logger_archive_log - compress the complete chunks of 'log' that are not
+ * archived yet.
+ */
+static void logger_archive_log(struct logger_log *log)
+{
+	struct logger_archive *arch = &log->archive;
+	struct logger_block *block;
+	size_t pos, len, off, part, clen;
+	int ret;
+
+	mutex_lock(&arch->mutex);
+	for (;;) {
+		pos = arch->pos;
+		if (logger_lapped(log, pos)) {
+			arch->pos = logger_resync(log);
+			arch->lost += arch->pos - pos;
+			continue;
+		}
+		if (ACCESS_ONCE(log->c_pos) - pos < LOGGER_CHUNK_SIZE)
+			break;
+		smp_rmb();
+
+		/* entries starting before c_pos are complete */
+		len = 0;
+		while (len < LOGGER_CHUNK_SIZE) {
+			len += get_entry_len(log, logger_offset(pos + len));
+			if (len > LOGGER_BLOCK_MAX)
+				break;	/* lapped */
+		}
+		if (len <= LOGGER_BLOCK_MAX) {
+			off = logger_offset(pos);
+			part = min(len, log->size - off);
+			memcpy(logger_archive_src, log->buffer + off, part);
+			memcpy(logger_archive_src + part, log->buffer,
+			       len - part);
+		}
+		if (logger_lapped(log, pos))
+			continue;
+		if (WARN_ON(len > LOGGER_BLOCK_MAX))
+			break;
+
+		ret = lzo1x_1_compress(logger_archive_src, len,
+				       logger_archive_dst, &clen,
+				       logger_archive_wrkmem);
+		if (ret != LZO_E_OK) {
+			pr_err("logger: %s: compression failed: %d\n",
+			       log->misc.name, ret);
+			break;
+		}
+		block = kmalloc(sizeof(*block) + clen, GFP_KERNEL);
+		if (!block) {
+			/* try again once the next chunk is full */
+			arch->failed++;
+			break;
+		}
+		memcpy(block->data, logger_archive_dst, clen);
+		block->start = pos;
+		block->end = pos + len;
+		block->clen = clen;
+
+		list_add_tail(&block->list, &arch->blocks);
+		arch->used += sizeof(*block) + clen;
+		arch->orig_size += len;
+		arch->compr_size += clen;
+		arch->nr_blocks++;
+		arch->total_in += len;
+		arch->total_out += clen;
+		arch->pos = block->end;
+
+		while (arch->used > arch->limit) {
+			logger_archive_evict(arch);
+			arch->evicted++;
+		}
+	}
+	mutex_unlock(&arch->mutex);
+}
+
+/*
+ * logger_archive_flush - drop the history before the log's head.
+ */
+static void logger_archive_flush(struct logger_log *log)
+{
+	struct logger_archive *arch = &log->archive;
+
+	mutex_lock(&arch->mutex);
+	while (!list_empty(&arch->blocks))
+		logger_archive_evict(arch);
+	if ((long)(arch->pos - log->head) < 0)
+		arch->pos = log->head;
+	mutex_unlock(&arch->mutex);
+}
+
+/* The first block that holds entries at or after 'pos'. */
+static struct logger_block *logger_archive_find(struct logger_archive *arch,
+						size_t pos)
+{
+	struct logger_block *block;
+
+	list_for_each_entry(block, &arch->blocks, list)
+		if ((long)(block->end - pos) > 0)
+			return block;
+	return NULL;
+}
+
+/*
+ * logger_archive_seek - the writers lapped the reader; point it at the
+ * oldest archived entry at or after its position.  Returns 0 if there is
+ * none, and the reader has to resync in the ring.
+ *
+ * Caller needs to hold reader->mutex.
+ */
+static int logger_archive_seek(struct logger_log *log,
+			       struct logger_reader *reader)
+{
+	struct logger_archive *arch = &log->archive;
+	struct logger_block *block;
+
+	/* still in the block this reader has decompressed? */
+	if (reader->block &&
+	    reader->r_pos - reader->b_start < reader->b_end - reader->b_start)
+		return 1;
+
+	mutex_lock(&arch->mutex);
+	block = logger_archive_find(arch, reader->r_pos);
+	if (block && (long)(block->start - reader->r_pos) > 0)
+		reader->r_pos = block->start;
+	mutex_unlock(&arch->mutex);
+
+	return block != NULL;
+}
+
+/*
+ * logger_archive_entry - returns the archived entry at the reader's
+ * position, decompressing its block if needed.  -EAGAIN means that it is
+ * not archived (any more), and the reader needs to be fixed up again.
+ *
+ * Caller needs to hold reader->mutex.
+ */
+static const unsigned char *logger_archive_entry(struct logger_log *log,
+						 struct logger_reader *reader)
+{
+	struct logger_archive *arch = &log->archive;
+	struct logger_block *block;
+	size_t dlen;
+	int ret;
+
+	if (reader->block &&
+	    reader->r_pos - reader->b_start < reader->b_end - reader->b_start)
+		return reader->block + (reader->r_pos - reader->b_start);
+
+	if (!reader->block) {
+		reader->block = vmalloc(LOGGER_BLOCK_MAX);
+		if (!reader->block)
+			return ERR_PTR(-ENOMEM);
+	}
+
+	mutex_lock(&arch->mutex);
+	block = logger_archive_find(arch, reader->r_pos);
+	if (!block || (long)(block->start - reader->r_pos) > 0) {
+		mutex_unlock(&arch->mutex);
+		reader->b_start = reader->b_end = 0;
+		return ERR_PTR(-EAGAIN);
+	}
+	dlen = LOGGER_BLOCK_MAX;
+	ret = lzo1x_decompress_safe(block->data, block->clen, reader->block,
+				    &dlen);
+	if (ret != LZO_E_OK || dlen != block->end - block->start) {
+		mutex_unlock(&arch->mutex);
+		pr_err("logger: %s: decompression failed: %d\n",
+		       log->misc.name, ret);
+		reader->b_start = reader->b_end = 0;
+		return ERR_PTR(-EIO);
+	}
+	reader->b_start = block->start;
+	reader->b_end = block->end;
+	arch->decompressed++;
+	mutex_unlock(&arch->mutex);
+
+	return reader->block + (reader->r_pos - reader->b_start);
+}
+
+static int logger_archive_show(struct seq_file *m, void *unused)
+{
+	struct logger_log *log = m->private;
+	struct logger_archive *arch = &log->archive;
+
+	mutex_lock(&arch->mutex);
+	seq_printf(m, "ring_size: %zu\n", log->size);
+	seq_printf(m, "limit: %zu\n", arch->limit);
+	seq_printf(m, "used: %zu\n", arch->used);
+	seq_printf(m, "blocks: %lu\n", arch->nr_blocks);
+	seq_printf(m, "orig_data_size: %zu\n", arch->orig_size);
+	seq_printf(m, "compr_data_size: %zu\n", arch->compr_size);
+	if (arch->compr_size)
+		seq_printf(m, "ratio: %zu.%02zu\n",
+			   arch->orig_size / arch->compr_size,
+			   arch->orig_size * 100 / arch->compr_size % 100);
+	seq_printf(m, "history: %zu\n", log->size + arch->orig_size);
+	seq_printf(m, "total_in: %llu\n",
+		   (unsigned long long)arch->total_in);
+	seq_printf(m, "total_out: %llu\n",
+		   (unsigned long long)arch->total_out);
+	seq_printf(m, "lost: %llu\n",
+		   (unsigned long long)arch->lost);
+	seq_printf(m, "evicted: %lu\n", arch->evicted);
+	seq_printf(m, "decompressed: %lu\n", arch->decompressed);
+	seq_printf(m, "failed: %lu\n", arch->failed);
+	mutex_unlock(&arch->mutex);
+	return 0;
+}
+
+static int logger_archive_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, logger_archive_show, inode->i_private);
+}
+
+static const struct file_operations logger_archive_fops = {
+	.owner = THIS_MODULE,
+	.open = logger_archive_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init logger_archive_init(void)
+{
+	logger_archive_src = vmalloc(LOGGER_BLOCK_MAX);
+	logger_archive_dst = vmalloc(lzo1x_worst_compress(LOGGER_BLOCK_MAX));
+	logger_archive_wrkmem = vmalloc(LZO1X_MEM_COMPRESS);
+	if (!logger_archive_src || !logger_archive_dst ||
+	    !logger_archive_wrkmem) {
+		vfree(logger_archive_src);
+		vfree(logger_archive_dst);
+		vfree(logger_archive_wrkmem);
+		return -ENOMEM;
+	}
+	return 0;
+}
+#else
+static inline void logger_archive_kick(struct logger_log *log, size_t pos,
+				       size_t count)
+{
+}
+
+static inline void logger_archive_flush(struct logger_log *log)
+{
+}
+
+static inline int logger_archive_seek(struct logger_log *log,
+				      struct logger_reader *reader)
+{
+	return 0;
+}
+
+static inline const unsigned char *
+logger_archive_entry(struct logger_log *log, struct logger_reader *reader)
+{
+	return ERR_PTR(-EAGAIN);
+}
+
+static inline __u32 logger_entry_len(const unsigned char *entry)
+{
+	return 0;
+}
+#endif
+
+/*
+ * fix_up_reader - pull the reader forward to the log's head if the log was
+ * flushed.  If the writers lapped it, move it to the oldest entry that is
+ * still archived, or else to the oldest intact entry in the ring.
+ *
+ * Caller needs to hold reader->mutex.
+ */
+static void fix_up_reader(struct logger_log *log, struct logger_reader *reader)
+{
+	size_t head = ACCESS_ONCE(log->head);
+
+	if ((long)(reader->r_pos - head) < 0)
+		reader->r_pos = head;
+	if (logger_lapped(log, reader->r_pos) &&
+	    !logger_archive_seek(log, reader))
+		reader->r_pos = logger_resync(log);
+}
+
+/*
+ * logger_arm_wakeup - let the next writer wake up the readers.  Called by a
+ * reader before it checks for new entries and goes to sleep.
+ */
+static inline void logger_arm_wakeup(struct logger_log *log)
+{
+	clear_bit(LOGGER_WAKEUP_PENDING, &log->wakeup);
+	smp_mb__after_clear_bit();
+}
+
+/*
+ * logger_wake_readers - wake up any blocked readers.
+ *
+ * Only the first writer after the readers went to sleep does so, the
+ * entries written until they are back get picked up in the same batch.
+ */
+static inline void logger_wake_readers(struct logger_log *log)
+{
+	smp_mb();
+	if (!waitqueue_active(&log->wq) ||
+	    test_bit(LOGGER_WAKEUP_PENDING, &log->wakeup) ||
+	    test_and_set_bit(LOGGER_WAKEUP_PENDING, &log->wakeup))
+		return;
+	wake_up_interruptible(&log->wq);
+}
+
 /*
  * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
  * user-space buffer 'buf'. Returns 'count' on success.
  *
- * Caller must hold log->mutex.
+ * Caller must hold reader->mutex.
  */
 static ssize_t do_read_log_to_user(struct logger_log *log,
 				   struct logger_reader *reader,
 				   char __user *buf,
 				   size_t count)
 {
+	size_t off = logger_offset(reader->r_pos);
 	size_t len;
 
 	/*
@@ -184,8 +661,8 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * the current read head offset up to 'count' bytes or to the end of
 	 * the log, whichever comes first.
 	 */
-	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
+	len = min(count, log->size - off);
+	if (copy_to_user(buf, log->buffer + off, len))
 		return -EFAULT;
 
 	/*
@@ -196,8 +673,6 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 		if (copy_to_user(buf + len, log->buffer, count - len))
 			return -EFAULT;
 
-	reader->r_off = logger_offset(reader->r_off + count);
-
 	return count;
 }
 
@@ -218,16 +693,19 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	const unsigned char *entry;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
 start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
+		logger_arm_wakeup(log);
 
-		mutex_lock(&log->mutex);
-		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		mutex_lock(&reader->mutex);
+		fix_up_reader(log, reader);
+		ret = (ACCESS_ONCE(log->c_pos) == reader->r_pos);
+		mutex_unlock(&reader->mutex);
 		if (!ret)
 			break;
 
@@ -248,16 +726,40 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	mutex_lock(&reader->mutex);
+retry:
+	fix_up_reader(log, reader);
 
 	/* is there still something to read or did we race? */
-	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+	if (unlikely(ACCESS_ONCE(log->c_pos) == reader->r_pos)) {
+		mutex_unlock(&reader->mutex);
 		goto start;
 	}
+	smp_rmb();
+
+	if (logger_lapped(log, reader->r_pos)) {
+		/* fix_up_reader() found it in the archive */
+		entry = logger_archive_entry(log, reader);
+		if (IS_ERR(entry)) {
+			ret = PTR_ERR(entry);
+			if (ret == -EAGAIN)
+				goto retry;
+			goto out;
+		}
+		ret = logger_entry_len(entry);
+		if (count < ret)
+			ret = -EINVAL;
+		else if (copy_to_user(buf, entry, ret))
+			ret = -EFAULT;
+		else
+			reader->r_pos += ret;
+		goto out;
+	}
 
 	/* get the size of the next entry */
-	ret = get_entry_len(log, reader->r_off);
+	ret = get_entry_len(log, logger_offset(reader->r_pos));
+	if (logger_lapped(log, reader->r_pos))
+		goto retry;
 	if (count < ret) {
 		ret = -EINVAL;
 		goto out;
@@ -265,150 +767,132 @@ start:
 
 	/* get exactly one entry from the log */
 	ret = do_read_log_to_user(log, reader, buf, ret);
+	if (ret < 0)
+		goto out;
+	if (logger_lapped(log, reader->r_pos))
+		goto retry;
+	reader->r_pos += ret;
 
 out:
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
 
 /*
- * get_next_entry - return the offset of the first valid entry at least 'len'
- * bytes after 'off'.
+ * logger_reserve - reserves 'len' bytes at the head of the log and returns
+ * their position.
  *
- * Caller must hold log->mutex.
+ * The caller needs to have preemption disabled until logger_commit().
  */
-static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
+static size_t logger_reserve(struct logger_log *log, size_t len)
 {
-	size_t count = 0;
-
-	do {
-		size_t nr = get_entry_len(log, off);
-		off = logger_offset(off + nr);
-		count += nr;
-	} while (count < len);
-
-	return off;
-}
-
-/*
- * clock_interval - is a < c < b in mod-space? Put another way, does the line
- * from a to b cross c?
- */
-static inline int clock_interval(size_t a, size_t b, size_t c)
-{
-	if (b < a) {
-		if (a < c || b >= c)
-			return 1;
-	} else {
-		if (a < c && b >= c)
-			return 1;
+	size_t old, new;
+
+	for (;;) {
+		old = ACCESS_ONCE(log->w_pos);
+		new = old + len;
+		/*
+		 * Never reuse space that an earlier writer is still copying
+		 * into.  Only possible with more writers in flight than the
+		 * log has room for entries.
+		 */
+		if (unlikely(new - ACCESS_ONCE(log->c_pos) > log->size)) {
+			cpu_relax();
+			continue;
+		}
+		if (cmpxchg(&log->w_pos, old, new) == old)
+			return old;
 	}
-
-	return 0;
 }
 
 /*
- * fix_up_readers - walk the list of all readers and "fix up" any who were
- * lapped by the writer; also do the same for the default "start head".
- * We do this by "pulling forward" the readers and start head to the first
- * entry after the new write head.
- *
- * The caller needs to hold log->mutex.
+ * do_write_log - writes 'count' bytes from 'buf' to 'log' at 'pos', which
+ * was reserved with logger_reserve(), and records the sync points the entry
+ * crosses.
  */
-static void fix_up_readers(struct logger_log *log, size_t len)
+static void do_write_log(struct logger_log *log, size_t pos,
+			 const void *buf, size_t count)
 {
-	size_t old = log->w_off;
-	size_t new = logger_offset(old + len);
-	struct logger_reader *reader;
+	size_t off = logger_offset(pos);
+	size_t len, sync;
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
-	list_for_each_entry(reader, &log->readers, list)
-		if (clock_interval(old, new, reader->r_off))
-			reader->r_off = get_next_entry(log, reader->r_off, len);
+	if (count != len)
+		memcpy(log->buffer, buf + len, count - len);
+
+	for (sync = ALIGN(pos, LOGGER_SYNC_SIZE); sync - pos < count;
+	     sync += LOGGER_SYNC_SIZE)
+		log->sync[logger_offset(sync) / LOGGER_SYNC_SIZE] =
+			sync == pos ? pos : pos + count;
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
- *
- * The caller needs to hold log->mutex.
+ * logger_commit - makes the entry at 'pos' visible to readers, once all the
+ * entries reserved before it are.  Those writers are running with
+ * preemption disabled and do not fault, so the wait is short.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static void logger_commit(struct logger_log *log, size_t pos, size_t count)
 {
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
-
-	if (count != len)
-		memcpy(log->buffer, buf + len, count - len);
-
-	log->w_off = logger_offset(log->w_off + count);
-
+	while (ACCESS_ONCE(log->c_pos) != pos)
+		cpu_relax();
+	smp_mb();
+	log->c_pos = pos + count;
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * do_copy_log_from_user - gathers 'count' bytes of payload from 'iov' into
+ * 'buf'.  With 'atomic' set, page faults are not handled and the copy fails
+ * instead.
  *
- * The caller needs to hold log->mutex.
- *
- * Returns 'count' on success, negative error code on failure.
+ * Returns zero on success, -EFAULT on failure.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static int do_copy_log_from_user(unsigned char *buf, const struct iovec *iov,
+				 unsigned long nr_segs, size_t count,
+				 int atomic)
 {
-	size_t len;
-
-#ifdef CONFIG_KERNEL_DEBUG_SEC
-	if (count > log->size - 1) {
-		pr_err(" ** invalid log count [%d]\n", count);
-		return -EFAULT;
-	}
-#endif
-
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
+	while (nr_segs-- > 0 && count) {
+		/* figure out how much of this vector we can keep */
+		size_t len = min_t(size_t, iov->iov_len, count);
+		unsigned long left;
 
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
+		if (atomic)
+			left = __copy_from_user_inatomic(buf, iov->iov_base,
+							 len);
+		else
+			left = copy_from_user(buf, iov->iov_base, len);
+		if (unlikely(left))
 			return -EFAULT;
 
-#ifdef CONFIG_KERNEL_DEBUG_SEC
-	/*{{ pass platform log (!@hello) to kernel -2/3*/
-	memset(klog_buf, 0, 255);
-
-	if (strncmp(log->buffer + log->w_off, "!@", 2) == 0) {
-		if (count < 255)
-			memcpy(klog_buf, log->buffer + log->w_off, count);
-		else
-			memcpy(klog_buf, log->buffer + log->w_off, 255);
-		klog_buf[255] = 0;
+		buf += len;
+		count -= len;
+		iov++;
 	}
-	/*}} pass platform log (!@hello) to kernel -2/3*/
-#endif
-
-	log->w_off = logger_offset(log->w_off + count);
 
-	return count;
+	return 0;
 }
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * The entry is gathered in this CPU's scratch buffer with page faults
+ * disabled.  Only if that fails is it copied into a kmalloc'ed buffer
+ * instead.  Either way no space in the log is reserved until the whole
+ * entry is at hand, and from then on nothing can sleep or fault.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
-	ssize_t ret = 0;
+	unsigned char *buf, *slow = NULL;
+	size_t count, pos;
+	int ret;
 
 	now = current_kernel_time();
 
@@ -417,55 +901,55 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	header.sec = now.tv_sec;
 	header.nsec = now.tv_nsec;
 	header.len = min_t(size_t, iocb->ki_left, LOGGER_ENTRY_MAX_PAYLOAD);
+	header.__pad = 0;
 
 	/* null writes succeed, return zero */
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
+	count = sizeof(struct logger_entry) + header.len;
 
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
-
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
-
-		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
-
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+	preempt_disable();
+	buf = __get_cpu_var(logger_scratch);
+	pagefault_disable();
+	ret = do_copy_log_from_user(buf + sizeof(struct logger_entry), iov,
+				    nr_segs, header.len, 1);
+	pagefault_enable();
+	if (unlikely(ret)) {
+		preempt_enable();
+		slow = kmalloc(count, GFP_KERNEL);
+		if (!slow)
+			return -ENOMEM;
+		ret = do_copy_log_from_user(slow + sizeof(struct logger_entry),
+					    iov, nr_segs, header.len, 0);
+		if (ret) {
+			kfree(slow);
+			return ret;
 		}
-
-		iov++;
-		ret += nr;
+		preempt_disable();
+		buf = slow;
 	}
+	memcpy(buf, &header, sizeof(struct logger_entry));
 
-	mutex_unlock(&log->mutex);
-
-	/* wake up any blocked readers */
-	wake_up_interruptible(&log->wq);
+	pos = logger_reserve(log, count);
+	do_write_log(log, pos, buf, count);
+	logger_commit(log, pos, count);
 
 #ifdef CONFIG_KERNEL_DEBUG_SEC
-	/*{{ pass platform log (!@hello) to kernel -3/3*/
-	if (strncmp(klog_buf, "!@", 2) == 0)
-		printk("%s\n", klog_buf);
-	/*}} pass platform log (!@hello) to kernel -3/3*/
+	/*{{ pass platform log (!@hello) to kernel */
+	if (strncmp(buf + sizeof(struct logger_entry), "!@", 2) == 0)
+		printk("%.*s\n", min_t(int, header.len, 255),
+		       buf + sizeof(struct logger_entry));
+	/*}} pass platform log (!@hello) to kernel */
 #endif
 
-	return ret;
+	preempt_enable();
+	kfree(slow);
+
+	logger_archive_kick(log, pos, count);
+	logger_wake_readers(log);
+
+	return header.len;
 }
 
 static struct logger_log *get_log_from_minor(int);
@@ -496,12 +980,13 @@ static int logger_open(struct inode *inode, struct file *file)
 			return -ENOMEM;
 
 		reader->log = log;
-		INIT_LIST_HEAD(&reader->list);
-
-		mutex_lock(&log->mutex);
-		reader->r_off = log->head;
-		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		mutex_init(&reader->mutex);
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		reader->block = NULL;
+		reader->b_start = reader->b_end = 0;
+#endif
+		/* pulled forward by fix_up_reader() if it was lapped */
+		reader->r_pos = ACCESS_ONCE(log->head);
 
 		file->private_data = reader;
 	} else
@@ -519,12 +1004,10 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
-		struct logger_log *log = reader->log;
-
-		mutex_lock(&log->mutex);
-		list_del(&reader->list);
-		mutex_unlock(&log->mutex);
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		vfree(reader->block);
+#endif
 		kfree(reader);
 	}
 
@@ -553,11 +1036,13 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	log = reader->log;
 
 	poll_wait(file, &log->wq, wait);
+	logger_arm_wakeup(log);
 
-	mutex_lock(&log->mutex);
-	if (log->w_off != reader->r_off)
+	mutex_lock(&reader->mutex);
+	fix_up_reader(log, reader);
+	if (ACCESS_ONCE(log->c_pos) != reader->r_pos)
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->mutex);
 
 	return ret;
 }
@@ -568,11 +1053,12 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	struct logger_reader *reader;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
-
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
 		ret = log->size;
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+		ret += log->archive.limit;
+#endif
 		break;
 	case LOGGER_GET_LOG_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -580,10 +1066,10 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		mutex_lock(&reader->mutex);
+		fix_up_reader(log, reader);
+		ret = ACCESS_ONCE(log->c_pos) - reader->r_pos;
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -591,25 +1077,41 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off != reader->r_off)
-			ret = get_entry_len(log, reader->r_off);
-		else
+		mutex_lock(&reader->mutex);
+		do {
+			fix_up_reader(log, reader);
 			ret = 0;
+			if (ACCESS_ONCE(log->c_pos) == reader->r_pos)
+				break;
+			smp_rmb();
+			if (logger_lapped(log, reader->r_pos)) {
+				const unsigned char *entry;
+
+				entry = logger_archive_entry(log, reader);
+				if (IS_ERR(entry)) {
+					ret = PTR_ERR(entry);
+					if (ret == -EAGAIN)
+						continue;
+				} else
+					ret = logger_entry_len(entry);
+				break;
+			}
+			ret = get_entry_len(log, logger_offset(reader->r_pos));
+		} while (logger_lapped(log, reader->r_pos));
+		mutex_unlock(&reader->mutex);
 		break;
 	case LOGGER_FLUSH_LOG:
 		if (!(file->f_mode & FMODE_WRITE)) {
 			ret = -EBADF;
 			break;
 		}
-		list_for_each_entry(reader, &log->readers, list)
-			reader->r_off = log->w_off;
-		log->head = log->w_off;
+		/* readers catch up with the new head in fix_up_reader() */
+		log->head = ACCESS_ONCE(log->c_pos);
+		logger_archive_flush(log);
 		ret = 0;
 		break;
 	}
 
-	mutex_unlock(&log->mutex);
-
 	return ret;
 }
 
@@ -624,15 +1126,35 @@ static const struct file_operations logger_fops = {
 	.release = logger_release,
 };
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+/*
+ * The ring gets a quarter of a log's memory, but no less than four chunks
+ * so that the archive worker can keep up, and the archive the rest.
+ */
+#define LOGGER_RING_SIZE(SIZE) \
+	((SIZE) / 4 > 4 * LOGGER_CHUNK_SIZE ? (SIZE) / 4 : 4 * LOGGER_CHUNK_SIZE)
+#define LOGGER_ARCHIVE_INIT(VAR, SIZE) \
+	.archive = { \
+		.mutex = __MUTEX_INITIALIZER(VAR .archive.mutex), \
+		.blocks = LIST_HEAD_INIT(VAR .archive.blocks), \
+		.limit = (SIZE) - LOGGER_RING_SIZE(SIZE), \
+	},
+#else
+#define LOGGER_RING_SIZE(SIZE)		(SIZE)
+#define LOGGER_ARCHIVE_INIT(VAR, SIZE)
+#endif
+
 /*
  * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
  * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
  * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+static unsigned char _buf_ ## VAR[LOGGER_RING_SIZE(SIZE)]; \
+static size_t _sync_ ## VAR[LOGGER_RING_SIZE(SIZE) / LOGGER_SYNC_SIZE]; \
 static struct logger_log VAR = { \
 	.buffer = _buf_ ## VAR, \
+	.sync = _sync_ ## VAR, \
 	.misc = { \
 		.minor = MISC_DYNAMIC_MINOR, \
 		.name = NAME, \
@@ -640,11 +1162,11 @@ static struct logger_log VAR = { \
 		.parent = NULL, \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
-	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
-	.w_off = 0, \
+	.w_pos = 0, \
+	.c_pos = 0, \
 	.head = 0, \
-	.size = SIZE, \
+	.size = LOGGER_RING_SIZE(SIZE), \
+	LOGGER_ARCHIVE_INIT(VAR, SIZE) \
 };
 
 #ifdef CONFIG_KERNEL_DEBUG_SEC
@@ -680,6 +1202,18 @@ static struct logger_log *get_log_from_minor(int minor)
 	return NULL;
 }
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+static void logger_archive_all(struct work_struct *work)
+{
+	logger_archive_log(&log_main);
+	logger_archive_log(&log_events);
+	logger_archive_log(&log_radio);
+	logger_archive_log(&log_system);
+}
+
+static struct dentry *logger_debugfs_root;
+#endif
+
 static int __init init_log(struct logger_log *log)
 {
 	int ret;
@@ -694,6 +1228,15 @@ static int __init init_log(struct logger_log *log)
 	printk(KERN_INFO "logger: created %luK log '%s'\n",
 	       (unsigned long) log->size >> 10, log->misc.name);
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	printk(KERN_INFO "logger: %luK compressed history for '%s'\n",
+	       (unsigned long) log->archive.limit >> 10, log->misc.name);
+	if (logger_debugfs_root)
+		log->debugfs = debugfs_create_file(log->misc.name, S_IRUGO,
+						   logger_debugfs_root, log,
+						   &logger_archive_fops);
+#endif
+
 	return 0;
 }
 
@@ -711,6 +1254,13 @@ static int __init logger_init(void)
 	/*}} Mark for GetLog -2/2*/
 #endif
 
+#ifdef CONFIG_ANDROID_LOGGER_COMPRESS
+	ret = logger_archive_init();
+	if (unlikely(ret))
+		goto out;
+	logger_debugfs_root = debugfs_create_dir("logger", NULL);
+#endif
+
 	ret = init_log(&log_main);
 	if (unlikely(ret))
 		goto out;
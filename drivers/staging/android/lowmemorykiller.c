@@ -15,6 +15,22 @@
  * The driver considers memory used for caches to be free, but if a large
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
+ * So the free memory thresholds only apply while reclaim is struggling:
+ * the reclaim pressure, the percentage of the pages scanned by reclaim
+ * that it failed to free, must be at least
+ * /sys/module/lowmemorykiller/parameters/minfree_pressure.
+ *
+ * Reclaim pressure also triggers kills on its own. The values in
+ * /sys/module/lowmemorykiller/parameters/pressure go with those in adj:
+ * with "101,98,90,60" and adj "0,1,6,12", processes with a oom_adj value of
+ * 12 or higher are killed when reclaim fails to free 60% of what it scans,
+ * those of 1 or higher when it fails to free 98%. A value above 100
+ * disables a level.
+ *
+ * Processes are kept on lists by oom_adj, so that picking a victim only
+ * looks at the processes with the highest oom_adj that is to be killed.
+ * /sys/module/lowmemorykiller/parameters/stats shows how long that took
+ * and how long the victims took to die.
  *
  * Copyright (C) 2007-2008 Google, Inc.
  *
@@ -37,6 +53,9 @@
 #include <linux/rcupdate.h>
 #include <linux/notifier.h>
 #include <linux/compaction.h>
+#include <linux/ktime.h>
+#include <linux/vmstat.h>
+#include <linux/swap.h>
 
 static uint32_t lowmem_debug_level = 1;
 static int lowmem_adj[6] = {
@@ -53,11 +72,53 @@ static int lowmem_minfree[6] = {
 	16 * 1024,	/* 64MB */
 };
 static int lowmem_minfree_size = 4;
+static int lowmem_pressure[6] = {
+	101,		/* never */
+	98,
+	90,
+	60,
+};
+static int lowmem_pressure_size = 4;
+static int lowmem_minfree_pressure = 60;
+/* pages reclaim has to scan before the pressure is worked out again */
+static int lowmem_pressure_window = SWAP_CLUSTER_MAX * 16;
 
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
+static ktime_t lowmem_deathpending_start;
+
+/*
+ * Thread group leaders by oom_adj, from OOM_DISABLE up.  hlists, so that
+ * the static array is valid before the first fork.  Protected by
+ * lowmem_adj_lock, which nests inside tasklist_lock and must not be held
+ * across task_lock().  Fork, exit and exec take it under
+ * write_lock_irq(&tasklist_lock); everyone else must disable irqs too,
+ * or an irq reading tasklist_lock could deadlock against them.
+ */
+#define LOWMEM_ADJ_LISTS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+static struct hlist_head lowmem_adj_lists[LOWMEM_ADJ_LISTS];
+static DEFINE_SPINLOCK(lowmem_adj_lock);
 
-extern int compact_nodes(bool sync);
+static struct {
+	unsigned long kills;
+	unsigned long kills_timedout;	/* victim still alive after a second */
+	unsigned long selects;		/* victim searches */
+	unsigned long tasks_scanned;
+	u64 scan_ns;
+	u64 scan_ns_max;
+	u64 kill_ns;			/* SIGKILL until the victim is freed */
+	u64 kill_ns_max;
+} lowmem_stats;
+/* irqsave: the task free notifier may be called from any context */
+static DEFINE_SPINLOCK(lowmem_stats_lock);
+
+static struct {
+	unsigned long scanned;
+	unsigned long reclaimed;
+	unsigned long stamp;
+	int level;
+} lowmem_vmpressure;
+static DEFINE_SPINLOCK(lowmem_pressure_lock);
 
 #define lowmem_print(level, x...)			\
 	do {						\
@@ -65,6 +126,75 @@ extern int compact_nodes(bool sync);
 			printk(x);			\
 	} while (0)
 
+static struct hlist_head *lowmem_adj_list(int adj)
+{
+	return &lowmem_adj_lists[clamp(adj, OOM_DISABLE, OOM_ADJUST_MAX) -
+				 OOM_DISABLE];
+}
+
+/*
+ * Kernel threads, and the odd process forked by one, have no mm and are
+ * never candidates, so only processes forked with an mm are listed.
+ */
+void lowmem_task_fork(struct task_struct *p)
+{
+	INIT_HLIST_NODE(&p->lowmem_adj_node);
+	if (!thread_group_leader(p) || !p->mm)
+		return;
+
+	spin_lock(&lowmem_adj_lock);
+	p->lowmem_adj = p->signal->oom_adj;
+	hlist_add_head(&p->lowmem_adj_node, lowmem_adj_list(p->lowmem_adj));
+	spin_unlock(&lowmem_adj_lock);
+}
+
+void lowmem_task_exit(struct task_struct *p)
+{
+	/* only fork, exit and exec hash or unhash, all under tasklist_lock */
+	if (hlist_unhashed(&p->lowmem_adj_node))
+		return;
+
+	spin_lock(&lowmem_adj_lock);
+	hlist_del_init(&p->lowmem_adj_node);
+	spin_unlock(&lowmem_adj_lock);
+}
+
+/* A thread other than the leader exec'ed and is taking its place. */
+void lowmem_task_exec(struct task_struct *leader, struct task_struct *tsk)
+{
+	if (hlist_unhashed(&leader->lowmem_adj_node))
+		return;
+
+	spin_lock(&lowmem_adj_lock);
+	tsk->lowmem_adj = leader->lowmem_adj;
+	hlist_add_before(&tsk->lowmem_adj_node, &leader->lowmem_adj_node);
+	hlist_del_init(&leader->lowmem_adj_node);
+	spin_unlock(&lowmem_adj_lock);
+}
+
+/*
+ * Move the process to the list of its current oom_adj.  Racing writers to
+ * oom_adj are fine, the last one to get here sees the final value.
+ */
+void lowmem_task_adj_changed(struct task_struct *task)
+{
+	struct task_struct *leader;
+	int adj;
+
+	read_lock(&tasklist_lock);
+	leader = task->group_leader;
+	spin_lock_irq(&lowmem_adj_lock);
+	adj = leader->signal->oom_adj;
+	if (!hlist_unhashed(&leader->lowmem_adj_node) &&
+	    adj != leader->lowmem_adj) {
+		hlist_del(&leader->lowmem_adj_node);
+		leader->lowmem_adj = adj;
+		hlist_add_head(&leader->lowmem_adj_node, lowmem_adj_list(adj));
+	}
+	spin_unlock_irq(&lowmem_adj_lock);
+	read_unlock(&tasklist_lock);
+}
+
 static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data);
 
@@ -76,29 +206,171 @@ static int
 task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 {
 	struct task_struct *task = data;
+	unsigned long flags;
+	u64 delta;
 
-	if (task == lowmem_deathpending)
+	if (task == lowmem_deathpending) {
 		lowmem_deathpending = NULL;
+		delta = ktime_to_ns(ktime_sub(ktime_get(),
+					      lowmem_deathpending_start));
+		spin_lock_irqsave(&lowmem_stats_lock, flags);
+		lowmem_stats.kill_ns += delta;
+		if (delta > lowmem_stats.kill_ns_max)
+			lowmem_stats.kill_ns_max = delta;
+		spin_unlock_irqrestore(&lowmem_stats_lock, flags);
+	}
 
 	return NOTIFY_OK;
 }
 
+static unsigned long lowmem_zone_events(enum vm_event_item normal)
+{
+	unsigned long sum = 0;
+	int cpu, zone;
+
+	for_each_online_cpu(cpu) {
+		struct vm_event_state *this = &per_cpu(vm_event_states, cpu);
+
+		for (zone = 0; zone < MAX_NR_ZONES; zone++)
+			sum += this->event[normal - ZONE_NORMAL + zone];
+	}
+	return sum;
+}
+
+/*
+ * Reclaim pressure in percent, like vmpressure: the share of the pages
+ * reclaim scanned in the last window that it did not manage to free.  Taken
+ * as zero once reclaim has not scanned a window's worth for a second.
+ */
+static int lowmem_reclaim_pressure(void)
+{
+	unsigned long scanned, reclaimed;
+	int level;
+
+	if (!spin_trylock(&lowmem_pressure_lock))
+		return ACCESS_ONCE(lowmem_vmpressure.level);
+
+	scanned = lowmem_zone_events(PGSCAN_KSWAPD_NORMAL) +
+		lowmem_zone_events(PGSCAN_DIRECT_NORMAL);
+	reclaimed = lowmem_zone_events(PGSTEAL_NORMAL);
+	scanned -= lowmem_vmpressure.scanned;
+	reclaimed -= lowmem_vmpressure.reclaimed;
+
+	if (scanned >= lowmem_pressure_window) {
+		reclaimed = min(reclaimed, scanned);
+		lowmem_vmpressure.level = 100 - reclaimed * 100 / scanned;
+		lowmem_vmpressure.scanned += scanned;
+		lowmem_vmpressure.reclaimed += reclaimed;
+		lowmem_vmpressure.stamp = jiffies;
+	} else if (time_after(jiffies, lowmem_vmpressure.stamp + HZ)) {
+		lowmem_vmpressure.level = 0;
+	}
+	level = lowmem_vmpressure.level;
+
+	spin_unlock(&lowmem_pressure_lock);
+	return level;
+}
+
+/*
+ * Pick the task to kill among the processes of the highest oom_adj, at
+ * least min_adj, that has any.  Returns it with a reference held.
+ *
+ * Every process looked at is pinned while lowmem_adj_lock is dropped for
+ * task_lock(); if it moved to another list meanwhile, the rest of its old
+ * list is skipped.
+ */
+static struct task_struct *lowmem_select(int min_adj, int *sizep, int *adjp)
+{
+	struct task_struct *tsk, *p, *last, *selected = NULL;
+	struct hlist_node *pos;
+	int target_free = 0;
+	int selected_tasksize = 0;
+	int selected_target_offset = 0;
+	int tasksize, target_offset;
+	int adj;
+	unsigned long scanned = 0;
+	ktime_t start = ktime_get();
+	unsigned long flags;
+	u64 delta;
+
+	for (adj = OOM_ADJUST_MAX; adj >= min_adj && !selected; adj--) {
+		last = NULL;
+		spin_lock_irq(&lowmem_adj_lock);
+		pos = lowmem_adj_list(adj)->first;
+		while (pos) {
+			tsk = hlist_entry(pos, struct task_struct,
+					  lowmem_adj_node);
+			get_task_struct(tsk);
+			spin_unlock_irq(&lowmem_adj_lock);
+			if (last)
+				put_task_struct(last);
+			last = tsk;
+			scanned++;
+
+			/* the reference does not keep the thread list alive */
+			rcu_read_lock();
+			p = find_lock_task_mm(tsk);
+			if (p) {
+				tasksize = get_mm_rss(p->mm);
+				target_offset = abs(target_free - tasksize);
+				if (tasksize > 0 && (!selected ||
+				    target_offset < selected_target_offset)) {
+					get_task_struct(p);
+					if (selected)
+						put_task_struct(selected);
+					selected = p;
+					selected_tasksize = tasksize;
+					selected_target_offset = target_offset;
+					lowmem_print(2, "select %d (%s), adj %d, "
+						     "size %d, to kill\n",
+						     p->pid, p->comm, adj,
+						     tasksize);
+				}
+				task_unlock(p);
+			}
+			rcu_read_unlock();
+
+			spin_lock_irq(&lowmem_adj_lock);
+			if (tsk->lowmem_adj == adj &&
+			    !hlist_unhashed(&tsk->lowmem_adj_node))
+				pos = tsk->lowmem_adj_node.next;
+			else
+				pos = NULL;
+		}
+		spin_unlock_irq(&lowmem_adj_lock);
+		if (last)
+			put_task_struct(last);
+	}
+
+	*sizep = selected_tasksize;
+	*adjp = adj + 1;
+
+	delta = ktime_to_ns(ktime_sub(ktime_get(), start));
+	spin_lock_irqsave(&lowmem_stats_lock, flags);
+	lowmem_stats.selects++;
+	lowmem_stats.tasks_scanned += scanned;
+	lowmem_stats.scan_ns += delta;
+	if (delta > lowmem_stats.scan_ns_max)
+		lowmem_stats.scan_ns_max = delta;
+	spin_unlock_irqrestore(&lowmem_stats_lock, flags);
+
+	return selected;
+}
+
 static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct task_struct *tsk;
-	struct task_struct *selected = NULL;
+	struct task_struct *selected;
+	unsigned long flags;
 	int rem = 0;
-	int tasksize;
 	int i;
 	int min_adj = OOM_ADJUST_MAX + 1;
-	int target_free = 0;
-	int selected_tasksize = 0;
-	int selected_target_offset;
+	int selected_tasksize;
 	int selected_oom_adj;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
 						global_page_state(NR_SHMEM);
+	int pressure = lowmem_reclaim_pressure();
 
 	/*
 	 * If we already have a death outstanding, then
@@ -107,9 +379,14 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	 * this pass.
 	 *
 	 */
-	if (lowmem_deathpending &&
-	    time_before_eq(jiffies, lowmem_deathpending_timeout))
-		return 0;
+	if (lowmem_deathpending) {
+		if (time_before_eq(jiffies, lowmem_deathpending_timeout))
+			return 0;
+		spin_lock_irqsave(&lowmem_stats_lock, flags);
+		lowmem_stats.kills_timedout++;
+		spin_unlock_irqrestore(&lowmem_stats_lock, flags);
+		lowmem_deathpending = NULL;
+	}
 
 	if (lowmem_adj_size < array_size)
 		array_size = lowmem_adj_size;
@@ -117,15 +394,22 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		array_size = lowmem_minfree_size;
 	for (i = 0; i < array_size; i++) {
 		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
+		    other_file < lowmem_minfree[i] &&
+		    pressure >= lowmem_minfree_pressure) {
+			min_adj = lowmem_adj[i];
+			break;
+		}
+		if (i < lowmem_pressure_size &&
+		    pressure >= lowmem_pressure[i]) {
 			min_adj = lowmem_adj[i];
 			break;
 		}
 	}
 	if (sc->nr_to_scan > 0)
-		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
-			     sc->nr_to_scan, sc->gfp_mask, other_free, other_file,
-			     min_adj);
+		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, "
+			     "pressure %d, ma %d\n",
+			     sc->nr_to_scan, sc->gfp_mask, other_free,
+			     other_file, pressure, min_adj);
 	rem = global_page_state(NR_ACTIVE_ANON) +
 		global_page_state(NR_ACTIVE_FILE) +
 		global_page_state(NR_INACTIVE_ANON) +
@@ -135,59 +419,28 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			     sc->nr_to_scan, sc->gfp_mask, rem);
 		return rem;
 	}
-	selected_oom_adj = min_adj;
-
-	rcu_read_lock();
-	for_each_process(tsk) {
-		struct task_struct *p;
-		int oom_adj;
-		int target_offset;
-
-		if (tsk->flags & PF_KTHREAD)
-			continue;
 
-		p = find_lock_task_mm(tsk);
-		if (!p)
-			continue;
-
-		oom_adj = p->signal->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(p->mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		target_offset = abs(target_free - tasksize);
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    target_offset >= selected_target_offset)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_target_offset = target_offset;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
-	}
+	selected = lowmem_select(min_adj, &selected_tasksize,
+				 &selected_oom_adj);
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
 			     selected_oom_adj, selected_tasksize);
+		lowmem_deathpending_start = ktime_get();
 		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + HZ;
 		send_sig(SIGKILL, selected, 0);
+		put_task_struct(selected);
+		spin_lock_irqsave(&lowmem_stats_lock, flags);
+		lowmem_stats.kills++;
+		spin_unlock_irqrestore(&lowmem_stats_lock, flags);
 		rem -= selected_tasksize;
 	}
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	rcu_read_unlock();
-    if (selected)
-        compact_nodes(false);
+	/* compact in the background, not in this allocation's reclaim */
+	if (selected)
+		wakeup_kcompactd(0);
 	return rem;
 }
 
@@ -196,6 +449,42 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+static int lowmem_stats_get(char *buffer, const struct kernel_param *kp)
+{
+	unsigned long selects, kills, flags;
+	u64 scan_ns, kill_ns;
+	int len;
+
+	spin_lock_irqsave(&lowmem_stats_lock, flags);
+	selects = lowmem_stats.selects;
+	kills = lowmem_stats.kills - lowmem_stats.kills_timedout;
+	scan_ns = lowmem_stats.scan_ns;
+	kill_ns = lowmem_stats.kill_ns;
+	len = scnprintf(buffer, PAGE_SIZE,
+			"pressure %d\n"
+			"kills %lu\n"
+			"kills_timedout %lu\n"
+			"selects %lu\n"
+			"tasks_scanned %lu\n"
+			"scan_us_avg %llu\n"
+			"scan_us_max %llu\n"
+			"kill_us_avg %llu\n"
+			"kill_us_max %llu\n",
+			ACCESS_ONCE(lowmem_vmpressure.level),
+			lowmem_stats.kills, lowmem_stats.kills_timedout,
+			selects, lowmem_stats.tasks_scanned,
+			selects ? div64_u64(scan_ns, (u64)selects * NSEC_PER_USEC) : 0,
+			div_u64(lowmem_stats.scan_ns_max, NSEC_PER_USEC),
+			kills ? div64_u64(kill_ns, (u64)kills * NSEC_PER_USEC) : 0,
+			div_u64(lowmem_stats.kill_ns_max, NSEC_PER_USEC));
+	spin_unlock_irqrestore(&lowmem_stats_lock, flags);
+	return len;
+}
+
+static struct kernel_param_ops lowmem_stats_ops = {
+	.get = lowmem_stats_get,
+};
+
 static int __init lowmem_init(void)
 {
 	task_free_register(&task_nb);
@@ -214,10 +503,16 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 			 S_IRUGO | S_IWUSR);
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
+module_param_array_named(pressure, lowmem_pressure, int,
+			 &lowmem_pressure_size, S_IRUGO | S_IWUSR);
+module_param_named(minfree_pressure, lowmem_minfree_pressure, int,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_window, lowmem_pressure_window, int,
+		   S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_cb(stats, &lowmem_stats_ops, NULL, S_IRUGO);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
 
 MODULE_LICENSE("GPL");
-
@@ -29,6 +29,8 @@
 #include <linux/types.h>
 #include <linux/atomic.h>
 #include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include "tmem.h"
 
 #include "../zram/xvmalloc.h" /* if built in drivers/staging */
@@ -1706,15 +1708,25 @@ out:
  */
 
 #ifdef CONFIG_CLEANCACHE
+/* like the other counters, these are only approximate */
+static unsigned long zcache_cleancache_puts;
+static unsigned long zcache_cleancache_failed_puts;
+static unsigned long zcache_cleancache_hits;
+static unsigned long zcache_cleancache_misses;
+
 static void zcache_cleancache_put_page(int pool_id,
 					struct cleancache_filekey key,
 					pgoff_t index, struct page *page)
 {
 	u32 ind = (u32) index;
 	struct tmem_oid oid = *(struct tmem_oid *)&key;
+	int ret = -1;
 
 	if (likely(ind == index))
-		(void)zcache_put_page(LOCAL_CLIENT, pool_id, &oid, index, page);
+		ret = zcache_put_page(LOCAL_CLIENT, pool_id, &oid, index, page);
+	zcache_cleancache_puts++;
+	if (ret < 0)
+		zcache_cleancache_failed_puts++;
 }
 
 static int zcache_cleancache_get_page(int pool_id,
@@ -1727,6 +1739,10 @@ static int zcache_cleancache_get_page(int pool_id,
 
 	if (likely(ind == index))
 		ret = zcache_get_page(LOCAL_CLIENT, pool_id, &oid, index, page);
+	if (ret >= 0)
+		zcache_cleancache_hits++;
+	else
+		zcache_cleancache_misses++;
 	return ret;
 }
 
@@ -1791,6 +1807,73 @@ struct cleancache_ops zcache_cleancache_register_ops(void)
 }
 #endif
 
+#if defined(CONFIG_CLEANCACHE) && defined(CONFIG_DEBUG_FS)
+/*
+ * /sys/kernel/debug/zcache/cleancache: how well the compressed page cache
+ * is doing, all in one place.  The detailed counters are in sysfs.
+ */
+static int zcache_cleancache_show(struct seq_file *m, void *unused)
+{
+	unsigned long hits = zcache_cleancache_hits;
+	unsigned long gets = hits + zcache_cleancache_misses;
+	unsigned long zbytes = zcache_zbud_curr_zbytes;
+	int zpages = atomic_read(&zcache_zbud_curr_zpages);
+	int raw_pages = atomic_read(&zcache_zbud_curr_raw_pages);
+
+	seq_printf(m, "puts:            %lu\n", zcache_cleancache_puts);
+	seq_printf(m, "failed_puts:     %lu\n",
+		   zcache_cleancache_failed_puts);
+	seq_printf(m, "compress_poor:   %lu\n", zcache_compress_poor);
+	seq_printf(m, "put_to_flush:    %lu\n", zcache_put_to_flush);
+	seq_printf(m, "hits:            %lu\n", hits);
+	seq_printf(m, "misses:          %lu\n", zcache_cleancache_misses);
+	if (gets)
+		seq_printf(m, "hit_ratio:       %lu%%\n",
+			   (unsigned long)div_u64((u64)hits * 100, gets));
+	seq_printf(m, "flushes:         %lu\n", zcache_flush_found);
+	seq_printf(m, "inode_flushes:   %lu\n", zcache_flobj_found);
+	seq_printf(m, "evicted_pages:   %lu\n",
+		   zcache_evicted_raw_pages + zcache_evicted_unbuddied_pages +
+		   zcache_evicted_buddied_pages);
+	seq_printf(m, "stored_pages:    %d\n", zpages);
+	seq_printf(m, "compr_data_size: %lu\n", zbytes);
+	seq_printf(m, "mem_used_total:  %lu\n",
+		   (unsigned long)raw_pages << PAGE_SHIFT);
+	if (raw_pages > 0)
+		seq_printf(m, "pages_per_page:  %d.%02d\n",
+			   zpages / raw_pages, zpages * 100 / raw_pages % 100);
+	return 0;
+}
+
+static int zcache_cleancache_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zcache_cleancache_show, NULL);
+}
+
+static const struct file_operations zcache_cleancache_fops = {
+	.owner = THIS_MODULE,
+	.open = zcache_cleancache_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static struct dentry *zcache_debugfs_root;
+
+static void __init zcache_debugfs_init(void)
+{
+	zcache_debugfs_root = debugfs_create_dir("zcache", NULL);
+	if (!zcache_debugfs_root)
+		return;
+	debugfs_create_file("cleancache", S_IRUGO, zcache_debugfs_root,
+			    NULL, &zcache_cleancache_fops);
+}
+#else
+static inline void zcache_debugfs_init(void)
+{
+}
+#endif
+
 #ifdef CONFIG_FRONTSWAP
 /* a single tmem poolid is used for all frontswap "types" (swapfiles) */
 static int zcache_frontswap_poolid = -1;
@@ -1900,10 +1983,14 @@ struct frontswap_ops zcache_frontswap_register_ops(void)
 /*
  * zcache initialization
  * NOTE FOR NOW zcache MUST BE PROVIDED AS A KERNEL BOOT PARAMETER OR
- * NOTHING HAPPENS!
+ * NOTHING HAPPENS, unless CONFIG_ZCACHE_DEFAULT_ENABLED is set!
  */
 
+#ifdef CONFIG_ZCACHE_DEFAULT_ENABLED
+static int zcache_enabled = 1;
+#else
 static int zcache_enabled;
+#endif
 
 static int __init enable_zcache(char *s)
 {
@@ -1983,6 +2070,7 @@ static int __init zcache_init(void)
 			"transcendent memory and compression buddies\n");
 		if (old_ops.init_fs != NULL)
 			pr_warning("zcache: cleancache_ops overridden");
+		zcache_debugfs_init();
 	}
 #endif
 #ifdef CONFIG_FRONTSWAP
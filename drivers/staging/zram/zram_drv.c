@@ -23,15 +23,19 @@
 #include <linux/kernel.h>
 #include <linux/bio.h>
 #include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
+#include <linux/completion.h>
+#include <linux/crypto.h>
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/wait.h>
 
 #include "zram_drv.h"
 
@@ -42,33 +46,45 @@ struct zram *devices;
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
+static void zram_stat_add(struct zram *zram, enum zram_stat_item item,
+			  s64 delta)
 {
-	*v = *v + 1;
-}
+	struct zram_stats *stats = get_cpu_ptr(zram->stats);
 
-static void zram_stat_dec(u32 *v)
-{
-	*v = *v - 1;
+	u64_stats_update_begin(&stats->syncp);
+	stats->count[item] += delta;
+	u64_stats_update_end(&stats->syncp);
+	put_cpu_ptr(zram->stats);
 }
 
-static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
+static void zram_stat_inc(struct zram *zram, enum zram_stat_item item)
 {
-	spin_lock(&zram->stat64_lock);
-	*v = *v + inc;
-	spin_unlock(&zram->stat64_lock);
+	zram_stat_add(zram, item, 1);
 }
 
-static void zram_stat64_sub(struct zram *zram, u64 *v, u64 dec)
+static void zram_stat_dec(struct zram *zram, enum zram_stat_item item)
 {
-	spin_lock(&zram->stat64_lock);
-	*v = *v - dec;
-	spin_unlock(&zram->stat64_lock);
+	zram_stat_add(zram, item, -1);
 }
 
-static void zram_stat64_inc(struct zram *zram, u64 *v)
+u64 zram_stat_read(struct zram *zram, enum zram_stat_item item)
 {
-	zram_stat64_add(zram, v, 1);
+	unsigned int start;
+	u64 val, sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_stats *stats = per_cpu_ptr(zram->stats, cpu);
+
+		do {
+			start = u64_stats_fetch_begin(&stats->syncp);
+			val = stats->count[item];
+		} while (u64_stats_fetch_retry(&stats->syncp, start));
+
+		sum += val;
+	}
+
+	return sum;
 }
 
 static int zram_test_flag(struct zram *zram, u32 index,
@@ -89,21 +105,246 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+/*
+ * Table entries are protected by a bit spinlock in their own flags
+ * word, so reads and writes to different slots never contend. Flag
+ * updates must be made with the slot locked.
+ */
+static void zram_slot_lock(struct zram *zram, u32 index)
+{
+	bit_spin_lock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
+static void zram_slot_unlock(struct zram *zram, u32 index)
+{
+	bit_spin_unlock(ZRAM_ACCESS, &zram->table[index].flags);
+}
+
+/* Compressors zram can use, in order of preference for the default */
+static const char * const zram_backends[] = {
+	"lzo",
+	"lz4",
+	"deflate",
+	NULL
+};
+
+static void zram_stream_free(struct zram_stream *zstrm)
+{
+	if (!IS_ERR_OR_NULL(zstrm->tfm))
+		crypto_free_comp(zstrm->tfm);
+	free_pages((unsigned long)zstrm->buffer, 1);
+	kfree(zstrm);
+}
+
+static struct zram_stream *zram_stream_alloc(struct zram *zram)
+{
+	struct zram_stream *zstrm;
+
+	zstrm = kzalloc(sizeof(*zstrm), GFP_KERNEL);
+	if (!zstrm)
+		return NULL;
+
+	zstrm->tfm = crypto_alloc_comp(zram->compressor, 0, 0);
+	zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (IS_ERR(zstrm->tfm) || !zstrm->buffer) {
+		zram_stream_free(zstrm);
+		return NULL;
+	}
+
+	return zstrm;
+}
+
+/*
+ * Get an idle compression stream, waiting for one to be released
+ * if all are busy. May sleep.
+ *
+ * Streams are only allocated from process context (device init and
+ * max_comp_streams updates): the crypto API allocates transforms with
+ * GFP_KERNEL, which must not happen in the swap-out path.
+ */
+static struct zram_stream *zram_stream_get(struct zram *zram)
+{
+	struct zram_stream *zstrm;
+
+	spin_lock(&zram->strm_lock);
+	while (list_empty(&zram->idle_strm)) {
+		spin_unlock(&zram->strm_lock);
+		wait_event(zram->strm_wait, !list_empty(&zram->idle_strm));
+		spin_lock(&zram->strm_lock);
+	}
+	zstrm = list_entry(zram->idle_strm.next, struct zram_stream, list);
+	list_del(&zstrm->list);
+	spin_unlock(&zram->strm_lock);
+
+	return zstrm;
+}
+
+static void zram_stream_put(struct zram *zram, struct zram_stream *zstrm)
+{
+	spin_lock(&zram->strm_lock);
+	if (zram->avail_strm <= zram->max_strm) {
+		list_add(&zstrm->list, &zram->idle_strm);
+		spin_unlock(&zram->strm_lock);
+		wake_up(&zram->strm_wait);
+		return;
+	}
+
+	zram->avail_strm--;
+	spin_unlock(&zram->strm_lock);
+	zram_stream_free(zstrm);
+}
+
+static void zram_destroy_streams(struct zram *zram)
+{
+	struct zram_stream *zstrm;
+
+	while (!list_empty(&zram->idle_strm)) {
+		zstrm = list_entry(zram->idle_strm.next,
+				struct zram_stream, list);
+		list_del(&zstrm->list);
+		zram_stream_free(zstrm);
+		zram->avail_strm--;
+	}
+}
+
+/*
+ * Allocate streams until there are max_strm of them, and release
+ * idle ones beyond that. Busy surplus streams are released when
+ * they are put back. Called with init_lock held.
+ */
+static int zram_balance_streams(struct zram *zram)
+{
+	struct zram_stream *zstrm;
+
+	spin_lock(&zram->strm_lock);
+	while (zram->avail_strm < zram->max_strm) {
+		zram->avail_strm++;
+		spin_unlock(&zram->strm_lock);
+
+		zstrm = zram_stream_alloc(zram);
+		if (!zstrm) {
+			spin_lock(&zram->strm_lock);
+			zram->avail_strm--;
+			spin_unlock(&zram->strm_lock);
+			return -ENOMEM;
+		}
+		zram_stream_put(zram, zstrm);
+		spin_lock(&zram->strm_lock);
+	}
+
+	while (zram->avail_strm > zram->max_strm &&
+	       !list_empty(&zram->idle_strm)) {
+		zstrm = list_entry(zram->idle_strm.next,
+				struct zram_stream, list);
+		list_del(&zstrm->list);
+		zram->avail_strm--;
+		spin_unlock(&zram->strm_lock);
+		zram_stream_free(zstrm);
+		spin_lock(&zram->strm_lock);
+	}
+	spin_unlock(&zram->strm_lock);
+
+	return 0;
+}
+
+/*
+ * Change the maximum number of concurrent compression streams.
+ * Streams for an uninitialized device are created at init time.
+ */
+int zram_set_max_streams(struct zram *zram, int num_strm)
+{
+	int ret = 0;
+
+	mutex_lock(&zram->init_lock);
+	zram->max_strm = num_strm;
+	if (zram->init_done)
+		ret = zram_balance_streams(zram);
+	mutex_unlock(&zram->init_lock);
+
+	return ret;
+}
+
+/*
+ * Select the compression backend. Only possible before the device
+ * is initialized, since stored pages could not be read back with a
+ * different algorithm.
+ */
+int zram_set_compressor(struct zram *zram, const char *name)
+{
+	int i, ret = -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	for (i = 0; zram_backends[i]; i++) {
+		if (sysfs_streq(name, zram_backends[i]) &&
+		    crypto_has_comp(zram_backends[i], 0, 0)) {
+			zram->compressor = zram_backends[i];
+			ret = 0;
+			break;
+		}
+	}
+out:
+	mutex_unlock(&zram->init_lock);
+	return ret;
+}
+
+ssize_t zram_show_compressors(struct zram *zram, char *buf)
+{
+	int i;
+	ssize_t sz = 0;
+
+	for (i = 0; zram_backends[i]; i++) {
+		if (!crypto_has_comp(zram_backends[i], 0, 0))
+			continue;
+
+		if (zram->compressor == zram_backends[i])
+			sz += sprintf(buf + sz, "[%s] ", zram_backends[i]);
+		else
+			sz += sprintf(buf + sz, "%s ", zram_backends[i]);
+	}
+	if (sz)
+		buf[sz - 1] = '\n';
+
+	return sz;
+}
+
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
+
 	return 1;
 }
 
+static void zram_fill_page(void *ptr, unsigned int len, unsigned long value)
+{
+	unsigned int pos;
+	unsigned long *page;
+
+	if (likely(value == 0)) {
+		memset(ptr, 0, len);
+		return;
+	}
+
+	page = (unsigned long *)ptr;
+
+	for (pos = 0; pos != len / sizeof(*page); pos++)
+		page[pos] = value;
+}
+
 static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 {
 	if (!zram->disksize) {
@@ -133,57 +374,331 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
-static void zram_free_page(struct zram *zram, size_t index)
+static struct zram_entry *zram_entry_alloc(struct zram *zram,
+					   unsigned long handle,
+					   unsigned int len)
 {
-	u32 clen;
-	void *obj;
+	struct zram_entry *entry;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	entry = kmalloc(sizeof(*entry), GFP_NOIO);
+	if (!entry)
+		return NULL;
 
-	if (unlikely(!page)) {
-		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
-		 */
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			zram_clear_flag(zram, index, ZRAM_ZERO);
-			zram_stat_dec(&zram->stats.pages_zero);
+	RB_CLEAR_NODE(&entry->rb_node);
+	entry->checksum = 0;
+	entry->refcount = 1;
+	entry->handle = handle;
+	entry->len = len;
+
+	return entry;
+}
+
+static void zram_entry_free(struct zram *zram, struct zram_entry *entry)
+{
+	if (unlikely(entry->len == PAGE_SIZE)) {
+		__free_page((struct page *)entry->handle);
+		zram_stat_dec(zram, ZRAM_PAGES_EXPAND);
+	} else {
+		zs_free(zram->mem_pool, entry->handle);
+		if (entry->len <= PAGE_SIZE / 2)
+			zram_stat_dec(zram, ZRAM_GOOD_COMPRESS);
+	}
+
+	zram_stat_add(zram, ZRAM_COMPR_SIZE, -(s64)entry->len);
+	kfree(entry);
+}
+
+static struct zram_hash *zram_hash_bucket(struct zram *zram, u32 checksum)
+{
+	return &zram->hash[checksum % zram->hash_size];
+}
+
+/*
+ * Drop one reference to @entry. Returns true if that was the last one,
+ * in which case the entry is no longer reachable and the caller frees it.
+ */
+static bool zram_entry_put(struct zram *zram, struct zram_entry *entry)
+{
+	struct zram_hash *hash;
+	bool last;
+
+	/* Entries stored while dedup was off are never shared */
+	if (RB_EMPTY_NODE(&entry->rb_node))
+		return true;
+
+	hash = zram_hash_bucket(zram, entry->checksum);
+	spin_lock(&hash->lock);
+	last = !--entry->refcount;
+	if (last)
+		rb_erase(&entry->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+
+	return last;
+}
+
+static u32 zram_calc_checksum(unsigned char *mem)
+{
+	return jhash2((u32 *)mem, PAGE_SIZE / sizeof(u32), 0);
+}
+
+static void zram_dedup_insert(struct zram *zram, struct zram_entry *new,
+			      u32 checksum)
+{
+	struct zram_hash *hash = zram_hash_bucket(zram, checksum);
+	struct rb_node **rb_node, *parent = NULL;
+	struct zram_entry *entry;
+
+	new->checksum = checksum;
+
+	spin_lock(&hash->lock);
+	rb_node = &hash->rb_root.rb_node;
+	while (*rb_node) {
+		parent = *rb_node;
+		entry = rb_entry(parent, struct zram_entry, rb_node);
+		if (checksum < entry->checksum)
+			rb_node = &parent->rb_left;
+		else
+			rb_node = &parent->rb_right;
+	}
+
+	rb_link_node(&new->rb_node, parent, rb_node);
+	rb_insert_color(&new->rb_node, &hash->rb_root);
+	spin_unlock(&hash->lock);
+}
+
+static bool zram_dedup_match(struct zram *zram, struct zram_stream *zstrm,
+			     struct zram_entry *entry, unsigned char *mem)
+{
+	unsigned int clen = PAGE_SIZE;
+	unsigned char *cmem;
+	bool match;
+	int ret;
+
+	if (unlikely(entry->len == PAGE_SIZE)) {
+		cmem = kmap_atomic((struct page *)entry->handle, KM_USER1);
+		match = !memcmp(mem, cmem, PAGE_SIZE);
+		kunmap_atomic(cmem, KM_USER1);
+		return match;
+	}
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	ret = crypto_comp_decompress(zstrm->tfm, cmem, entry->len,
+				     zstrm->buffer, &clen);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	return !ret && clen == PAGE_SIZE && !memcmp(mem, zstrm->buffer, PAGE_SIZE);
+}
+
+/*
+ * Look for an object already holding the data in @mem and take a
+ * reference to it. Only the first entry with a matching checksum is
+ * compared: a jhash collision between two live pages is rare enough
+ * that storing the page again is cheaper than walking the duplicates.
+ * The stream's buffer is used as decompression scratch space.
+ */
+static struct zram_entry *zram_dedup_find(struct zram *zram,
+					  struct zram_stream *zstrm,
+					  unsigned char *mem, u32 checksum)
+{
+	struct zram_hash *hash = zram_hash_bucket(zram, checksum);
+	struct zram_entry *entry = NULL;
+	struct rb_node *rb_node;
+
+	spin_lock(&hash->lock);
+	rb_node = hash->rb_root.rb_node;
+	while (rb_node) {
+		struct zram_entry *cur;
+
+		cur = rb_entry(rb_node, struct zram_entry, rb_node);
+		if (checksum == cur->checksum) {
+			entry = cur;
+			entry->refcount++;
+			break;
 		}
+
+		if (checksum < cur->checksum)
+			rb_node = rb_node->rb_left;
+		else
+			rb_node = rb_node->rb_right;
+	}
+	spin_unlock(&hash->lock);
+
+	if (!entry)
+		return NULL;
+
+	if (zram_dedup_match(zram, zstrm, entry, mem))
+		return entry;
+
+	if (zram_entry_put(zram, entry))
+		zram_entry_free(zram, entry);
+
+	return NULL;
+}
+
+static unsigned long zram_bd_alloc(struct zram *zram)
+{
+	unsigned long blk;
+
+	spin_lock(&zram->bd_lock);
+	blk = find_first_zero_bit(zram->bd_bitmap, zram->bd_nr_pages);
+	if (blk < zram->bd_nr_pages)
+		set_bit(blk, zram->bd_bitmap);
+	spin_unlock(&zram->bd_lock);
+
+	return blk;
+}
+
+static void zram_bd_free(struct zram *zram, unsigned long blk)
+{
+	spin_lock(&zram->bd_lock);
+	WARN_ON_ONCE(!test_bit(blk, zram->bd_bitmap));
+	clear_bit(blk, zram->bd_bitmap);
+	spin_unlock(&zram->bd_lock);
+}
+
+static void zram_close_backing_dev(struct zram *zram)
+{
+	if (!zram->bdev)
 		return;
+
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	zram->bdev = NULL;
+	vfree(zram->bd_bitmap);
+	zram->bd_bitmap = NULL;
+	zram->bd_nr_pages = 0;
+	kfree(zram->bd_path);
+	zram->bd_path = NULL;
+}
+
+/*
+ * Use the block device at @path to hold pages written back from RAM,
+ * or stop using one if @path is "none". Only allowed before the
+ * device is initialized. A swap file can be used through a loop device.
+ */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	struct block_device *bdev;
+	unsigned long nr_pages;
+	unsigned long *bitmap;
+	char *bd_path;
+	int ret = 0;
+
+	bd_path = kstrdup(path, GFP_KERNEL);
+	if (!bd_path)
+		return -ENOMEM;
+	strim(bd_path);
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		ret = -EBUSY;
+		goto out;
 	}
 
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
-		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_dec(&zram->stats.pages_expand);
+	zram_close_backing_dev(zram);
+	if (!strcmp(bd_path, "none"))
+		goto out;
+
+	bdev = blkdev_get_by_path(bd_path, FMODE_READ | FMODE_WRITE |
+				  FMODE_EXCL, zram);
+	if (IS_ERR(bdev)) {
+		ret = PTR_ERR(bdev);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
+	nr_pages = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	bitmap = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+	if (!nr_pages || !bitmap) {
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+		vfree(bitmap);
+		ret = nr_pages ? -ENOMEM : -EINVAL;
+		goto out;
+	}
 
-	xv_free(zram->mem_pool, page, offset);
-	if (clen <= PAGE_SIZE / 2)
-		zram_stat_dec(&zram->stats.good_compress);
+	zram->bdev = bdev;
+	zram->bd_bitmap = bitmap;
+	zram->bd_nr_pages = nr_pages;
+	zram->bd_path = bd_path;
+	bd_path = NULL;
+	pr_info("Backing device %s, %lu pages\n", zram->bd_path, nr_pages);
 
 out:
-	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
-	zram_stat_dec(&zram->stats.pages_stored);
+	mutex_unlock(&zram->init_lock);
+	kfree(bd_path);
+	return ret;
+}
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+void zram_set_writeback_age(struct zram *zram, unsigned int age)
+{
+	mutex_lock(&zram->init_lock);
+	zram->wb_age = age;
+	if (zram->init_done && zram->bdev && age) {
+		cancel_delayed_work(&zram->wb_work);
+		queue_delayed_work(system_unbound_wq, &zram->wb_work,
+				   age * HZ);
+	}
+	mutex_unlock(&zram->init_lock);
 }
 
-static void handle_zero_page(struct bio_vec *bvec)
+int zram_set_dedup(struct zram *zram, int enable)
+{
+	int ret = 0;
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done)
+		ret = -EBUSY;
+	else
+		zram->use_dedup = !!enable;
+	mutex_unlock(&zram->init_lock);
+
+	return ret;
+}
+
+static void zram_free_page(struct zram *zram, size_t index)
+{
+	struct zram_entry *entry;
+
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_bd_free(zram, zram->table[index].element);
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_stat_dec(zram, ZRAM_PAGES_BD);
+		zram_stat_dec(zram, ZRAM_PAGES_STORED);
+		zram->table[index].element = 0;
+		return;
+	}
+
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		/* No memory is allocated for same element filled pages */
+		if (!zram->table[index].element)
+			zram_stat_dec(zram, ZRAM_PAGES_ZERO);
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		zram_stat_dec(zram, ZRAM_PAGES_SAME);
+		zram->table[index].element = 0;
+		return;
+	}
+
+	entry = zram->table[index].entry;
+	if (!entry)
+		return;
+
+	if (zram_entry_put(zram, entry))
+		zram_entry_free(zram, entry);
+	else
+		zram_stat_dec(zram, ZRAM_PAGES_DUP);
+
+	zram_stat_dec(zram, ZRAM_PAGES_STORED);
+	zram->table[index].entry = NULL;
+}
+
+static void handle_same_page(struct bio_vec *bvec, unsigned long element)
 {
 	struct page *page = bvec->bv_page;
 	void *user_mem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	memset(user_mem + bvec->bv_offset, 0, bvec->bv_len);
+	zram_fill_page(user_mem + bvec->bv_offset, bvec->bv_len, element);
 	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
@@ -196,7 +711,8 @@ static void handle_uncompressed_page(struct zram *zram, struct bio_vec *bvec,
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1);
+	cmem = kmap_atomic((struct page *)zram->table[index].entry->handle,
+			   KM_USER1);
 
 	memcpy(user_mem + bvec->bv_offset, cmem + offset, bvec->bv_len);
 	kunmap_atomic(cmem, KM_USER1);
@@ -210,56 +726,223 @@ static inline int is_partial_io(struct bio_vec *bvec)
 	return bvec->bv_len != PAGE_SIZE;
 }
 
+static void zram_bd_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+struct zram_bd_read_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk;
+	int ret;
+};
+
+static void zram_bd_read_fn(struct work_struct *work)
+{
+	struct zram_bd_read_work *rw;
+	struct zram *zram;
+	struct bio *bio;
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	rw = container_of(work, struct zram_bd_read_work, work);
+	zram = rw->zram;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio) {
+		rw->ret = -ENOMEM;
+		return;
+	}
+
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = rw->blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_bd_end_io;
+	bio->bi_private = &done;
+	bio_add_page(bio, rw->page, PAGE_SIZE, 0);
+
+	submit_bio(READ_SYNC, bio);
+	wait_for_completion(&done);
+
+	rw->ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+}
+
+/*
+ * Read block @blk of the backing device into @page. We are called from
+ * zram's make_request function, where bios submitted to another device
+ * are only queued on current->bio_list until we return, so the read is
+ * issued and waited for from a worker.
+ */
+static int zram_bd_read(struct zram *zram, unsigned long blk,
+			struct page *page)
+{
+	struct zram_bd_read_work rw;
+
+	rw.zram = zram;
+	rw.page = page;
+	rw.blk = blk;
+
+	INIT_WORK_ONSTACK(&rw.work, zram_bd_read_fn);
+	queue_work(system_unbound_wq, &rw.work);
+	flush_work(&rw.work);
+	destroy_work_on_stack(&rw.work);
+
+	if (rw.ret)
+		pr_err("Backing device read failed! err=%d, block=%lu\n",
+		       rw.ret, blk);
+	else
+		zram_stat_inc(zram, ZRAM_BD_READS);
+
+	return rw.ret;
+}
+
+static int zram_bd_read_bvec(struct zram *zram, struct bio_vec *bvec,
+			     unsigned long blk, int offset)
+{
+	struct page *page = bvec->bv_page;
+	struct page *tmp;
+	unsigned char *user_mem, *mem;
+	int ret;
+
+	if (!is_partial_io(bvec)) {
+		ret = zram_bd_read(zram, blk, page);
+		if (!ret)
+			flush_dcache_page(page);
+		return ret;
+	}
+
+	tmp = alloc_page(GFP_NOIO);
+	if (!tmp)
+		return -ENOMEM;
+
+	ret = zram_bd_read(zram, blk, tmp);
+	if (!ret) {
+		user_mem = kmap_atomic(page, KM_USER0);
+		mem = kmap_atomic(tmp, KM_USER1);
+		memcpy(user_mem + bvec->bv_offset, mem + offset, bvec->bv_len);
+		kunmap_atomic(mem, KM_USER1);
+		kunmap_atomic(user_mem, KM_USER0);
+		flush_dcache_page(page);
+	}
+
+	__free_page(tmp);
+	return ret;
+}
+
+/* Does reading slot @index need a compression stream? */
+static bool zram_slot_compressed(struct zram *zram, u32 index)
+{
+	struct zram_entry *entry = zram->table[index].entry;
+
+	return !zram_test_flag(zram, index, ZRAM_WB) &&
+	       !zram_test_flag(zram, index, ZRAM_SAME) &&
+	       entry && entry->len != PAGE_SIZE;
+}
+
+/*
+ * Lock slot @index for reading. Returns a compression stream if the slot
+ * holds compressed data, else NULL: same-filled, written back and
+ * incompressible pages are read without waiting for a stream. Getting a
+ * stream may sleep, so the slot is checked again once it is ours.
+ */
+static struct zram_stream *zram_slot_lock_read(struct zram *zram, u32 index)
+{
+	struct zram_stream *zstrm = NULL;
+
+	zram_slot_lock(zram, index);
+	while (!zstrm && zram_slot_compressed(zram, index)) {
+		zram_slot_unlock(zram, index);
+		zstrm = zram_stream_get(zram);
+		zram_slot_lock(zram, index);
+	}
+
+	return zstrm;
+}
+
+static void zram_slot_unlock_read(struct zram *zram, u32 index,
+				  struct zram_stream *zstrm)
+{
+	zram_slot_unlock(zram, index);
+	if (zstrm)
+		zram_stream_put(zram, zstrm);
+}
+
 static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 			  u32 index, int offset, struct bio *bio)
 {
 	int ret;
-	size_t clen;
+	unsigned int clen;
 	struct page *page;
-	struct zobj_header *zheader;
+	struct zram_entry *entry;
+	struct zram_stream *zstrm;
 	unsigned char *user_mem, *cmem, *uncmem = NULL;
 
 	page = bvec->bv_page;
 
-	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-		handle_zero_page(bvec);
+	if (is_partial_io(bvec)) {
+		/* Use  a temporary buffer to decompress the page */
+		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		if (!uncmem) {
+			pr_info("Error allocating temp memory!\n");
+			return -ENOMEM;
+		}
+	}
+
+	zstrm = zram_slot_lock_read(zram, index);
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		unsigned long blk = zram->table[index].element;
+
+		zram_slot_unlock_read(zram, index, zstrm);
+		kfree(uncmem);
+		ret = zram_bd_read_bvec(zram, bvec, blk, offset);
+		if (unlikely(ret))
+			zram_stat_inc(zram, ZRAM_FAILED_READS);
+		return ret;
+	}
+
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		unsigned long element = zram->table[index].element;
+
+		zram_slot_unlock_read(zram, index, zstrm);
+		kfree(uncmem);
+		handle_same_page(bvec, element);
 		return 0;
 	}
 
 	/* Requested page is not present in compressed area */
-	if (unlikely(!zram->table[index].page)) {
+	entry = zram->table[index].entry;
+	if (unlikely(!entry)) {
+		zram_slot_unlock_read(zram, index, zstrm);
+		kfree(uncmem);
 		pr_debug("Read before write: sector=%lu, size=%u",
 			 (ulong)(bio->bi_sector), bio->bi_size);
-		handle_zero_page(bvec);
+		handle_same_page(bvec, 0);
 		return 0;
 	}
 
 	/* Page is stored uncompressed since it's incompressible */
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+	if (unlikely(entry->len == PAGE_SIZE)) {
 		handle_uncompressed_page(zram, bvec, index, offset);
+		zram_slot_unlock_read(zram, index, zstrm);
+		kfree(uncmem);
 		return 0;
 	}
 
-	if (is_partial_io(bvec)) {
-		/* Use  a temporary buffer to decompress the page */
-		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
-		if (!uncmem) {
-			pr_info("Error allocating temp memory!\n");
-			return -ENOMEM;
-		}
-	}
-
 	user_mem = kmap_atomic(page, KM_USER0);
 	if (!is_partial_io(bvec))
 		uncmem = user_mem;
 	clen = PAGE_SIZE;
 
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-		zram->table[index].offset;
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    xv_get_object_size(cmem) - sizeof(*zheader),
-				    uncmem, &clen);
+	ret = crypto_comp_decompress(zstrm->tfm, cmem, entry->len,
+				     uncmem, &clen);
+
+	zs_unmap_object(zram->mem_pool, entry->handle);
+	zram_slot_unlock_read(zram, index, zstrm);
 
 	if (is_partial_io(bvec)) {
 		memcpy(user_mem + bvec->bv_offset, uncmem + offset,
@@ -267,13 +950,12 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 		kfree(uncmem);
 	}
 
-	kunmap_atomic(cmem, KM_USER1);
 	kunmap_atomic(user_mem, KM_USER0);
 
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
-		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		zram_stat_inc(zram, ZRAM_FAILED_READS);
 		return ret;
 	}
 
@@ -282,38 +964,74 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	return 0;
 }
 
-static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
+/* Decompress a stored object into @mem. Called with the slot locked. */
+static int zram_decompress_entry(struct zram *zram, struct zram_stream *zstrm,
+				 struct zram_entry *entry, unsigned char *mem)
 {
 	int ret;
-	size_t clen = PAGE_SIZE;
-	struct zobj_header *zheader;
+	unsigned int clen = PAGE_SIZE;
 	unsigned char *cmem;
 
-	if (zram_test_flag(zram, index, ZRAM_ZERO) ||
-	    !zram->table[index].page) {
-		memset(mem, 0, PAGE_SIZE);
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(entry->len == PAGE_SIZE)) {
+		cmem = kmap_atomic((struct page *)entry->handle, KM_USER1);
+		memcpy(mem, cmem, PAGE_SIZE);
+		kunmap_atomic(cmem, KM_USER1);
 		return 0;
 	}
 
-	cmem = kmap_atomic(zram->table[index].page, KM_USER0) +
-		zram->table[index].offset;
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	ret = crypto_comp_decompress(zstrm->tfm, cmem, entry->len,
+				     mem, &clen);
+	zs_unmap_object(zram->mem_pool, entry->handle);
 
-	/* Page is stored uncompressed since it's incompressible */
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		memcpy(mem, cmem, PAGE_SIZE);
-		kunmap_atomic(cmem, KM_USER0);
+	return ret;
+}
+
+static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
+{
+	int ret;
+	struct zram_entry *entry;
+	struct zram_stream *zstrm;
+
+	zstrm = zram_slot_lock_read(zram, index);
+
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		unsigned long blk = zram->table[index].element;
+		struct page *tmp;
+
+		zram_slot_unlock_read(zram, index, zstrm);
+
+		tmp = alloc_page(GFP_NOIO);
+		if (!tmp)
+			return -ENOMEM;
+		ret = zram_bd_read(zram, blk, tmp);
+		if (!ret)
+			memcpy(mem, page_address(tmp), PAGE_SIZE);
+		__free_page(tmp);
+		if (unlikely(ret))
+			zram_stat_inc(zram, ZRAM_FAILED_READS);
+		return ret;
+	}
+
+	entry = zram->table[index].entry;
+	if (zram_test_flag(zram, index, ZRAM_SAME) || !entry) {
+		unsigned long element = 0;
+
+		if (zram_test_flag(zram, index, ZRAM_SAME))
+			element = zram->table[index].element;
+		zram_slot_unlock_read(zram, index, zstrm);
+		zram_fill_page(mem, PAGE_SIZE, element);
 		return 0;
 	}
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    xv_get_object_size(cmem) - sizeof(*zheader),
-				    mem, &clen);
-	kunmap_atomic(cmem, KM_USER0);
+	ret = zram_decompress_entry(zram, zstrm, entry, (unsigned char *)mem);
+	zram_slot_unlock_read(zram, index, zstrm);
 
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
-		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		zram_stat_inc(zram, ZRAM_FAILED_READS);
 		return ret;
 	}
 
@@ -324,14 +1042,15 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			   int offset)
 {
 	int ret;
-	u32 store_offset;
-	size_t clen;
-	struct zobj_header *zheader;
+	u32 checksum = 0;
+	unsigned long handle, element;
+	unsigned int clen;
+	struct zram_entry *entry;
+	struct zram_stream *zstrm = NULL;
 	struct page *page, *page_store;
 	unsigned char *user_mem, *cmem, *src, *uncmem = NULL;
 
 	page = bvec->bv_page;
-	src = zram->compress_buffer;
 
 	if (is_partial_io(bvec)) {
 		/*
@@ -345,46 +1064,67 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			goto out;
 		}
 		ret = zram_read_before_write(zram, uncmem, index);
-		if (ret) {
-			kfree(uncmem);
+		if (ret)
 			goto out;
-		}
 	}
 
 	/*
-	 * System overwrites unused sectors. Free memory associated
-	 * with this sector now.
+	 * Take a compression stream before mapping the page: waiting
+	 * for one may sleep.
 	 */
-	if (zram->table[index].page ||
-	    zram_test_flag(zram, index, ZRAM_ZERO))
-		zram_free_page(zram, index);
+	zstrm = zram_stream_get(zram);
+	src = zstrm->buffer;
 
 	user_mem = kmap_atomic(page, KM_USER0);
 
-	if (is_partial_io(bvec))
+	if (is_partial_io(bvec)) {
 		memcpy(uncmem + offset, user_mem + bvec->bv_offset,
 		       bvec->bv_len);
-	else
+		kunmap_atomic(user_mem, KM_USER0);
+		user_mem = NULL;
+	} else
 		uncmem = user_mem;
 
-	if (page_zero_filled(uncmem)) {
-		kunmap_atomic(user_mem, KM_USER0);
-		if (is_partial_io(bvec))
-			kfree(uncmem);
-		zram_stat_inc(&zram->stats.pages_zero);
-		zram_set_flag(zram, index, ZRAM_ZERO);
+	if (page_same_filled(uncmem, &element)) {
+		if (user_mem)
+			kunmap_atomic(user_mem, KM_USER0);
+		zram_stream_put(zram, zstrm);
+		zstrm = NULL;
+
+		/*
+		 * System overwrites unused sectors. Free memory
+		 * associated with this sector now.
+		 */
+		zram_slot_lock(zram, index);
+		zram_free_page(zram, index);
+		zram_set_flag(zram, index, ZRAM_SAME);
+		zram->table[index].element = element;
+		zram_slot_unlock(zram, index);
+		zram_stat_inc(zram, ZRAM_PAGES_SAME);
+		if (!element)
+			zram_stat_inc(zram, ZRAM_PAGES_ZERO);
 		ret = 0;
 		goto out;
 	}
 
-	ret = lzo1x_1_compress(uncmem, PAGE_SIZE, src, &clen,
-			       zram->compress_workmem);
+	if (zram->use_dedup) {
+		checksum = zram_calc_checksum(uncmem);
+		entry = zram_dedup_find(zram, zstrm, uncmem, checksum);
+		if (entry) {
+			if (user_mem)
+				kunmap_atomic(user_mem, KM_USER0);
+			zram_stat_inc(zram, ZRAM_PAGES_DUP);
+			goto found;
+		}
+	}
 
-	kunmap_atomic(user_mem, KM_USER0);
-	if (is_partial_io(bvec))
-			kfree(uncmem);
+	clen = 2 * PAGE_SIZE;
+	ret = crypto_comp_compress(zstrm->tfm, uncmem, PAGE_SIZE, src, &clen);
 
-	if (unlikely(ret != LZO_E_OK)) {
+	if (user_mem)
+		kunmap_atomic(user_mem, KM_USER0);
+
+	if (unlikely(ret)) {
 		pr_err("Compression failed! err=%d\n", ret);
 		goto out;
 	}
@@ -404,72 +1144,339 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			goto out;
 		}
 
-		store_offset = 0;
-		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_inc(&zram->stats.pages_expand);
-		zram->table[index].page = page_store;
-		src = kmap_atomic(page, KM_USER0);
-		goto memstore;
+		cmem = kmap_atomic(page_store, KM_USER1);
+		if (is_partial_io(bvec))
+			memcpy(cmem, uncmem, PAGE_SIZE);
+		else {
+			user_mem = kmap_atomic(page, KM_USER0);
+			memcpy(cmem, user_mem, PAGE_SIZE);
+			kunmap_atomic(user_mem, KM_USER0);
+		}
+		kunmap_atomic(cmem, KM_USER1);
+		handle = (unsigned long)page_store;
+	} else {
+		handle = zs_malloc(zram->mem_pool, clen);
+		if (!handle) {
+			pr_info("Error allocating memory for compressed "
+				"page: %u, size=%u\n", index, clen);
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+		memcpy(cmem, src, clen);
+		zs_unmap_object(zram->mem_pool, handle);
 	}
 
-	if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-		      &zram->table[index].page, &store_offset,
-		      GFP_NOIO | __GFP_HIGHMEM)) {
-		pr_info("Error allocating memory for compressed "
-			"page: %u, size=%zu\n", index, clen);
+	entry = zram_entry_alloc(zram, handle, clen);
+	if (!entry) {
+		if (clen == PAGE_SIZE)
+			__free_page((struct page *)handle);
+		else
+			zs_free(zram->mem_pool, handle);
 		ret = -ENOMEM;
 		goto out;
 	}
 
-memstore:
-	zram->table[index].offset = store_offset;
+	if (zram->use_dedup)
+		zram_dedup_insert(zram, entry, checksum);
+
+	/* Update stats */
+	zram_stat_add(zram, ZRAM_COMPR_SIZE, clen);
+	if (clen == PAGE_SIZE)
+		zram_stat_inc(zram, ZRAM_PAGES_EXPAND);
+	else if (clen <= PAGE_SIZE / 2)
+		zram_stat_inc(zram, ZRAM_GOOD_COMPRESS);
+
+found:
+	zram_stream_put(zram, zstrm);
+	zstrm = NULL;
+
+	/*
+	 * Publish the new object. The old one, if any, is freed here
+	 * rather than before compression so readers of this slot never
+	 * see it empty.
+	 */
+	zram_slot_lock(zram, index);
+	zram_free_page(zram, index);
+	zram->table[index].entry = entry;
+	zram_slot_unlock(zram, index);
+
+	zram_stat_inc(zram, ZRAM_PAGES_STORED);
+
+	ret = 0;
+
+out:
+	if (zstrm)
+		zram_stream_put(zram, zstrm);
+	if (is_partial_io(bvec))
+		kfree(uncmem);
+	if (ret)
+		zram_stat_inc(zram, ZRAM_FAILED_WRITES);
+	return ret;
+}
+
+/*
+ * A batch of pages being written back. Slots stay in RAM, flagged
+ * ZRAM_UNDER_WB, until their bio completes; a slot that is overwritten
+ * or freed meanwhile loses the flag and its block is dropped.
+ */
+struct zram_wb_batch {
+	struct page *pages[ZRAM_WB_BATCH];
+	u32 index[ZRAM_WB_BATCH];
+	unsigned long blk[ZRAM_WB_BATCH];
+	int count;
+	atomic_t pending;
+	struct completion done;
+	int error;
+};
+
+static void zram_wb_end_io(struct bio *bio, int err)
+{
+	struct zram_wb_batch *wb = bio->bi_private;
+
+	if (err || !test_bit(BIO_UPTODATE, &bio->bi_flags))
+		wb->error = err ? err : -EIO;
+	bio_put(bio);
+
+	if (atomic_dec_and_test(&wb->pending))
+		complete(&wb->done);
+}
+
+static struct bio *zram_wb_bio_alloc(struct zram *zram,
+				     struct zram_wb_batch *wb,
+				     unsigned long blk)
+{
+	struct bio *bio;
+
+	bio = bio_alloc(GFP_NOIO, ZRAM_WB_BATCH);
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_wb_end_io;
+	bio->bi_private = wb;
+	atomic_inc(&wb->pending);
+
+	return bio;
+}
+
+/*
+ * Write the batch out, one bio per run of consecutive blocks, then
+ * move each slot that is still waiting for it over to its block.
+ */
+static void zram_wb_submit(struct zram *zram, struct zram_wb_batch *wb)
+{
+	struct bio *bio = NULL;
+	struct zram_entry *entry;
+	int i;
+
+	atomic_set(&wb->pending, 1);
+	init_completion(&wb->done);
+	wb->error = 0;
+
+	for (i = 0; i < wb->count; i++) {
+		if (bio && (wb->blk[i] != wb->blk[i - 1] + 1 ||
+			    !bio_add_page(bio, wb->pages[i], PAGE_SIZE, 0))) {
+			submit_bio(WRITE, bio);
+			bio = NULL;
+		}
+
+		if (!bio) {
+			bio = zram_wb_bio_alloc(zram, wb, wb->blk[i]);
+			bio_add_page(bio, wb->pages[i], PAGE_SIZE, 0);
+		}
+	}
+
+	if (bio)
+		submit_bio(WRITE, bio);
+
+	if (!atomic_dec_and_test(&wb->pending))
+		wait_for_completion(&wb->done);
 
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-		zram->table[index].offset;
+	if (wb->error)
+		pr_err("Backing device write failed! err=%d\n", wb->error);
 
-#if 0
-	/* Back-reference needed for memory defragmentation */
-	if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
+	for (i = 0; i < wb->count; i++) {
+		u32 index = wb->index[i];
+
+		zram_slot_lock(zram, index);
+		if (wb->error || !zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+			zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+			zram_slot_unlock(zram, index);
+			zram_bd_free(zram, wb->blk[i]);
+			continue;
+		}
+
+		/* Keep the slot counted in pages_stored */
+		entry = zram->table[index].entry;
+		if (zram_entry_put(zram, entry))
+			zram_entry_free(zram, entry);
+		else
+			zram_stat_dec(zram, ZRAM_PAGES_DUP);
+
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		zram_clear_flag(zram, index, ZRAM_IDLE);
+		zram_set_flag(zram, index, ZRAM_WB);
+		zram->table[index].element = wb->blk[i];
+		zram_slot_unlock(zram, index);
+
+		zram_stat_inc(zram, ZRAM_PAGES_BD);
+		zram_stat_inc(zram, ZRAM_BD_WRITES);
 	}
-#endif
 
-	memcpy(cmem, src, clen);
+	wb->count = 0;
+}
 
-	kunmap_atomic(cmem, KM_USER1);
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-		kunmap_atomic(src, KM_USER0);
+/* Does slot @index hold a page in RAM that @mode writes back? */
+static bool zram_wb_wanted(struct zram *zram, size_t index, int mode)
+{
+	struct zram_entry *entry = zram->table[index].entry;
 
-	/* Update stats */
-	zram_stat64_add(zram, &zram->stats.compr_size, clen);
-	zram_stat_inc(&zram->stats.pages_stored);
-	if (clen <= PAGE_SIZE / 2)
-		zram_stat_inc(&zram->stats.good_compress);
+	if (zram_test_flag(zram, index, ZRAM_SAME) ||
+	    zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_UNDER_WB) || !entry)
+		return false;
 
-	return 0;
+	return ((mode & ZRAM_WB_HUGE) && entry->len == PAGE_SIZE) ||
+	       ((mode & ZRAM_WB_IDLE) &&
+		zram_test_flag(zram, index, ZRAM_IDLE));
+}
+
+/*
+ * Write pages selected by @mode (ZRAM_WB_HUGE, ZRAM_WB_IDLE) to the
+ * backing device, freeing their memory. Called with init_lock held on
+ * an initialized device.
+ */
+int zram_writeback(struct zram *zram, int mode)
+{
+	struct zram_wb_batch *wb;
+	struct zram_stream *zstrm;
+	size_t index, num_pages;
+	unsigned long blk;
+	bool wanted;
+	int i, ret = 0;
+
+	if (!zram->bdev)
+		return -ENODEV;
+
+	wb = kzalloc(sizeof(*wb), GFP_KERNEL);
+	if (!wb)
+		return -ENOMEM;
+
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		wb->pages[i] = alloc_page(GFP_KERNEL);
+		if (!wb->pages[i]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	num_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < num_pages; index++) {
+		if (wb->count == ZRAM_WB_BATCH)
+			zram_wb_submit(zram, wb);
+
+		/*
+		 * Most slots are skipped: check first, so that the scan
+		 * only competes with foreground I/O for a stream when it
+		 * has something to decompress.
+		 */
+		zram_slot_lock(zram, index);
+		wanted = zram_wb_wanted(zram, index, mode);
+		zram_slot_unlock(zram, index);
+		if (!wanted)
+			continue;
+
+		/* getting a stream may sleep: check again once it's ours */
+		zstrm = zram_stream_get(zram);
+		zram_slot_lock(zram, index);
+		if (!zram_wb_wanted(zram, index, mode))
+			goto next;
+
+		blk = zram_bd_alloc(zram);
+		if (blk >= zram->bd_nr_pages) {
+			ret = -ENOSPC;
+			zram_slot_unlock(zram, index);
+			zram_stream_put(zram, zstrm);
+			break;
+		}
+
+		if (zram_decompress_entry(zram, zstrm,
+				zram->table[index].entry,
+				page_address(wb->pages[wb->count]))) {
+			zram_bd_free(zram, blk);
+			goto next;
+		}
+
+		zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		wb->index[wb->count] = index;
+		wb->blk[wb->count] = blk;
+		wb->count++;
+next:
+		zram_slot_unlock(zram, index);
+		zram_stream_put(zram, zstrm);
+	}
+
+	if (wb->count)
+		zram_wb_submit(zram, wb);
 
 out:
-	if (ret)
-		zram_stat64_inc(zram, &zram->stats.failed_writes);
+	for (i = 0; i < ZRAM_WB_BATCH; i++)
+		if (wb->pages[i])
+			__free_page(wb->pages[i]);
+	kfree(wb);
+
 	return ret;
 }
 
+/*
+ * Flag every page in RAM idle. Any access clears the flag, so pages
+ * still flagged at the next writeback have not been touched since.
+ */
+void zram_mark_idle(struct zram *zram)
+{
+	size_t index;
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		zram_slot_lock(zram, index);
+		if (zram->table[index].entry &&
+		    !zram_test_flag(zram, index, ZRAM_SAME) &&
+		    !zram_test_flag(zram, index, ZRAM_WB))
+			zram_set_flag(zram, index, ZRAM_IDLE);
+		zram_slot_unlock(zram, index);
+	}
+}
+
+/*
+ * Every wb_age seconds, write back pages that stayed idle over the
+ * last period along with incompressible ones, then start a new one.
+ */
+static void zram_wb_work(struct work_struct *work)
+{
+	struct zram *zram = container_of(to_delayed_work(work),
+					 struct zram, wb_work);
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done || !zram->bdev || !zram->wb_age)
+		goto out;
+
+	zram_writeback(zram, ZRAM_WB_HUGE | ZRAM_WB_IDLE);
+	zram_mark_idle(zram);
+
+	queue_delayed_work(system_unbound_wq, &zram->wb_work,
+			   zram->wb_age * HZ);
+out:
+	mutex_unlock(&zram->init_lock);
+}
+
 static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 			int offset, struct bio *bio, int rw)
 {
 	int ret;
 
-	if (rw == READ) {
-		down_read(&zram->lock);
+	if (rw == READ)
 		ret = zram_bvec_read(zram, bvec, index, offset, bio);
-		up_read(&zram->lock);
-	} else {
-		down_write(&zram->lock);
+	else
 		ret = zram_bvec_write(zram, bvec, index, offset);
-		up_write(&zram->lock);
-	}
 
 	return ret;
 }
@@ -489,10 +1496,10 @@ static void __zram_make_request(struct zram *zram, struct bio *bio, int rw)
 
 	switch (rw) {
 	case READ:
-		zram_stat64_inc(zram, &zram->stats.num_reads);
+		zram_stat_inc(zram, ZRAM_NUM_READS);
 		break;
 	case WRITE:
-		zram_stat64_inc(zram, &zram->stats.num_writes);
+		zram_stat_inc(zram, ZRAM_NUM_WRITES);
 		break;
 	}
 
@@ -561,7 +1568,7 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 	struct zram *zram = queue->queuedata;
 
 	if (!valid_io_request(zram, bio)) {
-		zram_stat64_inc(zram, &zram->stats.invalid_io);
+		zram_stat_inc(zram, ZRAM_INVALID_IO);
 		bio_io_error(bio);
 		return 0;
 	}
@@ -579,42 +1586,36 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 void zram_reset_device(struct zram *zram)
 {
 	size_t index;
+	int cpu;
+
+	/* The writeback worker takes init_lock itself */
+	cancel_delayed_work_sync(&zram->wb_work);
 
 	mutex_lock(&zram->init_lock);
 	zram->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	/* Free idle compression streams */
+	zram_destroy_streams(zram);
 
 	/* Free all pages that are still in this zram device */
-	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
-			continue;
-
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
-	}
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++)
+		zram_free_page(zram, index);
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	vfree(zram->hash);
+	zram->hash = NULL;
+	zram->hash_size = 0;
+
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
-	memset(&zram->stats, 0, sizeof(zram->stats));
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(zram->stats, cpu)->count, 0,
+		       sizeof(zram->stats->count));
 
 	zram->disksize = 0;
 	mutex_unlock(&zram->init_lock);
@@ -634,16 +1635,14 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
+	/*
+	 * At least one compression stream is needed to make progress;
+	 * if fewer than max_comp_streams can be set up, run with what
+	 * we got.
+	 */
+	if (zram_balance_streams(zram) && !zram->avail_strm) {
+		pr_err("Error allocating %s compression stream\n",
+			zram->compressor);
 		ret = -ENOMEM;
 		goto fail;
 	}
@@ -658,12 +1657,29 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	if (zram->use_dedup) {
+		size_t i;
+
+		zram->hash_size = max_t(size_t, num_pages >> ZRAM_HASH_SHIFT, 1);
+		zram->hash = vmalloc(zram->hash_size * sizeof(*zram->hash));
+		if (!zram->hash) {
+			pr_err("Error allocating zram dedup hash\n");
+			ret = -ENOMEM;
+			goto fail;
+		}
+
+		for (i = 0; i < zram->hash_size; i++) {
+			spin_lock_init(&zram->hash[i].lock);
+			zram->hash[i].rb_root = RB_ROOT;
+		}
+	}
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool("zram", GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -671,6 +1687,9 @@ int zram_init_device(struct zram *zram)
 	}
 
 	zram->init_done = 1;
+	if (zram->bdev && zram->wb_age)
+		queue_delayed_work(system_unbound_wq, &zram->wb_work,
+				   zram->wb_age * HZ);
 	mutex_unlock(&zram->init_lock);
 
 	pr_debug("Initialization done!\n");
@@ -689,8 +1708,10 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	zram_slot_lock(zram, index);
 	zram_free_page(zram, index);
-	zram_stat64_inc(zram, &zram->stats.notify_free);
+	zram_slot_unlock(zram, index);
+	zram_stat_inc(zram, ZRAM_NOTIFY_FREE);
 }
 
 static const struct block_device_operations zram_devops = {
@@ -702,14 +1723,31 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	init_rwsem(&zram->lock);
 	mutex_init(&zram->init_lock);
-	spin_lock_init(&zram->stat64_lock);
+
+	zram->stats = alloc_percpu(struct zram_stats);
+	if (!zram->stats) {
+		pr_err("Error allocating stats for device %d\n", device_id);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	spin_lock_init(&zram->strm_lock);
+	INIT_LIST_HEAD(&zram->idle_strm);
+	init_waitqueue_head(&zram->strm_wait);
+	zram->avail_strm = 0;
+	zram->max_strm = min_t(int, num_online_cpus(), max_comp_streams);
+	zram->compressor = zram_backends[0];
+	zram->use_dedup = 1;
+
+	spin_lock_init(&zram->bd_lock);
+	INIT_DELAYED_WORK(&zram->wb_work, zram_wb_work);
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
 		pr_err("Error allocating disk queue for device %d\n",
 			device_id);
+		free_percpu(zram->stats);
 		ret = -ENOMEM;
 		goto out;
 	}
@@ -721,6 +1759,7 @@ static int create_device(struct zram *zram, int device_id)
 	zram->disk = alloc_disk(1);
 	if (!zram->disk) {
 		blk_cleanup_queue(zram->queue);
+		free_percpu(zram->stats);
 		pr_warning("Error allocating disk structure for device %d\n",
 			device_id);
 		ret = -ENOMEM;
@@ -816,8 +1855,10 @@ static int __init zram_init(void)
 	return 0;
 
 free_devices:
-	while (dev_id)
+	while (dev_id) {
 		destroy_device(&devices[--dev_id]);
+		free_percpu(devices[dev_id].stats);
+	}
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
@@ -836,6 +1877,8 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			zram_reset_device(zram);
+		zram_close_backing_dev(zram);
+		free_percpu(zram->stats);
 	}
 
 	unregister_blkdev(zram_major, "zram");
@@ -17,8 +17,14 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/rbtree.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/crypto.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
 
-#include "xvmalloc.h"
+#include "../zsmalloc/zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,18 +32,6 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
 /* Default zram disk size: 25% of total RAM */
@@ -51,9 +45,25 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE - sizeof(unsigned long)
+ * otherwise, zs_malloc() would always return failure.
+ */
+
+/*
+ * Upper bound on the number of concurrent compression streams
+ * per device (sysfs max_comp_streams). Each one costs a compressor
+ * work area plus a two page output buffer.
  */
+static const unsigned max_comp_streams = 16;
+
+/*
+ * One dedup hash bucket per 2^ZRAM_HASH_SHIFT disk pages. Each bucket
+ * is an rbtree of stored objects sorted by checksum.
+ */
+#define ZRAM_HASH_SHIFT		4
+
+/* Max pages read out and written to the backing device per batch */
+#define ZRAM_WB_BATCH		32
 
 /*-- End of configurable params */
 
@@ -68,47 +78,127 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /* Flags for zram pages (table[page_no].flags) */
 enum zram_pageflags {
-	/* Page is stored uncompressed */
-	ZRAM_UNCOMPRESSED,
+	/* Page is filled with a single repeated word (table.element) */
+	ZRAM_SAME,
+
+	/* Slot lock bit, see zram_slot_lock() */
+	ZRAM_ACCESS,
 
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO,
+	/* Page lives on the backing device, at block table.element */
+	ZRAM_WB,
+
+	/* Page being written to the backing device */
+	ZRAM_UNDER_WB,
+
+	/* Page not accessed since the last idle scan */
+	ZRAM_IDLE,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
+/*
+ * A stored object, shared by every slot holding the same data. 'handle'
+ * is a zsmalloc handle, or the struct page itself when the data did not
+ * compress (len == PAGE_SIZE). Entries are hashed by checksum into
+ * zram->hash while dedup is enabled; refcount is protected by the lock
+ * of that bucket.
+ */
+struct zram_entry {
+	struct rb_node rb_node;
+	u32 checksum;
+	unsigned long refcount;
+	unsigned long handle;
+	unsigned int len;
+};
+
+struct zram_hash {
+	spinlock_t lock;
+	struct rb_root rb_root;
+};
+
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
-	u8 flags;
+	union {
+		struct zram_entry *entry;
+		unsigned long element;	/* ZRAM_SAME fill word, ZRAM_WB block */
+	};
+	unsigned long flags;
 } __attribute__((aligned(4)));
 
+enum zram_stat_item {
+	ZRAM_COMPR_SIZE,	/* compressed size of pages stored */
+	ZRAM_NUM_READS,		/* failed + successful */
+	ZRAM_NUM_WRITES,	/* --do-- */
+	ZRAM_FAILED_READS,	/* should NEVER! happen */
+	ZRAM_FAILED_WRITES,	/* can happen when memory is too low */
+	ZRAM_INVALID_IO,	/* non-page-aligned I/O requests */
+	ZRAM_NOTIFY_FREE,	/* no. of swap slot free notifications */
+	ZRAM_BD_READS,		/* pages read from the backing device */
+	ZRAM_BD_WRITES,		/* pages written to the backing device */
+	ZRAM_PAGES_ZERO,	/* no. of zero filled pages */
+	ZRAM_PAGES_SAME,	/* no. of same element filled pages */
+	ZRAM_PAGES_DUP,		/* no. of slots sharing another's object */
+	ZRAM_PAGES_STORED,	/* no. of pages currently stored */
+	ZRAM_GOOD_COMPRESS,	/* no. of pages with compression ratio<=50% */
+	ZRAM_PAGES_EXPAND,	/* no. of incompressible pages */
+	ZRAM_PAGES_BD,		/* no. of pages on the backing device */
+	NR_ZRAM_STATS,
+};
+
+/*
+ * Statistics are kept per cpu, so that I/O running on different cpus
+ * never bounces a shared lock or counter between them. A cpu's share
+ * of a gauge such as pages_stored may go below zero (wrap); only the
+ * sum over all cpus, see zram_stat_read(), is meaningful.
+ */
 struct zram_stats {
-	u64 compr_size;		/* compressed size of pages stored */
-	u64 num_reads;		/* failed + successful */
-	u64 num_writes;		/* --do-- */
-	u64 failed_reads;	/* should NEVER! happen */
-	u64 failed_writes;	/* can happen when memory is too low */
-	u64 invalid_io;		/* non-page-aligned I/O requests */
-	u64 notify_free;	/* no. of swap slot free notifications */
-	u32 pages_zero;		/* no. of zero filled pages */
-	u32 pages_stored;	/* no. of pages currently stored */
-	u32 good_compress;	/* % of pages with compression ratio<=50% */
-	u32 pages_expand;	/* % of incompressible pages */
+	u64 count[NR_ZRAM_STATS];
+	struct u64_stats_sync syncp;
+};
+
+/*
+ * Compression stream: a compressor transform and output buffer for
+ * one compression or decompression in flight.
+ */
+struct zram_stream {
+	struct crypto_comp *tfm;
+	void *buffer;		/* compressed output, two pages */
+	struct list_head list;
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
 	struct table *table;
-	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct rw_semaphore lock; /* protect compression buffers and table
-				   * against concurrent read and writes */
+	struct zram_stats __percpu *stats;
+	/*
+	 * Pool of max_strm compression streams for the crypto compressor
+	 * named by 'compressor'. I/O takes an idle stream or sleeps on
+	 * strm_wait until one is released.
+	 */
+	const char *compressor;
+	spinlock_t strm_lock;
+	struct list_head idle_strm;
+	wait_queue_head_t strm_wait;
+	int avail_strm;
+	int max_strm;
+	/* Content dedup of stored objects, see zram_dedup_find() */
+	int use_dedup;
+	struct zram_hash *hash;
+	size_t hash_size;
+	/*
+	 * Optional backing device that idle and incompressible pages
+	 * are written back to. bd_bitmap tracks its used blocks, one
+	 * per page.
+	 */
+	struct block_device *bdev;
+	char *bd_path;
+	unsigned long *bd_bitmap;
+	unsigned long bd_nr_pages;
+	spinlock_t bd_lock;	/* protects bd_bitmap */
+	unsigned int wb_age;	/* idle writeback period, seconds */
+	struct delayed_work wb_work;
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -119,8 +209,6 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
-
-	struct zram_stats stats;
 };
 
 extern struct zram *devices;
@@ -131,5 +219,19 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+extern u64 zram_stat_read(struct zram *zram, enum zram_stat_item item);
+extern int zram_set_max_streams(struct zram *zram, int num_strm);
+extern int zram_set_compressor(struct zram *zram, const char *name);
+extern ssize_t zram_show_compressors(struct zram *zram, char *buf);
+extern int zram_set_dedup(struct zram *zram, int enable);
+
+/* zram_writeback() modes */
+#define ZRAM_WB_HUGE	(1 << 0)	/* pages that did not compress */
+#define ZRAM_WB_IDLE	(1 << 1)	/* pages idle since the last scan */
+
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern void zram_set_writeback_age(struct zram *zram, unsigned int age);
+extern int zram_writeback(struct zram *zram, int mode);
+extern void zram_mark_idle(struct zram *zram);
 
 #endif
@@ -0,0 +1,825 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * zsmalloc stores objects of up to PAGE_SIZE bytes in groups of
+ * 0-order pages ("zspages") owned by a size class, packing them back
+ * to back so that an object may straddle a page boundary. Unlike a
+ * freelist allocator working inside single pages, this keeps the
+ * per-object overhead at one word and the per-page waste at a few
+ * percent, regardless of how compressed sizes are distributed.
+ *
+ * Users get an opaque handle and must map it (zs_map_object) to
+ * access the object. Because handles are indirect, objects can be
+ * migrated between zspages of a class to free sparsely used zspages
+ * (zs_compact), which the pool also does from a shrinker.
+ *
+ * Locking: each size class has a spinlock protecting its lists and
+ * zspages. A handle's pin bit is held while the object is mapped or
+ * being freed; it nests outside the class lock. Compaction holds the
+ * class lock and only trylocks pins, skipping objects in use.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/bit_spinlock.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+/*
+ * Per-cpu buffer used to map objects that span two pages: the object
+ * is copied in on map and back out on unmap.
+ */
+struct mapping_area {
+	char *vm_buf;		/* copy of an object spanning pages */
+	char *vm_addr;		/* kmap of an object within one page */
+	enum zs_mapmode vm_mm;
+};
+
+static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
+
+static struct kmem_cache *zs_handle_cachep;
+
+static int get_size_class_index(int size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Pick the number of pages per zspage (1..ZS_MAX_PAGES_PER_ZSPAGE)
+ * that wastes the smallest fraction of memory for this class size.
+ */
+static int get_pages_per_zspage(int class_size)
+{
+	int i, max_usedpc = 0;
+	int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size;
+		int waste, usedpc;
+
+		zspage_size = i * PAGE_SIZE;
+		waste = zspage_size % class_size;
+		usedpc = (zspage_size - waste) * 100 / zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+/* Handle encoding */
+
+static unsigned long location_to_obj(struct zspage *zspage,
+				unsigned long obj_idx)
+{
+	unsigned long obj;
+
+	obj = page_to_pfn(zspage->pages[0]) << ZS_OBJ_INDEX_BITS;
+	obj |= obj_idx & ZS_OBJ_INDEX_MASK;
+
+	return obj;
+}
+
+static struct zspage *obj_to_zspage(unsigned long obj)
+{
+	struct page *page = pfn_to_page(obj >> ZS_OBJ_INDEX_BITS);
+
+	return (struct zspage *)page_private(page);
+}
+
+static unsigned long obj_to_index(unsigned long obj)
+{
+	return obj & ZS_OBJ_INDEX_MASK;
+}
+
+static unsigned long handle_to_obj(unsigned long handle)
+{
+	return *(unsigned long *)handle >> 1;
+}
+
+/* Must be called with the pin held (or before the handle is public) */
+static void record_obj(unsigned long handle, unsigned long obj)
+{
+	unsigned long *p = (unsigned long *)handle;
+
+	*p = (obj << 1) | (*p & BIT(HANDLE_PIN_BIT));
+}
+
+static void pin_tag(unsigned long handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int trypin_tag(unsigned long handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static void unpin_tag(unsigned long handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+/* Object layout */
+
+static void obj_location(struct size_class *class, struct zspage *zspage,
+			unsigned long obj_idx, struct page **page,
+			unsigned long *offset)
+{
+	unsigned long off = obj_idx * class->size;
+
+	*page = zspage->pages[off >> PAGE_SHIFT];
+	*offset = off & ~PAGE_MASK;
+}
+
+static unsigned long read_obj_header(struct size_class *class,
+				struct zspage *zspage, unsigned long obj_idx)
+{
+	struct page *page;
+	unsigned long offset, val;
+	void *addr;
+
+	obj_location(class, zspage, obj_idx, &page, &offset);
+	addr = kmap_atomic(page, KM_USER0);
+	val = *(unsigned long *)(addr + offset);
+	kunmap_atomic(addr, KM_USER0);
+
+	return val;
+}
+
+static void write_obj_header(struct size_class *class,
+			struct zspage *zspage, unsigned long obj_idx,
+			unsigned long val)
+{
+	struct page *page;
+	unsigned long offset;
+	void *addr;
+
+	obj_location(class, zspage, obj_idx, &page, &offset);
+	addr = kmap_atomic(page, KM_USER0);
+	*(unsigned long *)(addr + offset) = val;
+	kunmap_atomic(addr, KM_USER0);
+}
+
+/*
+ * Free objects are chained through their headers. A link holds the
+ * next free index plus one (zero ends the list), shifted clear of
+ * OBJ_ALLOCATED_TAG; zspage->freeobj holds the head the same way.
+ */
+static unsigned long obj_link(unsigned long next_idx_plus_one)
+{
+	return next_idx_plus_one << OBJ_TAG_BITS;
+}
+
+/* Take a free object from a zspage and tag it with its handle */
+static unsigned long obj_malloc(struct size_class *class,
+				struct zspage *zspage, unsigned long handle)
+{
+	unsigned long obj_idx = zspage->freeobj - 1;
+
+	zspage->freeobj = read_obj_header(class, zspage, obj_idx) >>
+				OBJ_TAG_BITS;
+	write_obj_header(class, zspage, obj_idx, handle | OBJ_ALLOCATED_TAG);
+	zspage->inuse++;
+	class->objs_used++;
+
+	return location_to_obj(zspage, obj_idx);
+}
+
+static void obj_free(struct size_class *class, struct zspage *zspage,
+			unsigned long obj_idx)
+{
+	write_obj_header(class, zspage, obj_idx, obj_link(zspage->freeobj));
+	zspage->freeobj = obj_idx + 1;
+	zspage->inuse--;
+	class->objs_used--;
+}
+
+/* Copy a whole object between zspages of the same class */
+static void zs_object_copy(struct size_class *class,
+			struct zspage *d_zspage, unsigned long d_idx,
+			struct zspage *s_zspage, unsigned long s_idx)
+{
+	unsigned long s_pos = s_idx * class->size;
+	unsigned long d_pos = d_idx * class->size;
+	unsigned long s_off, d_off;
+	int len, size = class->size;
+	void *s_addr, *d_addr;
+
+	while (size) {
+		s_off = s_pos & ~PAGE_MASK;
+		d_off = d_pos & ~PAGE_MASK;
+		len = min_t(int, size, PAGE_SIZE - s_off);
+		len = min_t(int, len, PAGE_SIZE - d_off);
+
+		s_addr = kmap_atomic(s_zspage->pages[s_pos >> PAGE_SHIFT],
+					KM_USER0);
+		d_addr = kmap_atomic(d_zspage->pages[d_pos >> PAGE_SHIFT],
+					KM_USER1);
+		memcpy(d_addr + d_off, s_addr + s_off, len);
+		kunmap_atomic(d_addr, KM_USER1);
+		kunmap_atomic(s_addr, KM_USER0);
+
+		size -= len;
+		s_pos += len;
+		d_pos += len;
+	}
+}
+
+/* zspage management */
+
+static enum fullness_group get_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	if (zspage->inuse == 0)
+		return ZS_EMPTY;
+	if (zspage->inuse == class->objs_per_zspage)
+		return ZS_FULL;
+	if (zspage->inuse <= 3 * class->objs_per_zspage /
+			ZS_FULLNESS_THRESHOLD_FRAC)
+		return ZS_ALMOST_EMPTY;
+
+	return ZS_ALMOST_FULL;
+}
+
+static void insert_zspage(struct size_class *class, struct zspage *zspage,
+			enum fullness_group fullness)
+{
+	zspage->fullness = fullness;
+	if (fullness == ZS_EMPTY)
+		return;
+
+	list_add(&zspage->list, &class->fullness_list[fullness]);
+}
+
+static void remove_zspage(struct size_class *class, struct zspage *zspage)
+{
+	if (zspage->fullness == ZS_EMPTY)
+		return;
+
+	list_del_init(&zspage->list);
+	zspage->fullness = ZS_EMPTY;
+}
+
+/* Move a zspage to the list matching its usage, returning the group */
+static enum fullness_group fix_fullness_group(struct size_class *class,
+					struct zspage *zspage)
+{
+	enum fullness_group newfg;
+
+	newfg = get_fullness_group(class, zspage);
+	if (newfg == zspage->fullness)
+		return newfg;
+
+	remove_zspage(class, zspage);
+	insert_zspage(class, zspage, newfg);
+
+	return newfg;
+}
+
+static void free_zspage(struct size_class *class, struct zspage *zspage)
+{
+	int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		set_page_private(zspage->pages[i], 0);
+		__free_page(zspage->pages[i]);
+	}
+	kfree(zspage);
+}
+
+static struct zspage *alloc_zspage(struct size_class *class, gfp_t flags)
+{
+	int i;
+	unsigned long obj_idx;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage), flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class = class;
+	zspage->fullness = ZS_EMPTY;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		struct page *page;
+
+		page = alloc_page(flags);
+		if (!page) {
+			while (--i >= 0)
+				__free_page(zspage->pages[i]);
+			kfree(zspage);
+			return NULL;
+		}
+		set_page_private(page, (unsigned long)zspage);
+		zspage->pages[i] = page;
+	}
+
+	/* Chain all objects into the free list, in address order */
+	for (obj_idx = 0; obj_idx < class->objs_per_zspage; obj_idx++) {
+		unsigned long next = obj_idx + 2;
+
+		if (next > class->objs_per_zspage)
+			next = 0;
+		write_obj_header(class, zspage, obj_idx, obj_link(next));
+	}
+	zspage->freeobj = 1;
+
+	return zspage;
+}
+
+static struct zspage *find_get_zspage(struct size_class *class)
+{
+	int i;
+
+	for (i = 0; i < ZS_FULL; i++) {
+		if (!list_empty(&class->fullness_list[i]))
+			return list_first_entry(&class->fullness_list[i],
+					struct zspage, list);
+	}
+
+	return NULL;
+}
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ *
+ * On success, handle to the allocated object is returned,
+ * otherwise 0.
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE will fail.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	unsigned long handle, obj;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	size += ZS_HANDLE_SIZE;
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	handle = (unsigned long)kmem_cache_alloc(zs_handle_cachep,
+					pool->flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+	*(unsigned long *)handle = 0;
+
+	class = &pool->size_class[get_size_class_index(size)];
+
+	spin_lock(&class->lock);
+	zspage = find_get_zspage(class);
+	if (!zspage) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(class, pool->flags);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(zs_handle_cachep, (void *)handle);
+			return 0;
+		}
+
+		atomic_long_add(class->pages_per_zspage,
+				&pool->pages_allocated);
+		spin_lock(&class->lock);
+		class->objs_allocated += class->objs_per_zspage;
+	}
+
+	obj = obj_malloc(class, zspage, handle);
+	record_obj(handle, obj);
+	fix_fullness_group(class, zspage);
+	spin_unlock(&class->lock);
+
+	return handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	unsigned long obj;
+	struct size_class *class;
+	struct zspage *zspage;
+	enum fullness_group fullness;
+
+	if (unlikely(!handle))
+		return;
+
+	pin_tag(handle);
+	obj = handle_to_obj(handle);
+	zspage = obj_to_zspage(obj);
+	class = zspage->class;
+
+	spin_lock(&class->lock);
+	obj_free(class, zspage, obj_to_index(obj));
+	fullness = fix_fullness_group(class, zspage);
+	if (fullness == ZS_EMPTY)
+		class->objs_allocated -= class->objs_per_zspage;
+	spin_unlock(&class->lock);
+	unpin_tag(handle);
+
+	if (fullness == ZS_EMPTY) {
+		atomic_long_sub(class->pages_per_zspage,
+				&pool->pages_allocated);
+		free_zspage(class, zspage);
+	}
+
+	kmem_cache_free(zs_handle_cachep, (void *)handle);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: access mode, see enum zs_mapmode
+ *
+ * Before using an object allocated from zs_malloc, it must be mapped
+ * using this function. When done with the object, it must be unmapped
+ * using zs_unmap_object.
+ *
+ * Only one object can be mapped per cpu at a time. The mapping runs
+ * with preemption disabled and must not sleep.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	unsigned long obj, offset;
+	struct size_class *class;
+	struct zspage *zspage;
+	struct mapping_area *area;
+	struct page *page;
+	int len;
+
+	BUG_ON(!handle);
+
+	pin_tag(handle);
+	obj = handle_to_obj(handle);
+	zspage = obj_to_zspage(obj);
+	class = zspage->class;
+	obj_location(class, zspage, obj_to_index(obj), &page, &offset);
+
+	area = &get_cpu_var(zs_map_area);
+	area->vm_mm = mm;
+	if (offset + class->size <= PAGE_SIZE) {
+		area->vm_addr = kmap_atomic(page, KM_USER0);
+		return area->vm_addr + offset + ZS_HANDLE_SIZE;
+	}
+
+	/* The object spans two pages: work on a copy */
+	area->vm_addr = NULL;
+	if (mm != ZS_MM_WO) {
+		char *addr;
+		unsigned long off = obj_to_index(obj) * class->size;
+
+		len = PAGE_SIZE - offset;
+		addr = kmap_atomic(page, KM_USER0);
+		memcpy(area->vm_buf, addr + offset, len);
+		kunmap_atomic(addr, KM_USER0);
+
+		page = zspage->pages[(off >> PAGE_SHIFT) + 1];
+		addr = kmap_atomic(page, KM_USER0);
+		memcpy(area->vm_buf + len, addr, class->size - len);
+		kunmap_atomic(addr, KM_USER0);
+	}
+
+	return area->vm_buf + ZS_HANDLE_SIZE;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	unsigned long obj, offset;
+	struct size_class *class;
+	struct zspage *zspage;
+	struct mapping_area *area;
+	struct page *page;
+	int len;
+
+	BUG_ON(!handle);
+
+	obj = handle_to_obj(handle);
+	zspage = obj_to_zspage(obj);
+	class = zspage->class;
+
+	area = &__get_cpu_var(zs_map_area);
+	if (area->vm_addr) {
+		kunmap_atomic(area->vm_addr, KM_USER0);
+		area->vm_addr = NULL;
+	} else if (area->vm_mm != ZS_MM_RO) {
+		char *addr;
+		unsigned long off = obj_to_index(obj) * class->size;
+
+		obj_location(class, zspage, obj_to_index(obj), &page, &offset);
+
+		/* The header is not ours to change: copy the payload only */
+		len = PAGE_SIZE - offset;
+		addr = kmap_atomic(page, KM_USER0);
+		memcpy(addr + offset + ZS_HANDLE_SIZE,
+			area->vm_buf + ZS_HANDLE_SIZE, len - ZS_HANDLE_SIZE);
+		kunmap_atomic(addr, KM_USER0);
+
+		page = zspage->pages[(off >> PAGE_SHIFT) + 1];
+		addr = kmap_atomic(page, KM_USER0);
+		memcpy(addr, area->vm_buf + len, class->size - len);
+		kunmap_atomic(addr, KM_USER0);
+	}
+	put_cpu_var(zs_map_area);
+
+	unpin_tag(handle);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+/* Compaction */
+
+/*
+ * Move as many objects as possible from src to dst. Objects that are
+ * currently pinned (mapped or being freed) are skipped. Returns the
+ * number of objects moved. Called with the class lock held.
+ */
+static int migrate_zspage(struct size_class *class, struct zspage *src,
+			struct zspage *dst)
+{
+	unsigned long s_idx, d_obj, header, handle;
+	int moved = 0;
+
+	for (s_idx = 0; s_idx < class->objs_per_zspage; s_idx++) {
+		if (!src->inuse || !dst->freeobj)
+			break;
+
+		header = read_obj_header(class, src, s_idx);
+		if (!(header & OBJ_ALLOCATED_TAG))
+			continue;
+
+		handle = header & ~OBJ_ALLOCATED_TAG;
+		if (!trypin_tag(handle))
+			continue;
+
+		d_obj = obj_malloc(class, dst, handle);
+		zs_object_copy(class, dst, obj_to_index(d_obj), src, s_idx);
+		obj_free(class, src, s_idx);
+		record_obj(handle, d_obj);
+		unpin_tag(handle);
+		moved++;
+	}
+
+	return moved;
+}
+
+static unsigned long compact_class(struct zs_pool *pool,
+				struct size_class *class)
+{
+	struct zspage *src, *dst;
+	struct list_head *almost_empty;
+	unsigned long freed = 0;
+
+	almost_empty = &class->fullness_list[ZS_ALMOST_EMPTY];
+
+	spin_lock(&class->lock);
+	while (!list_empty(almost_empty)) {
+		/* Drain the least recently filled sparse zspage ... */
+		src = list_entry(almost_empty->prev, struct zspage, list);
+
+		/* ... into the fullest zspage that still has room */
+		if (!list_empty(&class->fullness_list[ZS_ALMOST_FULL]))
+			dst = list_first_entry(
+				&class->fullness_list[ZS_ALMOST_FULL],
+				struct zspage, list);
+		else
+			dst = list_first_entry(almost_empty,
+				struct zspage, list);
+		if (dst == src)
+			break;
+
+		if (!migrate_zspage(class, src, dst))
+			break;
+
+		fix_fullness_group(class, dst);
+		if (fix_fullness_group(class, src) == ZS_EMPTY) {
+			class->objs_allocated -= class->objs_per_zspage;
+			atomic_long_sub(class->pages_per_zspage,
+					&pool->pages_allocated);
+			free_zspage(class, src);
+			freed += class->pages_per_zspage;
+		}
+
+		spin_unlock(&class->lock);
+		cond_resched();
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/**
+ * zs_compact - free sparsely used zspages by migrating their objects
+ * @pool: pool to compact
+ *
+ * Returns the number of pages freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++)
+		freed += compact_class(pool, &pool->size_class[i]);
+
+	atomic_long_add(freed, &pool->pages_compacted);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+/* Pages compaction could free, judging from unused objects per class */
+static unsigned long zs_can_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long pages = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		unsigned long unused;
+
+		unused = class->objs_allocated - class->objs_used;
+		pages += unused / class->objs_per_zspage *
+				class->pages_per_zspage;
+	}
+
+	return pages;
+}
+
+static int zs_shrinker_scan(struct shrinker *shrinker,
+			struct shrink_control *sc)
+{
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+					shrinker);
+
+	if (sc->nr_to_scan)
+		zs_compact(pool);
+
+	return min_t(unsigned long, zs_can_compact(pool), INT_MAX);
+}
+
+/* Pool management */
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: name of the pool to be created
+ * @flags: allocation flags used when growing pool
+ *
+ * This function must be called before anything when using
+ * the zsmalloc allocator.
+ *
+ * On success, a pointer to the newly created pool is returned,
+ * otherwise NULL.
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	int i;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		int j;
+		struct size_class *class = &pool->size_class[i];
+
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->index = i;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+					PAGE_SIZE / class->size;
+		spin_lock_init(&class->lock);
+		for (j = 0; j < _ZS_NR_FULLNESS_GROUPS; j++)
+			INIT_LIST_HEAD(&class->fullness_list[j]);
+	}
+
+	pool->name = name;
+	pool->flags = flags;
+	atomic_long_set(&pool->pages_allocated, 0);
+	atomic_long_set(&pool->pages_compacted, 0);
+
+	pool->shrinker.shrink = zs_shrinker_scan;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+
+	return pool;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i;
+
+	unregister_shrinker(&pool->shrinker);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		int fg;
+		struct size_class *class = &pool->size_class[i];
+
+		for (fg = 0; fg < _ZS_NR_FULLNESS_GROUPS; fg++) {
+			struct zspage *zspage, *tmp;
+
+			list_for_each_entry_safe(zspage, tmp,
+					&class->fullness_list[fg], list) {
+				pr_info("Freeing non-empty class %d (size %d) "
+					"zspage in pool %s\n", class->index,
+					class->size, pool->name);
+				list_del(&zspage->list);
+				free_zspage(class, zspage);
+			}
+		}
+	}
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+u64 zs_get_pages_compacted(struct zs_pool *pool)
+{
+	return atomic_long_read(&pool->pages_compacted);
+}
+EXPORT_SYMBOL_GPL(zs_get_pages_compacted);
+
+static void zs_free_map_areas(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		kfree(area->vm_buf);
+		area->vm_buf = NULL;
+	}
+}
+
+static int __init zs_init(void)
+{
+	int cpu;
+
+	BUILD_BUG_ON(ZS_MAX_OBJS_PER_ZSPAGE > ZS_OBJ_INDEX_MASK);
+
+	zs_handle_cachep = kmem_cache_create("zs_handle", ZS_HANDLE_SIZE,
+					0, 0, NULL);
+	if (!zs_handle_cachep)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = &per_cpu(zs_map_area, cpu);
+
+		area->vm_buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->vm_buf) {
+			zs_free_map_areas();
+			kmem_cache_destroy(zs_handle_cachep);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+static void __exit zs_exit(void)
+{
+	zs_free_map_areas();
+	kmem_cache_destroy(zs_handle_cachep);
+}
+
+module_init(zs_init);
+module_exit(zs_exit);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("Memory allocator for compressed pages");
@@ -0,0 +1,116 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/shrinker.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+/*
+ * Objects are grouped in size classes. A class allocates "zspages":
+ * sets of up to ZS_MAX_PAGES_PER_ZSPAGE 0-order (possibly highmem)
+ * pages, chosen so that the class size wastes as little of them as
+ * possible. Objects are laid out back to back across the pages, so
+ * an object may straddle two of them.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/*
+ * Size classes are ZS_SIZE_CLASS_DELTA apart. Since every class size
+ * is then a multiple of 16, an object always starts at least 16 bytes
+ * before the end of a page, so its header never straddles pages.
+ */
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / \
+					ZS_SIZE_CLASS_DELTA + 1)
+
+/*
+ * Every object starts with a header word. For an allocated object it
+ * holds the handle (with OBJ_ALLOCATED_TAG set), which is how
+ * compaction finds and updates the owner of an object it moves. For a
+ * free object it links to the next free object in the zspage.
+ */
+#define ZS_HANDLE_SIZE		(sizeof(unsigned long))
+#define OBJ_ALLOCATED_TAG	1UL
+#define OBJ_TAG_BITS		1
+
+/*
+ * A handle points to a word holding the object location: the pfn of
+ * the zspage's first page and the object index within the zspage.
+ * Bit 0 is a pin lock held while the object is mapped or freed, so
+ * compaction never moves an object under a user.
+ */
+#define HANDLE_PIN_BIT		0
+#define ZS_OBJ_INDEX_BITS	10
+#define ZS_OBJ_INDEX_MASK	((1UL << ZS_OBJ_INDEX_BITS) - 1)
+#define ZS_MAX_OBJS_PER_ZSPAGE	(ZS_MAX_PAGES_PER_ZSPAGE * PAGE_SIZE / \
+					ZS_MIN_ALLOC_SIZE)
+
+/*
+ * A zspage is almost empty while at most 3/4 of its objects are in
+ * use; these are the sources for compaction and the last choice for
+ * allocation.
+ */
+#define ZS_FULLNESS_THRESHOLD_FRAC	4
+
+enum fullness_group {
+	ZS_ALMOST_FULL,
+	ZS_ALMOST_EMPTY,
+	ZS_FULL,
+	_ZS_NR_FULLNESS_GROUPS,
+
+	ZS_EMPTY,
+};
+
+struct size_class;
+
+struct zspage {
+	struct list_head list;		/* in class fullness list */
+	struct size_class *class;
+	enum fullness_group fullness;
+	unsigned int inuse;		/* objects allocated */
+	unsigned long freeobj;		/* free list head, see obj_link */
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+};
+
+struct size_class {
+	/* protects everything below and the zspages of this class */
+	spinlock_t lock;
+	struct list_head fullness_list[_ZS_NR_FULLNESS_GROUPS];
+	int size;			/* object size, including header */
+	int index;
+	int pages_per_zspage;
+	int objs_per_zspage;
+
+	/* stats */
+	unsigned long objs_allocated;	/* capacity of all zspages */
+	unsigned long objs_used;
+};
+
+struct zs_pool {
+	const char *name;
+	gfp_t flags;			/* for zspage pages */
+
+	struct size_class size_class[ZS_SIZE_CLASSES];
+
+	atomic_long_t pages_allocated;
+	atomic_long_t pages_compacted;
+
+	/* compacts the pool under memory pressure */
+	struct shrinker shrinker;
+};
+
+#endif
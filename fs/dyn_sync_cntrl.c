@@ -23,9 +23,14 @@
 #include <linux/notifier.h>
 #include <linux/reboot.h>
 #include <linux/writeback.h>
+#include <linux/fs.h>
+#include <linux/hash.h>
+#include <linux/delay.h>
+#include <linux/hrtimer.h>
+#include <linux/wait.h>
 
 #define DYN_FSYNC_VERSION_MAJOR 1
-#define DYN_FSYNC_VERSION_MINOR 2
+#define DYN_FSYNC_VERSION_MINOR 3
 
 /*
  * fsync_mutex protects dyn_fsync_active during early suspend / late resume
@@ -36,6 +41,146 @@ static DEFINE_MUTEX(fsync_mutex);
 bool early_suspend_active __read_mostly = false;
 bool dyn_fsync_active __read_mostly = true;
 
+/*
+ * Batch mode: instead of dropping fsync while the screen is on, fsyncs
+ * on the same filesystem that come in within dyn_fsync_window_ms of
+ * each other are grouped.  The first one waits out the window and does
+ * the commit, the others wait for that commit and then run their own
+ * fsync, which finds its transaction committed already on journaling
+ * filesystems.
+ */
+bool dyn_fsync_batch __read_mostly = false;
+static unsigned int dyn_fsync_window_ms __read_mostly = 10;
+
+#define DYN_FSYNC_HASH_BITS	4
+#define DYN_FSYNC_HIST_BUCKETS	14	/* <64us .. <256ms, and above */
+
+struct dyn_fsync_group {
+	spinlock_t		lock;
+	wait_queue_head_t	wait;
+	struct super_block	*sb;
+	bool			open;	/* leader still collecting */
+	unsigned long		seq;	/* batch being collected */
+	unsigned long		done;	/* last batch committed */
+	unsigned int		joined;	/* followers in this batch */
+	ktime_t			last;	/* last fsync on sb */
+};
+
+static struct dyn_fsync_group dyn_fsync_groups[1 << DYN_FSYNC_HASH_BITS];
+
+static DEFINE_SPINLOCK(dyn_fsync_stats_lock);
+static struct {
+	unsigned long	fsyncs;
+	unsigned long	commits;
+	unsigned long	coalesced;
+	u64		saved_ns;
+	unsigned long	fsync_hist[DYN_FSYNC_HIST_BUCKETS];
+	unsigned long	commit_hist[DYN_FSYNC_HIST_BUCKETS];
+} dyn_fsync_stats;
+
+static int dyn_fsync_hist_bucket(s64 ns)
+{
+	int i = 0;
+
+	for (ns >>= 16; ns && i < DYN_FSYNC_HIST_BUCKETS - 1; ns >>= 1)
+		i++;
+	return i;
+}
+
+static void dyn_fsync_account(s64 fsync_ns, s64 commit_ns,
+			      unsigned int coalesced)
+{
+	spin_lock(&dyn_fsync_stats_lock);
+	dyn_fsync_stats.fsyncs++;
+	dyn_fsync_stats.fsync_hist[dyn_fsync_hist_bucket(fsync_ns)]++;
+	if (commit_ns >= 0) {
+		dyn_fsync_stats.commits++;
+		dyn_fsync_stats.commit_hist[dyn_fsync_hist_bucket(commit_ns)]++;
+		/* each follower would have paid for a commit of its own */
+		dyn_fsync_stats.coalesced += coalesced;
+		dyn_fsync_stats.saved_ns += (u64)commit_ns * coalesced;
+	}
+	spin_unlock(&dyn_fsync_stats_lock);
+}
+
+/*
+ * dyn_fsync_batched - fsync @file as part of a group commit
+ *
+ * Called from vfs_fsync_range() in batch mode, with the same arguments.
+ */
+int dyn_fsync_batched(struct file *file, loff_t start, loff_t end,
+		      int datasync)
+{
+	struct address_space *mapping = file->f_mapping;
+	struct super_block *sb = mapping->host->i_sb;
+	struct dyn_fsync_group *g;
+	unsigned long window_us = dyn_fsync_window_ms * USEC_PER_MSEC;
+	unsigned long seq = 0;
+	unsigned int joined;
+	bool leader = false, follower = false, wait = false;
+	ktime_t t0, t1;
+	s64 commit_ns = -1;
+	int ret;
+
+	g = &dyn_fsync_groups[hash_ptr(sb, DYN_FSYNC_HASH_BITS)];
+	t0 = ktime_get();
+
+	/* get our data on its way while the batch fills up */
+	filemap_fdatawrite_range(mapping, start, end);
+
+	spin_lock(&g->lock);
+	if (g->open) {
+		/* a different filesystem in the same slot isn't batched */
+		if (g->sb == sb) {
+			follower = true;
+			seq = g->seq;
+			g->joined++;
+		}
+	} else {
+		leader = true;
+		seq = ++g->seq;
+		g->joined = 0;
+		g->open = true;
+		/* a lone fsync does not wait for company */
+		wait = g->sb == sb &&
+			ktime_us_delta(t0, g->last) < window_us;
+		g->sb = sb;
+	}
+	if (g->sb == sb)
+		g->last = t0;
+	spin_unlock(&g->lock);
+
+	if (follower) {
+		wait_event(g->wait, (long)(ACCESS_ONCE(g->done) - seq) >= 0);
+		ret = file->f_op->fsync(file, start, end, datasync);
+		dyn_fsync_account(ktime_to_ns(ktime_sub(ktime_get(), t0)),
+				  -1, 0);
+		return ret;
+	}
+
+	if (leader && wait)
+		usleep_range(window_us, window_us + window_us / 4);
+
+	spin_lock(&g->lock);
+	if (leader)
+		g->open = false;
+	joined = leader ? g->joined : 0;
+	spin_unlock(&g->lock);
+
+	t1 = ktime_get();
+	ret = file->f_op->fsync(file, start, end, datasync);
+	if (leader) {
+		commit_ns = ktime_to_ns(ktime_sub(ktime_get(), t1));
+		spin_lock(&g->lock);
+		g->done = seq;
+		spin_unlock(&g->lock);
+		wake_up_all(&g->wait);
+	}
+	dyn_fsync_account(ktime_to_ns(ktime_sub(ktime_get(), t0)), commit_ns,
+			  joined);
+	return ret;
+}
+
 static ssize_t dyn_fsync_active_show(struct kobject *kobj,
 		struct kobj_attribute *attr, char *buf)
 {
@@ -64,6 +209,70 @@ static ssize_t dyn_fsync_active_store(struct kobject *kobj,
 	return count;
 }
 
+static ssize_t dyn_fsync_batch_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", (dyn_fsync_batch ? 1 : 0));
+}
+
+static ssize_t dyn_fsync_batch_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int data;
+
+	if (sscanf(buf, "%u\n", &data) != 1 || data > 1)
+		return -EINVAL;
+
+	dyn_fsync_batch = data;
+	pr_info("%s: fsync batching %s\n", __FUNCTION__,
+		data ? "enabled" : "disabled");
+	return count;
+}
+
+static ssize_t dyn_fsync_window_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", dyn_fsync_window_ms);
+}
+
+static ssize_t dyn_fsync_window_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int data;
+
+	if (sscanf(buf, "%u\n", &data) != 1 || data < 1 || data > 1000)
+		return -EINVAL;
+
+	dyn_fsync_window_ms = data;
+	return count;
+}
+
+static ssize_t dyn_fsync_stats_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	ssize_t len;
+	int i;
+
+	spin_lock(&dyn_fsync_stats_lock);
+	len = sprintf(buf, "fsyncs: %lu\ncommits: %lu\ncoalesced: %lu\n"
+		      "saved_ms: %llu\n",
+		      dyn_fsync_stats.fsyncs, dyn_fsync_stats.commits,
+		      dyn_fsync_stats.coalesced,
+		      div_u64(dyn_fsync_stats.saved_ns, NSEC_PER_MSEC));
+	len += sprintf(buf + len, "%10s %10s %10s\n",
+		       "latency_us", "fsync", "commit");
+	for (i = 0; i < DYN_FSYNC_HIST_BUCKETS - 1; i++)
+		len += sprintf(buf + len, " <%8u %10lu %10lu\n", 64U << i,
+			       dyn_fsync_stats.fsync_hist[i],
+			       dyn_fsync_stats.commit_hist[i]);
+	len += sprintf(buf + len, ">=%8u %10lu %10lu\n", 64U << (i - 1),
+		       dyn_fsync_stats.fsync_hist[i],
+		       dyn_fsync_stats.commit_hist[i]);
+	spin_unlock(&dyn_fsync_stats_lock);
+
+	return len;
+}
+
 static ssize_t dyn_fsync_version_show(struct kobject *kobj,
 		struct kobj_attribute *attr, char *buf)
 {
@@ -83,6 +292,19 @@ static struct kobj_attribute dyn_fsync_active_attribute =
 		dyn_fsync_active_show,
 		dyn_fsync_active_store);
 
+static struct kobj_attribute dyn_fsync_batch_attribute =
+	__ATTR(Dyn_fsync_batch, 0644,
+		dyn_fsync_batch_show,
+		dyn_fsync_batch_store);
+
+static struct kobj_attribute dyn_fsync_window_attribute =
+	__ATTR(Dyn_fsync_batch_window_ms, 0644,
+		dyn_fsync_window_show,
+		dyn_fsync_window_store);
+
+static struct kobj_attribute dyn_fsync_stats_attribute =
+	__ATTR(Dyn_fsync_batch_stats, 0444, dyn_fsync_stats_show, NULL);
+
 static struct kobj_attribute dyn_fsync_version_attribute = 
 	__ATTR(Dyn_fsync_version, 0444, dyn_fsync_version_show, NULL);
 
@@ -94,6 +316,9 @@ static struct attribute *dyn_fsync_active_attrs[] =
 		&dyn_fsync_active_attribute.attr,
 		&dyn_fsync_version_attribute.attr,
 		&dyn_fsync_earlysuspend_attribute.attr,
+		&dyn_fsync_batch_attribute.attr,
+		&dyn_fsync_window_attribute.attr,
+		&dyn_fsync_stats_attribute.attr,
 		NULL,
 	};
 
@@ -169,6 +394,12 @@ static struct notifier_block dyn_fsync_notifier = {
 static int dyn_fsync_init(void)
 {
 	int sysfs_result;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(dyn_fsync_groups); i++) {
+		spin_lock_init(&dyn_fsync_groups[i].lock);
+		init_waitqueue_head(&dyn_fsync_groups[i].wait);
+	}
 
 	register_early_suspend(&dyn_fsync_early_suspend_handler);
 	register_reboot_notifier(&dyn_fsync_notifier);
@@ -1080,6 +1080,7 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	lowmem_task_adj_changed(task);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
@@ -1214,6 +1215,7 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	lowmem_task_adj_changed(task);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
@@ -2742,6 +2744,38 @@ static int proc_tgid_io_accounting(struct task_struct *task, char *buffer)
 }
 #endif /* CONFIG_TASK_IO_ACCOUNTING */
 
+#ifdef CONFIG_KSM
+/*
+ * How much memory KSM saves for this mm, and how much scanning it cost:
+ * ksm_merging_pages are pages of this mm that are mapped to a KSM page.
+ */
+static int proc_pid_ksm_stat(struct task_struct *task, char *buffer)
+{
+	struct mm_struct *mm;
+	unsigned long merging, scanned;
+	u64 msecs, kb_per_sec = 0;
+
+	mm = get_task_mm(task);
+	if (!mm)
+		return 0;
+	merging = mm->ksm_merging_pages;
+	scanned = mm->ksm_scanned_pages;
+	msecs = div_u64(mm->ksm_scan_ns, NSEC_PER_MSEC);
+	mmput(mm);
+
+	if (msecs)
+		kb_per_sec = div64_u64(((u64)merging << (PAGE_SHIFT - 10)) *
+				       MSEC_PER_SEC, msecs);
+	return sprintf(buffer,
+			"ksm_merging_pages: %lu\n"
+			"ksm_scanned_pages: %lu\n"
+			"ksm_scan_msecs: %llu\n"
+			"ksm_saved_kb_per_cpu_sec: %llu\n",
+			merging, scanned, (unsigned long long)msecs,
+			(unsigned long long)kb_per_sec);
+}
+#endif /* CONFIG_KSM */
+
 static int proc_pid_personality(struct seq_file *m, struct pid_namespace *ns,
 				struct pid *pid, struct task_struct *task)
 {
@@ -2841,6 +2875,9 @@ static const struct pid_entry tgid_base_stuff[] = {
 #ifdef CONFIG_HARDWALL
 	INF("hardwall",   S_IRUGO, proc_pid_hardwall),
 #endif
+#ifdef CONFIG_KSM
+	INF("ksm_stat",   S_IRUGO, proc_pid_ksm_stat),
+#endif
 };
 
 static int proc_tgid_base_readdir(struct file * filp,
@@ -3183,6 +3220,9 @@ static const struct pid_entry tid_base_stuff[] = {
 #ifdef CONFIG_HARDWALL
 	INF("hardwall",   S_IRUGO, proc_pid_hardwall),
 #endif
+#ifdef CONFIG_KSM
+	INF("ksm_stat",   S_IRUGO, proc_pid_ksm_stat),
+#endif
 };
 
 static int proc_tid_base_readdir(struct file * filp,
@@ -21,6 +21,15 @@
 #ifdef CONFIG_DYNAMIC_FSYNC
 extern bool early_suspend_active;
 extern bool dyn_fsync_active;
+extern bool dyn_fsync_batch;
+extern int dyn_fsync_batched(struct file *file, loff_t start, loff_t end,
+			     int datasync);
+
+/* fsync is dropped while the screen is on, unless it is batched */
+static inline bool dyn_fsync_skip(void)
+{
+	return dyn_fsync_active && !early_suspend_active && !dyn_fsync_batch;
+}
 #endif
 
 #define VALID_FLAGS (SYNC_FILE_RANGE_WAIT_BEFORE|SYNC_FILE_RANGE_WRITE| \
@@ -171,16 +180,16 @@ SYSCALL_DEFINE1(syncfs, int, fd)
 int vfs_fsync_range(struct file *file, loff_t start, loff_t end, int datasync)
 {
 #ifdef CONFIG_DYNAMIC_FSYNC
-	if (likely(dyn_fsync_active && !early_suspend_active))
+	if (likely(dyn_fsync_skip()))
 		return 0;
-	else {
 #endif
 	if (!file->f_op || !file->f_op->fsync)
 		return -EINVAL;
-	return file->f_op->fsync(file, start, end, datasync);
 #ifdef CONFIG_DYNAMIC_FSYNC
-	}
+	if (dyn_fsync_batch && dyn_fsync_active && !early_suspend_active)
+		return dyn_fsync_batched(file, start, end, datasync);
 #endif
+	return file->f_op->fsync(file, start, end, datasync);
 }
 EXPORT_SYMBOL(vfs_fsync_range);
 
@@ -215,7 +224,7 @@ static int do_fsync(unsigned int fd, int datasync)
 SYSCALL_DEFINE1(fsync, unsigned int, fd)
 {
 #ifdef CONFIG_DYNAMIC_FSYNC
-	if (likely(dyn_fsync_active && !early_suspend_active))
+	if (likely(dyn_fsync_skip()))
 		return 0;
 	else
 #endif
@@ -225,7 +234,7 @@ SYSCALL_DEFINE1(fsync, unsigned int, fd)
 SYSCALL_DEFINE1(fdatasync, unsigned int, fd)
 {
 #if 0
-	if (likely(dyn_fsync_active && !early_suspend_active))
+	if (likely(dyn_fsync_skip()))
 		return 0;
 	else
 #endif
@@ -300,7 +309,7 @@ SYSCALL_DEFINE(sync_file_range)(int fd, loff_t offset, loff_t nbytes,
 				unsigned int flags)
 {
 #ifdef CONFIG_DYNAMIC_FSYNC
-	if (likely(dyn_fsync_active && !early_suspend_active))
+	if (likely(dyn_fsync_skip()))
 		return 0;
 	else {
 #endif
@@ -404,7 +413,7 @@ SYSCALL_DEFINE(sync_file_range2)(int fd, unsigned int flags,
 				 loff_t offset, loff_t nbytes)
 {
 #ifdef CONFIG_DYNAMIC_FSYNC
-	if (likely(dyn_fsync_active && !early_suspend_active))
+	if (likely(dyn_fsync_skip()))
 		return 0;
 	else
 #endif
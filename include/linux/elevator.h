@@ -85,6 +85,7 @@ struct elevator_type
 	struct elv_fs_entry *elevator_attrs;
 	char elevator_name[ELV_NAME_MAX];
 	struct module *elevator_owner;
+	bool elevator_staging;	/* may be fed from per-cpu staging */
 };
 
 #define ELV_HASH_BITS 6
@@ -0,0 +1,133 @@
+#ifndef _LINUX_FRONTSWAP_H
+#define _LINUX_FRONTSWAP_H
+
+#include <linux/swap.h>
+#include <linux/mm.h>
+#include <linux/bitops.h>
+
+/*
+ * A frontswap backend stores swap pages synchronously, in place of the
+ * block I/O that swap_writepage would otherwise issue.  put_page returns
+ * 0 if it took the page; get_page returns 0 if it filled the page.
+ */
+struct frontswap_ops {
+	void (*init)(unsigned);
+	int (*put_page)(unsigned, pgoff_t, struct page *);
+	int (*get_page)(unsigned, pgoff_t, struct page *);
+	void (*flush_page)(unsigned, pgoff_t);
+	void (*flush_area)(unsigned);
+};
+
+extern struct frontswap_ops
+	frontswap_register_ops(struct frontswap_ops *ops);
+extern void __frontswap_init(unsigned type);
+extern int __frontswap_put_page(struct page *page);
+extern int __frontswap_get_page(struct page *page);
+extern void __frontswap_flush_page(struct swap_info_struct *, pgoff_t);
+extern void __frontswap_flush_area(struct swap_info_struct *);
+extern int frontswap_enabled;
+
+#ifdef CONFIG_FRONTSWAP
+/* the frontswap_map bit of a swap entry is set while the backend has it */
+static inline int frontswap_test(struct swap_info_struct *sis, pgoff_t offset)
+{
+	if (sis->frontswap_map)
+		return test_bit(offset, sis->frontswap_map);
+	return 0;
+}
+
+static inline void frontswap_set(struct swap_info_struct *sis, pgoff_t offset)
+{
+	if (sis->frontswap_map)
+		set_bit(offset, sis->frontswap_map);
+}
+
+static inline void frontswap_clear(struct swap_info_struct *sis,
+				   pgoff_t offset)
+{
+	if (sis->frontswap_map)
+		clear_bit(offset, sis->frontswap_map);
+}
+
+static inline unsigned long *frontswap_map_get(struct swap_info_struct *sis)
+{
+	return sis->frontswap_map;
+}
+
+static inline void frontswap_map_set(struct swap_info_struct *sis,
+				     unsigned long *map)
+{
+	sis->frontswap_map = map;
+}
+#else
+#define frontswap_enabled (0)
+
+static inline int frontswap_test(struct swap_info_struct *sis, pgoff_t offset)
+{
+	return 0;
+}
+
+static inline void frontswap_set(struct swap_info_struct *sis, pgoff_t offset)
+{
+}
+
+static inline void frontswap_clear(struct swap_info_struct *sis,
+				   pgoff_t offset)
+{
+}
+
+static inline unsigned long *frontswap_map_get(struct swap_info_struct *sis)
+{
+	return NULL;
+}
+
+static inline void frontswap_map_set(struct swap_info_struct *sis,
+				     unsigned long *map)
+{
+}
+#endif
+
+/*
+ * As with cleancache, these shims reduce to nothing without
+ * CONFIG_FRONTSWAP, and to a global variable check until a backend
+ * registers.
+ */
+
+static inline void frontswap_init(unsigned type)
+{
+	if (frontswap_enabled)
+		__frontswap_init(type);
+}
+
+static inline int frontswap_put_page(struct page *page)
+{
+	int ret = -1;
+
+	if (frontswap_enabled)
+		ret = __frontswap_put_page(page);
+	return ret;
+}
+
+static inline int frontswap_get_page(struct page *page)
+{
+	int ret = -1;
+
+	if (frontswap_enabled)
+		ret = __frontswap_get_page(page);
+	return ret;
+}
+
+static inline void frontswap_flush_page(struct swap_info_struct *sis,
+					pgoff_t offset)
+{
+	if (frontswap_enabled && frontswap_test(sis, offset))
+		__frontswap_flush_page(sis, offset);
+}
+
+static inline void frontswap_flush_area(struct swap_info_struct *sis)
+{
+	if (frontswap_enabled && frontswap_map_get(sis))
+		__frontswap_flush_area(sis);
+}
+
+#endif /* _LINUX_FRONTSWAP_H */
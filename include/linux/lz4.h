@@ -0,0 +1,40 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ *  LZ4 Public Kernel Interface
+ *
+ *  Compressor and decompressor for the LZ4 block format
+ *  (http://code.google.com/p/lz4/). Compression is a simple greedy
+ *  single-probe parser, which keeps it close to LZO in speed and
+ *  ratio; decompression is considerably faster than LZO.
+ */
+
+#define LZ4_HASH_LOG		12
+#define LZ4_MEM_COMPRESS	((1 << LZ4_HASH_LOG) * sizeof(u32))
+
+#define lz4_compressbound(x)	((x) + ((x) / 255) + 16)
+
+/*
+ * This requires 'wrkmem' of size LZ4_MEM_COMPRESS.
+ * On entry *dst_len is the size of 'dst', on return the number of
+ * bytes written. Output is bounds checked, so 'dst' need not be
+ * lz4_compressbound() sized: LZ4_E_OUTPUT_OVERRUN is returned if
+ * the result would not fit.
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		 unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/* safe decompression with overrun testing */
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len);
+
+/*
+ * Return values (< 0 = Error)
+ */
+#define LZ4_E_OK			0
+#define LZ4_E_ERROR			(-1)
+#define LZ4_E_INPUT_OVERRUN		(-4)
+#define LZ4_E_OUTPUT_OVERRUN		(-5)
+#define LZ4_E_LOOKBEHIND_OVERRUN	(-6)
+
+#endif
@@ -1459,6 +1459,38 @@ unsigned long ra_submit(struct file_ra_state *ra,
 			struct address_space *mapping,
 			struct file *filp);
 
+/* readahead_pattern.c */
+#ifdef CONFIG_READAHEAD_PATTERN
+extern bool ra_pattern_recording;
+extern unsigned int ra_pattern_pending;
+extern int sysctl_readahead_record_secs;
+int readahead_record_sysctl_handler(struct ctl_table *table, int write,
+				    void __user *buffer, size_t *length,
+				    loff_t *ppos);
+void __readahead_pattern_access(struct file *file, pgoff_t index);
+void __readahead_pattern_replay(struct file *file);
+
+static inline void readahead_pattern_access(struct file *file, pgoff_t index)
+{
+	if (unlikely(ra_pattern_recording))
+		__readahead_pattern_access(file, index);
+}
+
+static inline void readahead_pattern_replay(struct file *file)
+{
+	if (unlikely(ra_pattern_pending))
+		__readahead_pattern_replay(file);
+}
+#else
+static inline void readahead_pattern_access(struct file *file, pgoff_t index)
+{
+}
+
+static inline void readahead_pattern_replay(struct file *file)
+{
+}
+#endif
+
 /* Generic expand stack which grows the stack according to GROWS{UP,DOWN} */
 extern int expand_stack(struct vm_area_struct *vma, unsigned long address);
 
@@ -327,17 +327,6 @@ struct mm_struct {
 	/* Architecture-specific MM context */
 	mm_context_t context;
 
-	/* Swap token stuff */
-	/*
-	 * Last value of global fault stamp as seen by this process.
-	 * In other words, this value gives an indication of how long
-	 * it has been since this task got the token.
-	 * Look at mm/thrash.c
-	 */
-	unsigned int faultstamp;
-	unsigned int token_priority;
-	unsigned int last_interval;
-
 	/* How many tasks sharing this mm are OOM_DISABLE */
 	atomic_t oom_disable_count;
 
@@ -374,6 +363,12 @@ struct mm_struct {
 #ifdef CONFIG_CPUMASK_OFFSTACK
 	struct cpumask cpumask_allocation;
 #endif
+#ifdef CONFIG_KSM
+	/* KSM merge efficiency, see /proc/<pid>/ksm_stat; updated by ksmd */
+	unsigned long ksm_merging_pages;
+	unsigned long ksm_scanned_pages;
+	u64 ksm_scan_ns;
+#endif
 };
 
 static inline void mm_init_cpumask(struct mm_struct *mm)
@@ -83,6 +83,9 @@ struct mmc_ext_csd {
 	u8			out_of_int_time;	/* out of int time */
 	bool			bk_ops;			/* BK ops support bit */
 	bool			bk_ops_en;		/* BK ops enable bit */
+	unsigned int		data_sector_size;	/* 512 bytes or 4KB */
+	u8			max_packed_writes;	/* 500 */
+	bool			packed_event_en;	/* packed failure events */
 };
 
 struct sd_scr {
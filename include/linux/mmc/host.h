@@ -232,6 +232,10 @@ struct mmc_host {
 #define MMC_CAP_CMD23		(1 << 30)	/* CMD23 supported. */
 #define MMC_CAP_BKOPS		(1 << 31)	/* Host supports BKOPS */
 
+	unsigned int		caps2;		/* More host capabilities */
+
+#define MMC_CAP2_PACKED_WR	(1 << 0)	/* Allow packed write */
+
 	mmc_pm_flag_t		pm_caps;	/* supported pm features */
 
 #ifdef CONFIG_MMC_CLKGATE
@@ -430,4 +434,9 @@ static inline int mmc_host_cmd23(struct mmc_host *host)
 {
 	return host->caps & MMC_CAP_CMD23;
 }
+
+static inline int mmc_host_packed_wr(struct mmc_host *host)
+{
+	return host->caps2 & MMC_CAP2_PACKED_WR;
+}
 #endif /* LINUX_MMC_HOST_H */
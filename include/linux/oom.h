@@ -67,6 +67,36 @@ static inline void oom_killer_enable(void)
 
 extern struct task_struct *find_lock_task_mm(struct task_struct *p);
 
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+/*
+ * Keep the lowmemorykiller's per-oom_adj lists of processes up to date.
+ * All but lowmem_task_adj_changed() are called with tasklist_lock held
+ * for writing, none of them with task_lock() held.
+ */
+extern void lowmem_task_fork(struct task_struct *p);
+extern void lowmem_task_exit(struct task_struct *p);
+extern void lowmem_task_exec(struct task_struct *leader,
+			     struct task_struct *tsk);
+extern void lowmem_task_adj_changed(struct task_struct *task);
+#else
+static inline void lowmem_task_fork(struct task_struct *p)
+{
+}
+
+static inline void lowmem_task_exit(struct task_struct *p)
+{
+}
+
+static inline void lowmem_task_exec(struct task_struct *leader,
+				    struct task_struct *tsk)
+{
+}
+
+static inline void lowmem_task_adj_changed(struct task_struct *task)
+{
+}
+#endif
+
 /* sysctls */
 extern int sysctl_oom_dump_tasks;
 extern int sysctl_oom_kill_allocating_task;
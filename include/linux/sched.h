@@ -1282,6 +1282,11 @@ struct task_struct {
 #ifdef CONFIG_SMP
 	struct plist_node pushable_tasks;
 #endif
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+	/* thread group leaders only, see lowmem_task_fork() */
+	struct hlist_node lowmem_adj_node;
+	int lowmem_adj;
+#endif
 
 	struct mm_struct *mm, *active_mm;
 #ifdef CONFIG_COMPAT_BRK
@@ -10,7 +10,6 @@
 #include <linux/gfp.h>
 #include <linux/workqueue.h>
 #include <linux/kobject.h>
-#include <linux/rcu_types.h>
 #include <linux/mm_types.h>
 #include <linux/kernel.h>
 
@@ -31,6 +30,7 @@ enum stat_item {
 	FLUSH_RFREE_LIST_OBJECTS, /* Rfree objects flushed */
 	CLAIM_REMOTE_LIST,	/* Remote freed list claimed */
 	CLAIM_REMOTE_LIST_OBJECTS, /* Remote freed objects claimed */
+	FLUSH_RFREE_MAGAZINE,	/* Magazine flushed to make room for another */
 	NR_SLQB_STAT_ITEMS
 };
 
@@ -93,6 +93,21 @@ struct kmem_cache_list {
 #endif
 } ____cacheline_aligned;
 
+/*
+ * Number of remote kmem_cache_lists a CPU can collect objects for at once.
+ */
+#define SLQB_NR_MAGAZINES	4
+
+/*
+ * A magazine collects objects freed on this CPU that belong to another
+ * kmem_cache_list, dst. Once it holds freebatch objects, it is handed over
+ * to dst's remote_free list as a single chain.
+ */
+struct slqb_magazine {
+	struct kmlist		list;
+	struct kmem_cache_list	*dst;
+};
+
 /*
  * Primary per-cpu, per-kmem_cache structure.
  */
@@ -102,16 +117,16 @@ struct kmem_cache_cpu {
 
 #ifdef CONFIG_SMP
 	/*
-	 * rlist is a list of objects that don't fit on list.freelist (ie.
-	 * wrong node). The objects all correspond to a given kmem_cache_list,
-	 * remote_cache_list. To free objects to another list, we must first
-	 * flush the existing objects, then switch remote_cache_list.
+	 * Magazines of objects that don't fit on list.freelist (ie. wrong
+	 * node, or flushed from our freelist but belonging to another CPU's
+	 * list), one per destination list. Only when all of them are in use
+	 * must one be flushed early to collect objects for another list.
 	 *
 	 * An NR_CPUS or MAX_NUMNODES array would be nice here, but then we
 	 * get to O(NR_CPUS^2) memory consumption situation.
 	 */
-	struct kmlist		rlist;
-	struct kmem_cache_list	*remote_cache_list;
+	struct slqb_magazine	mag[SLQB_NR_MAGAZINES];
+	unsigned int		mag_victim;	/* next magazine to recycle */
 #endif
 } ____cacheline_aligned_in_smp;
 
@@ -164,8 +179,8 @@ struct kmem_cache {
 /*
  * Kmalloc subsystem.
  */
-#if defined(ARCH_KMALLOC_MINALIGN) && ARCH_KMALLOC_MINALIGN > 8
-#define KMALLOC_MIN_SIZE ARCH_KMALLOC_MINALIGN
+#if defined(ARCH_DMA_MINALIGN) && ARCH_DMA_MINALIGN > 8
+#define KMALLOC_MIN_SIZE ARCH_DMA_MINALIGN
 #else
 #define KMALLOC_MIN_SIZE 8
 #endif
@@ -253,14 +268,6 @@ static __always_inline struct kmem_cache *kmalloc_slab(size_t size, gfp_t flags)
 void *kmem_cache_alloc(struct kmem_cache *, gfp_t);
 void *__kmalloc(size_t size, gfp_t flags);
 
-#ifndef ARCH_KMALLOC_MINALIGN
-#define ARCH_KMALLOC_MINALIGN __alignof__(unsigned long long)
-#endif
-
-#ifndef ARCH_SLAB_MINALIGN
-#define ARCH_SLAB_MINALIGN __alignof__(unsigned long long)
-#endif
-
 #define KMALLOC_HEADER (ARCH_KMALLOC_MINALIGN < sizeof(void *) ?	\
 				sizeof(void *) : ARCH_KMALLOC_MINALIGN)
 
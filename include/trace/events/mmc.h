@@ -0,0 +1,122 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mmc
+
+#if !defined(_TRACE_MMC_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_MMC_H
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+
+/*
+ * One read or write command of mmcqd has completed.  The time it took
+ * is split into: waiting on the request queue, building the command in
+ * mmcqd, waiting for the previous command to leave the bus, on the bus
+ * (including the status check and any retries), and completing it back
+ * to the block layer.  All times are in nanoseconds.
+ */
+TRACE_EVENT(mmc_blk_rw_done,
+
+	TP_PROTO(const char *name, int write, sector_t sector,
+		unsigned int bytes, unsigned int nr_reqs, int error,
+		u64 queue_ns, u64 prep_ns, u64 wait_ns, u64 bus_ns,
+		u64 complete_ns),
+
+	TP_ARGS(name, write, sector, bytes, nr_reqs, error,
+		queue_ns, prep_ns, wait_ns, bus_ns, complete_ns),
+
+	TP_STRUCT__entry(
+		__string(name, name)
+		__field(int, write)
+		__field(sector_t, sector)
+		__field(unsigned int, bytes)
+		__field(unsigned int, nr_reqs)
+		__field(int, error)
+		__field(u64, queue_ns)
+		__field(u64, prep_ns)
+		__field(u64, wait_ns)
+		__field(u64, bus_ns)
+		__field(u64, complete_ns)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, name);
+		__entry->write = write;
+		__entry->sector = sector;
+		__entry->bytes = bytes;
+		__entry->nr_reqs = nr_reqs;
+		__entry->error = error;
+		__entry->queue_ns = queue_ns;
+		__entry->prep_ns = prep_ns;
+		__entry->wait_ns = wait_ns;
+		__entry->bus_ns = bus_ns;
+		__entry->complete_ns = complete_ns;
+	),
+
+	TP_printk("%s %c %llu + %u reqs=%u err=%d queue=%llu prep=%llu "
+		"wait=%llu bus=%llu complete=%llu",
+		__get_str(name), __entry->write ? 'W' : 'R',
+		(unsigned long long)__entry->sector, __entry->bytes >> 9,
+		__entry->nr_reqs, __entry->error,
+		__entry->queue_ns, __entry->prep_ns, __entry->wait_ns,
+		__entry->bus_ns, __entry->complete_ns)
+);
+
+/*
+ * A flush was completed.  @inflight tells whether a write was still on
+ * the bus, i.e. whether the flush overtook it instead of draining it.
+ */
+TRACE_EVENT(mmc_blk_flush,
+
+	TP_PROTO(const char *name, bool inflight),
+
+	TP_ARGS(name, inflight),
+
+	TP_STRUCT__entry(
+		__string(name, name)
+		__field(bool, inflight)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, name);
+		__entry->inflight = inflight;
+	),
+
+	TP_printk("%s inflight=%d", __get_str(name), __entry->inflight)
+);
+
+/*
+ * A discard was completed, after waiting @wait_ns for the command on
+ * the bus to finish and spending @erase_ns erasing.
+ */
+TRACE_EVENT(mmc_blk_discard,
+
+	TP_PROTO(const char *name, sector_t sector, unsigned int nr_sects,
+		u64 wait_ns, u64 erase_ns),
+
+	TP_ARGS(name, sector, nr_sects, wait_ns, erase_ns),
+
+	TP_STRUCT__entry(
+		__string(name, name)
+		__field(sector_t, sector)
+		__field(unsigned int, nr_sects)
+		__field(u64, wait_ns)
+		__field(u64, erase_ns)
+	),
+
+	TP_fast_assign(
+		__assign_str(name, name);
+		__entry->sector = sector;
+		__entry->nr_sects = nr_sects;
+		__entry->wait_ns = wait_ns;
+		__entry->erase_ns = erase_ns;
+	),
+
+	TP_printk("%s %llu + %u wait=%llu erase=%llu", __get_str(name),
+		(unsigned long long)__entry->sector, __entry->nr_sects,
+		__entry->wait_ns, __entry->erase_ns)
+);
+
+#endif /* _TRACE_MMC_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -70,6 +70,7 @@ static void __unhash_process(struct task_struct *p, bool group_dead)
 		list_del_rcu(&p->tasks);
 		list_del_init(&p->sibling);
 		__this_cpu_dec(process_counts);
+		lowmem_task_exit(p);
 	}
 	list_del_rcu(&p->thread_group);
 }
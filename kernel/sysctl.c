@@ -1179,6 +1179,14 @@ static struct ctl_table vm_table[] = {
 		.extra1		= &min_extfrag_threshold,
 		.extra2		= &max_extfrag_threshold,
 	},
+	{
+		.procname	= "kcompactd_interval_ms",
+		.data		= &sysctl_kcompactd_interval_ms,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= sysctl_kcompactd_interval_handler,
+		.extra1		= &zero,
+	},
 
 #endif /* CONFIG_COMPACTION */
 	{
@@ -1359,6 +1367,16 @@ static struct ctl_table vm_table[] = {
 		.extra1		= &zero,
 		.extra2		= &one,
 	},
+#endif
+#ifdef CONFIG_READAHEAD_PATTERN
+	{
+		.procname	= "readahead_record_secs",
+		.data		= &sysctl_readahead_record_secs,
+		.maxlen		= sizeof(sysctl_readahead_record_secs),
+		.mode		= 0644,
+		.proc_handler	= readahead_record_sysctl_handler,
+		.extra1		= &zero,
+	},
 #endif
 	{ }
 };
@@ -0,0 +1,221 @@
+/*
+ * kmalloc/kfree microbenchmark
+ *
+ * Times kmalloc() and kfree() for sizes from 8 to 4096 bytes, freeing on
+ * the allocating CPU, freeing on another CPU, and with objects going back
+ * and forth between two CPUs. It runs once when loaded and prints its
+ * results; loading fails afterwards with -EAGAIN, so it can simply be
+ * loaded again for another run. To compare the allocators, build the
+ * kernel once each with SLAB, SLUB and SLQB and load it on each; the
+ * allocator is named in the first line of the results.
+ *
+ *	modprobe kmalloc_benchmark [batch=N] [rounds=N] [cpu_a=N] [cpu_b=N]
+ *
+ * Licensed under the GPL-2.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/hrtimer.h>
+#include <linux/cpu.h>
+#include <linux/workqueue.h>
+
+#if defined(CONFIG_SLQB)
+#define KB_ALLOCATOR	"SLQB"
+#elif defined(CONFIG_SLUB)
+#define KB_ALLOCATOR	"SLUB"
+#elif defined(CONFIG_SLOB)
+#define KB_ALLOCATOR	"SLOB"
+#else
+#define KB_ALLOCATOR	"SLAB"
+#endif
+
+static int batch = 512;
+module_param(batch, int, 0444);
+MODULE_PARM_DESC(batch, "objects allocated before they are freed");
+
+static int rounds = 64;
+module_param(rounds, int, 0444);
+MODULE_PARM_DESC(rounds, "batches per test and size");
+
+static int cpu_a;
+module_param(cpu_a, int, 0444);
+MODULE_PARM_DESC(cpu_a, "first cpu, which does all single-cpu tests");
+
+static int cpu_b = 1;
+module_param(cpu_b, int, 0444);
+MODULE_PARM_DESC(cpu_b, "second cpu, for the cross-cpu tests");
+
+struct kb_ctx {
+	size_t		size;
+	void		**objs;
+	int		nr;		/* objects in objs[] */
+	u64		alloc_ns;
+	u64		free_ns;
+	unsigned long	allocs;
+	unsigned long	frees;
+	int		failed;
+};
+
+static long kb_alloc_batch(void *arg)
+{
+	struct kb_ctx *ctx = arg;
+	ktime_t start;
+	int i;
+
+	start = ktime_get();
+	for (i = 0; i < batch; i++) {
+		ctx->objs[i] = kmalloc(ctx->size, GFP_KERNEL);
+		if (!ctx->objs[i]) {
+			ctx->failed = 1;
+			break;
+		}
+	}
+	ctx->alloc_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	ctx->allocs += i;
+	ctx->nr = i;
+	return 0;
+}
+
+static long kb_free_batch(void *arg)
+{
+	struct kb_ctx *ctx = arg;
+	ktime_t start;
+	int i;
+
+	start = ktime_get();
+	for (i = 0; i < ctx->nr; i++)
+		kfree(ctx->objs[i]);
+	ctx->free_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	ctx->frees += ctx->nr;
+	ctx->nr = 0;
+	return 0;
+}
+
+/* kmalloc immediately followed by kfree: the best case of every allocator */
+static long kb_alloc_free(void *arg)
+{
+	struct kb_ctx *ctx = arg;
+	ktime_t start;
+	void *obj;
+	int i;
+
+	start = ktime_get();
+	for (i = 0; i < batch; i++) {
+		obj = kmalloc(ctx->size, GFP_KERNEL);
+		if (!obj) {
+			ctx->failed = 1;
+			break;
+		}
+		kfree(obj);
+	}
+	ctx->alloc_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	ctx->allocs += i;
+	return 0;
+}
+
+static unsigned long kb_per_op(u64 ns, unsigned long ops)
+{
+	return ops ? (unsigned long)div64_u64(ns, ops) : 0;
+}
+
+/*
+ * Allocate on 'alloc' and free on 'free' for each round; with pingpong,
+ * the two cpus swap roles every round.
+ */
+static int kb_run(struct kb_ctx *ctx, int alloc, int free, int pingpong)
+{
+	int r, tmp;
+
+	ctx->alloc_ns = ctx->free_ns = 0;
+	ctx->allocs = ctx->frees = 0;
+	for (r = 0; r < rounds && !ctx->failed; r++) {
+		work_on_cpu(alloc, kb_alloc_batch, ctx);
+		work_on_cpu(free, kb_free_batch, ctx);
+		if (pingpong) {
+			tmp = alloc;
+			alloc = free;
+			free = tmp;
+		}
+	}
+	return ctx->failed ? -ENOMEM : 0;
+}
+
+static int kb_run_size(struct kb_ctx *ctx, int cross)
+{
+	unsigned long pair, a_local, f_local, a_remote = 0, f_remote = 0;
+	unsigned long a_pp = 0, f_pp = 0;
+	int r, err;
+
+	ctx->alloc_ns = 0;
+	ctx->allocs = 0;
+	for (r = 0; r < rounds && !ctx->failed; r++)
+		work_on_cpu(cpu_a, kb_alloc_free, ctx);
+	pair = kb_per_op(ctx->alloc_ns, ctx->allocs);
+
+	err = kb_run(ctx, cpu_a, cpu_a, 0);
+	if (err)
+		return err;
+	a_local = kb_per_op(ctx->alloc_ns, ctx->allocs);
+	f_local = kb_per_op(ctx->free_ns, ctx->frees);
+
+	if (cross) {
+		err = kb_run(ctx, cpu_a, cpu_b, 0);
+		if (err)
+			return err;
+		a_remote = kb_per_op(ctx->alloc_ns, ctx->allocs);
+		f_remote = kb_per_op(ctx->free_ns, ctx->frees);
+
+		err = kb_run(ctx, cpu_a, cpu_b, 1);
+		if (err)
+			return err;
+		a_pp = kb_per_op(ctx->alloc_ns, ctx->allocs);
+		f_pp = kb_per_op(ctx->free_ns, ctx->frees);
+	}
+
+	pr_info("kmalloc_benchmark: %5zu %6lu %6lu %6lu %6lu %6lu %6lu %6lu\n",
+		ctx->size, pair, a_local, f_local, a_remote, f_remote,
+		a_pp, f_pp);
+	return 0;
+}
+
+static int __init kmalloc_benchmark_init(void)
+{
+	struct kb_ctx ctx;
+	int cross, err = 0;
+
+	if (batch <= 0 || rounds <= 0 || !cpu_online(cpu_a))
+		return -EINVAL;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.objs = vmalloc(batch * sizeof(void *));
+	if (!ctx.objs)
+		return -ENOMEM;
+
+	get_online_cpus();
+	cross = cpu_b != cpu_a && cpu_online(cpu_b);
+	pr_info("kmalloc_benchmark: %s, %d x %d objects, cpus %d and %d, "
+		"ns/op\n", KB_ALLOCATOR, rounds, batch, cpu_a,
+		cross ? cpu_b : -1);
+	pr_info("kmalloc_benchmark:        alloc+  local batch remote free"
+		"  ping-pong\n");
+	pr_info("kmalloc_benchmark:  size   free  alloc   free  alloc   free"
+		"  alloc   free\n");
+	for (ctx.size = 8; ctx.size <= 4096 && !err; ctx.size <<= 1)
+		err = kb_run_size(&ctx, cross);
+	put_online_cpus();
+
+	if (ctx.nr)
+		kb_free_batch(&ctx);
+	vfree(ctx.objs);
+	if (err) {
+		pr_err("kmalloc_benchmark: allocation failed\n");
+		return err;
+	}
+	return -EAGAIN;
+}
+module_init(kmalloc_benchmark_init);
+
+MODULE_DESCRIPTION("kmalloc/kfree microbenchmark");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,122 @@
+/*
+ *  LZ4 Compressor
+ *
+ *  Greedy single-probe compressor for the LZ4 block format. Each
+ *  position is hashed on its first four bytes into a table of the
+ *  last position seen with that hash; a verified hit of at least
+ *  MINMATCH bytes within MAX_DISTANCE becomes a match.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <asm/unaligned.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+static inline u32 lz4_hash(const unsigned char *p)
+{
+	return (get_unaligned((const u32 *)p) * 2654435761U) >>
+		(32 - LZ4_HASH_LOG);
+}
+
+/* Emit a length extension (the part beyond the token nibble). */
+static inline unsigned char *lz4_put_len(unsigned char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (unsigned char)len;
+	return op;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		 unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	const unsigned char *ip = src;
+	const unsigned char *anchor = src;
+	const unsigned char * const iend = src + src_len;
+	const unsigned char * const mflimit = iend - MFLIMIT;
+	const unsigned char * const matchlimit = iend - LASTLITERALS;
+	unsigned char *op = dst;
+	unsigned char * const oend = dst + *dst_len;
+	u32 *table = wrkmem;
+	size_t lit, mlen;
+
+	if (src_len < MFLIMIT + 1)
+		goto last_literals;
+
+	memset(table, 0, LZ4_MEM_COMPRESS);
+	table[lz4_hash(ip)] = 0;
+	ip++;
+
+	while (ip < mflimit) {
+		const unsigned char *ref;
+		u32 h = lz4_hash(ip);
+
+		ref = src + table[h];
+		table[h] = ip - src;
+
+		if (ref >= ip || ip - ref > MAX_DISTANCE ||
+		    get_unaligned((const u32 *)ref) !=
+		    get_unaligned((const u32 *)ip)) {
+			ip++;
+			continue;
+		}
+
+		/* Extend backwards into pending literals, then forwards */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+		mlen = MINMATCH;
+		while (ip + mlen < matchlimit && ip[mlen] == ref[mlen])
+			mlen++;
+
+		lit = ip - anchor;
+		/* token + extensions + literals + offset */
+		if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit + 2 +
+					  (mlen - MINMATCH) / 255 + 1)
+			return LZ4_E_OUTPUT_OVERRUN;
+
+		*op = (lit >= RUN_MASK ? RUN_MASK : lit) << ML_BITS;
+		*op |= (mlen - MINMATCH >= ML_MASK ?
+			ML_MASK : mlen - MINMATCH);
+		op++;
+		if (lit >= RUN_MASK)
+			op = lz4_put_len(op, lit - RUN_MASK);
+		memcpy(op, anchor, lit);
+		op += lit;
+
+		*op++ = (ip - ref) & 0xff;
+		*op++ = (ip - ref) >> 8;
+		if (mlen - MINMATCH >= ML_MASK)
+			op = lz4_put_len(op, mlen - MINMATCH - ML_MASK);
+
+		ip += mlen;
+		anchor = ip;
+		if (ip < mflimit)
+			table[lz4_hash(ip - 2)] = ip - 2 - src;
+	}
+
+last_literals:
+	lit = iend - anchor;
+	if ((size_t)(oend - op) < 1 + lit / 255 + 1 + lit)
+		return LZ4_E_OUTPUT_OVERRUN;
+
+	*op++ = (lit >= RUN_MASK ? RUN_MASK : lit) << ML_BITS;
+	if (lit >= RUN_MASK)
+		op = lz4_put_len(op, lit - RUN_MASK);
+	memcpy(op, anchor, lit);
+	op += lit;
+
+	*dst_len = op - dst;
+	return LZ4_E_OK;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
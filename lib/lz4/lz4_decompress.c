@@ -0,0 +1,105 @@
+/*
+ *  LZ4 Decompressor
+ *
+ *  Decoder for the LZ4 block format. Every length and offset read
+ *  from the input is checked against the input and output bounds, so
+ *  corrupted data cannot make it read or write out of range.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#ifndef STATIC
+#include <linux/module.h>
+#include <linux/kernel.h>
+#endif
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+#define HAVE_IP(x)	((size_t)(ip_end - ip) >= (size_t)(x))
+#define HAVE_OP(x)	((size_t)(op_end - op) >= (size_t)(x))
+#define NEED_IP(x)	if (!HAVE_IP(x)) goto input_overrun
+#define NEED_OP(x)	if (!HAVE_OP(x)) goto output_overrun
+
+int lz4_decompress_safe(const unsigned char *in, size_t in_len,
+			unsigned char *out, size_t *out_len)
+{
+	const unsigned char *ip = in;
+	const unsigned char * const ip_end = in + in_len;
+	unsigned char *op = out;
+	unsigned char * const op_end = out + *out_len;
+	const unsigned char *m_pos;
+	unsigned int token;
+	size_t len, offset;
+	unsigned char s;
+
+	for (;;) {
+		NEED_IP(1);
+		token = *ip++;
+
+		/* literals */
+		len = token >> ML_BITS;
+		if (len == RUN_MASK) {
+			do {
+				NEED_IP(1);
+				s = *ip++;
+				len += s;
+			} while (s == 255);
+		}
+		NEED_IP(len);
+		NEED_OP(len);
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		/* the last sequence has no match part */
+		if (ip == ip_end)
+			break;
+
+		/* match */
+		NEED_IP(2);
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - out))
+			goto lookbehind_overrun;
+		m_pos = op - offset;
+
+		len = token & ML_MASK;
+		if (len == ML_MASK) {
+			do {
+				NEED_IP(1);
+				s = *ip++;
+				len += s;
+			} while (s == 255);
+		}
+		len += MINMATCH;
+		NEED_OP(len);
+
+		/* byte copy: source and destination may overlap */
+		while (len--)
+			*op++ = *m_pos++;
+	}
+
+	*out_len = op - out;
+	return LZ4_E_OK;
+
+input_overrun:
+	*out_len = op - out;
+	return LZ4_E_INPUT_OVERRUN;
+
+output_overrun:
+	*out_len = op - out;
+	return LZ4_E_OUTPUT_OVERRUN;
+
+lookbehind_overrun:
+	*out_len = op - out;
+	return LZ4_E_LOOKBEHIND_OVERRUN;
+}
+#ifndef STATIC
+EXPORT_SYMBOL_GPL(lz4_decompress_safe);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
+#endif
@@ -0,0 +1,27 @@
+/*
+ *  lz4defs.h -- definitions shared by the LZ4 compressor and
+ *  decompressor
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+/*
+ * Block format: a sequence is a token byte (literal run length in the
+ * high nibble, match length - MINMATCH in the low nibble), optional
+ * literal length extension bytes, the literals, a 16-bit little endian
+ * match offset and optional match length extension bytes. A nibble of
+ * RUN_MASK/ML_MASK means the length continues in following bytes, each
+ * 255 meaning "add 255 and keep going". The last sequence carries only
+ * literals.
+ */
+#define MINMATCH	4
+#define LASTLITERALS	5	/* last bytes of a block are literals */
+#define MFLIMIT		12	/* no match may start after end - MFLIMIT */
+#define MAX_DISTANCE	65535
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
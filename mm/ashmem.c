@@ -27,6 +27,11 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 #include <linux/shmem_fs.h>
 #include <linux/ashmem.h>
 
@@ -37,43 +42,73 @@
 /*
  * ashmem_area - anonymous shared memory area
  * Lifecycle: From our parent file's open() until its release()
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its `mutex'
  * Big Note: Mappings do NOT pin this structure; it dies on close()
  */
 struct ashmem_area {
 	char name[ASHMEM_FULL_NAME_LEN];/* optional name for /proc/pid/maps */
-	struct list_head unpinned_list;	/* list of all ashmem areas */
+	struct rb_root unpinned;	/* unpinned ranges, by pgstart */
+	struct mutex mutex;		/* protects all of the above and below */
 	struct file *file;		/* the shmem-based backing file */
 	size_t size;			/* size of the mapping, in bytes */
 	unsigned long prot_mask;	/* allowed prot bits, as vm_flags */
+	atomic_t purge_inflight;	/* ranges being truncated, see below */
 };
 
 /*
  * ashmem_range - represents an interval of unpinned (evictable) pages
  * Lifecycle: From unpin to pin
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its area's `mutex'; `lru' and `purged' are also
+ * protected by `ashmem_lru_lock', as the purger changes them without the
+ * area's mutex.
+ *
+ * The unpinned ranges of an area never overlap, so ordering the tree by
+ * pgstart orders it by pgend too, and it works as an interval tree.
  */
 struct ashmem_range {
 	struct list_head lru;		/* entry in LRU list */
-	struct list_head unpinned;	/* entry in its area's unpinned list */
+	struct rb_node node;		/* entry in its area's unpinned tree */
 	struct ashmem_area *asma;	/* associated area */
 	size_t pgstart;			/* starting page, inclusive */
 	size_t pgend;			/* ending page, inclusive */
 	unsigned int purged;		/* ASHMEM_NOT or ASHMEM_WAS_PURGED */
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
+/* LRU list of unpinned pages, protected by ashmem_lru_lock */
 static LIST_HEAD(ashmem_lru_list);
 
-/* Count of pages on our LRU list, protected by ashmem_mutex */
+/* Count of pages on our LRU list, protected by ashmem_lru_lock */
 static unsigned long lru_count;
 
 /*
- * ashmem_mutex - protects the list of and each individual ashmem_area
+ * ashmem_lru_lock - protects the LRU list and whether a range is purged
  *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
+ * Lock Ordering: asma->mutex -> ashmem_lru_lock
+ *		  asma->mutex -> i_mutex -> i_alloc_sem
+ * Purging takes i_mutex with neither of the others held.
+ */
+static DEFINE_SPINLOCK(ashmem_lru_lock);
+
+/*
+ * Ranges being purged are off the LRU and marked purged, but their pages
+ * are only gone once vmtruncate_range returns.  A pin that finds a purged
+ * range waits for the purges in flight on its area, so the caller does
+ * not repopulate pages that are about to be truncated; release waits for
+ * them too, before the area is freed.  The counter is per area, the wait
+ * queue is shared: the purger must not touch the area once it has
+ * dropped its count.
  */
-static DEFINE_MUTEX(ashmem_mutex);
+static DECLARE_WAIT_QUEUE_HEAD(ashmem_purge_wait);
+
+/*
+ * Pages that reclaim asked for but left to the purge worker, which purges
+ * them ASHMEM_PURGE_BATCH pages at a time.
+ */
+#define ASHMEM_PURGE_BATCH	(SWAP_CLUSTER_MAX * 8)
+static atomic_long_t ashmem_purge_pending = ATOMIC_LONG_INIT(0);
+static struct workqueue_struct *ashmem_purge_wq;
+static void ashmem_purge_worker(struct work_struct *work);
+static DECLARE_WORK(ashmem_purge_work, ashmem_purge_worker);
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -90,16 +125,6 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 #define page_range_subsumed_by_range(range, start, end) \
   (((range)->pgstart <= (start)) && ((range)->pgend >= (end)))
 
-#define page_in_range(range, page) \
- (((range)->pgstart <= (page)) && ((range)->pgend >= (page)))
-
-#define page_range_in_range(range, start, end) \
-  (page_in_range(range, start) || page_in_range(range, end) || \
-   page_range_subsumes_range(range, start, end))
-
-#define range_before_page(range, page) \
-  ((range)->pgend < (page))
-
 #define PROT_MASK		(PROT_EXEC | PROT_READ | PROT_WRITE)
 
 static inline void lru_add(struct ashmem_range *range)
@@ -115,42 +140,85 @@ static inline void lru_del(struct ashmem_range *range)
 }
 
 /*
- * range_alloc - allocate and initialize a new ashmem_range structure
+ * range_first - returns the first unpinned range of 'asma' that ends at or
+ * after 'pgstart', or NULL.  Together with range_next, this walks the
+ * ranges that overlap [pgstart, pgend] in order:
+ *
+ *	for (range = range_first(asma, pgstart);
+ *	     range && range->pgstart <= pgend; range = range_next(range))
+ *
+ * Caller must hold asma->mutex.
+ */
+static struct ashmem_range *range_first(struct ashmem_area *asma,
+					size_t pgstart)
+{
+	struct rb_node *node = asma->unpinned.rb_node;
+	struct ashmem_range *range, *first = NULL;
+
+	while (node) {
+		range = rb_entry(node, struct ashmem_range, node);
+		if (range->pgend >= pgstart) {
+			first = range;
+			node = node->rb_left;
+		} else
+			node = node->rb_right;
+	}
+
+	return first;
+}
+
+static inline struct ashmem_range *range_next(struct ashmem_range *range)
+{
+	struct rb_node *node = rb_next(&range->node);
+
+	return node ? rb_entry(node, struct ashmem_range, node) : NULL;
+}
+
+/*
+ * range_alloc - initialize a new ashmem_range structure and insert it
  *
  * 'asma' - associated ashmem_area
- * 'prev_range' - the previous ashmem_range in the sorted asma->unpinned list
+ * 'new_range' - preallocated range, consumed (set to NULL) here
  * 'purged' - initial purge value (ASMEM_NOT_PURGED or ASHMEM_WAS_PURGED)
  * 'start' - starting page, inclusive
  * 'end' - ending page, inclusive
  *
- * Caller must hold ashmem_mutex.
+ * The range is allocated before the locks are taken, so this cannot fail.
+ *
+ * Caller must hold asma->mutex and ashmem_lru_lock.
  */
-static int range_alloc(struct ashmem_area *asma,
-		       struct ashmem_range *prev_range, unsigned int purged,
-		       size_t start, size_t end)
+static void range_alloc(struct ashmem_area *asma,
+			struct ashmem_range **new_range, unsigned int purged,
+			size_t start, size_t end)
 {
-	struct ashmem_range *range;
-
-	range = kmem_cache_zalloc(ashmem_range_cachep, GFP_KERNEL);
-	if (unlikely(!range))
-		return -ENOMEM;
+	struct rb_node **p = &asma->unpinned.rb_node, *parent = NULL;
+	struct ashmem_range *range = *new_range;
 
+	*new_range = NULL;
 	range->asma = asma;
 	range->pgstart = start;
 	range->pgend = end;
 	range->purged = purged;
 
-	list_add_tail(&range->unpinned, &prev_range->unpinned);
+	while (*p) {
+		parent = *p;
+		if (start < rb_entry(parent, struct ashmem_range,
+				     node)->pgstart)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&range->node, parent, p);
+	rb_insert_color(&range->node, &asma->unpinned);
 
 	if (range_on_lru(range))
 		lru_add(range);
-
-	return 0;
 }
 
+/* Caller must hold asma->mutex and ashmem_lru_lock. */
 static void range_del(struct ashmem_range *range)
 {
-	list_del(&range->unpinned);
+	rb_erase(&range->node, &range->asma->unpinned);
 	if (range_on_lru(range))
 		lru_del(range);
 	kmem_cache_free(ashmem_range_cachep, range);
@@ -159,7 +227,7 @@ static void range_del(struct ashmem_range *range)
 /*
  * range_shrink - shrinks a range
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex and ashmem_lru_lock.
  */
 static inline void range_shrink(struct ashmem_range *range,
 				size_t start, size_t end)
@@ -186,7 +254,8 @@ static int ashmem_open(struct inode *inode, struct file *file)
 	if (unlikely(!asma))
 		return -ENOMEM;
 
-	INIT_LIST_HEAD(&asma->unpinned_list);
+	asma->unpinned = RB_ROOT;
+	mutex_init(&asma->mutex);
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -197,12 +266,17 @@ static int ashmem_open(struct inode *inode, struct file *file)
 static int ashmem_release(struct inode *ignored, struct file *file)
 {
 	struct ashmem_area *asma = file->private_data;
-	struct ashmem_range *range, *next;
+	struct rb_node *node;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
-		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
+	spin_lock(&ashmem_lru_lock);
+	while ((node = rb_first(&asma->unpinned)))
+		range_del(rb_entry(node, struct ashmem_range, node));
+	spin_unlock(&ashmem_lru_lock);
+	mutex_unlock(&asma->mutex);
+
+	/* purges of our ranges still point at us */
+	wait_event(ashmem_purge_wait, !atomic_read(&asma->purge_inflight));
 
 	if (asma->file)
 		fput(asma->file);
@@ -217,7 +291,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* If size is not set, or set to 0, always return EOF. */
 	if (asma->size == 0) {
@@ -229,7 +303,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 		goto out_unlock;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	/*
 	 * asma and asma->file are used outside the lock here.  We assume
@@ -245,7 +319,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	return ret;
 
 out_unlock:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -254,7 +328,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -275,7 +349,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -292,7 +366,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* user needs to SET_SIZE before mapping */
 	if (unlikely(!asma->size)) {
@@ -335,10 +409,75 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	vma->vm_flags |= VM_CAN_NONLINEAR;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
+/*
+ * ashmem_purge - purge up to 'nr_to_scan' pages, least-recently-unpinned
+ * range first, and return the number of pages purged.
+ *
+ * Each range is taken off the LRU and marked purged under ashmem_lru_lock,
+ * then truncated with no ashmem lock held, so pins and unpins on other
+ * areas, and on this one, are not held up by the truncation.
+ */
+static unsigned long ashmem_purge(unsigned long nr_to_scan)
+{
+	struct ashmem_range *range;
+	atomic_t *inflight;
+	struct file *file;
+	unsigned long freed = 0;
+	loff_t start, end;
+
+	spin_lock(&ashmem_lru_lock);
+	while (freed < nr_to_scan && !list_empty(&ashmem_lru_list)) {
+		range = list_first_entry(&ashmem_lru_list, struct ashmem_range,
+					 lru);
+		/* the area can't go away while its ranges are on the LRU */
+		file = range->asma->file;
+		get_file(file);
+		start = range->pgstart * PAGE_SIZE;
+		end = (range->pgend + 1) * PAGE_SIZE - 1;
+
+		range->purged = ASHMEM_WAS_PURGED;
+		lru_del(range);
+		freed += range_size(range);
+		inflight = &range->asma->purge_inflight;
+		atomic_inc(inflight);
+		spin_unlock(&ashmem_lru_lock);
+
+		vmtruncate_range(file->f_dentry->d_inode, start, end);
+		fput(file);
+		if (atomic_dec_and_test(inflight))
+			wake_up_all(&ashmem_purge_wait);
+
+		cond_resched();
+		spin_lock(&ashmem_lru_lock);
+	}
+	spin_unlock(&ashmem_lru_lock);
+
+	return freed;
+}
+
+/*
+ * ashmem_purge_worker - purge what reclaim left to us, in batches
+ */
+static void ashmem_purge_worker(struct work_struct *work)
+{
+	unsigned long freed;
+	long nr;
+
+	while ((nr = atomic_long_xchg(&ashmem_purge_pending, 0)) > 0) {
+		while (nr > 0) {
+			freed = ashmem_purge(min_t(long, nr,
+						   ASHMEM_PURGE_BATCH));
+			if (!freed)
+				break;	/* LRU is empty, forget the rest */
+			nr -= freed;
+		}
+	}
+}
+
 /*
  * ashmem_shrink - our cache shrinker, called from mm/vmscan.c :: shrink_slab
  *
@@ -353,32 +492,24 @@ out:
  * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
  * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
  * pages freed.
+ *
+ * Truncating takes i_mutex and can take a while, so only kswapd purges
+ * directly.  Direct reclaim, and reclaim that must not recurse into the
+ * filesystem, queue the work for the purge worker instead of stalling the
+ * allocating task.
  */
 static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct ashmem_range *range, *next;
-
-	/* We might recurse into filesystem code, so bail out if necessary */
-	if (sc->nr_to_scan && !(sc->gfp_mask & __GFP_FS))
-		return -1;
 	if (!sc->nr_to_scan)
 		return lru_count;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
-
-		vmtruncate_range(inode, start, end);
-		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
-
-		sc->nr_to_scan -= range_size(range);
-		if (sc->nr_to_scan <= 0)
-			break;
+	if (!current_is_kswapd() || !(sc->gfp_mask & __GFP_FS)) {
+		atomic_long_add(sc->nr_to_scan, &ashmem_purge_pending);
+		queue_work(ashmem_purge_wq, &ashmem_purge_work);
+		return (sc->gfp_mask & __GFP_FS) ? lru_count : -1;
 	}
-	mutex_unlock(&ashmem_mutex);
+
+	ashmem_purge(sc->nr_to_scan);
 
 	return lru_count;
 }
@@ -392,7 +523,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* the user can only remove, not add, protection bits */
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -407,7 +538,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -422,7 +553,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 		return len;
 	if (len == ASHMEM_NAME_LEN)
 		lname[ASHMEM_NAME_LEN - 1] = '\0';
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* cannot change an existing mapping's name */
 	if (unlikely(asma->file))
@@ -430,7 +561,7 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	else
 		strcpy(asma->name + ASHMEM_NAME_PREFIX_LEN, lname);
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -440,7 +571,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 	char lname[ASHMEM_NAME_LEN];
 	size_t len;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 		/*
 		 * Copying only `len', instead of ASHMEM_NAME_LEN, bytes
@@ -452,7 +583,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 		len = strlen(ASHMEM_NAME_DEF) + 1;
 		memcpy(lname, ASHMEM_NAME_DEF, len);
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	if (unlikely(copy_to_user(name, lname, len)))
 		ret = -EFAULT;
 	return ret;
@@ -462,17 +593,17 @@ static int get_name(struct ashmem_area *asma, void __user *name)
  * ashmem_pin - pin the given ashmem region, returning whether it was
  * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED).
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex and ashmem_lru_lock.
  */
-static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
+static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend,
+		      struct ashmem_range **new_range)
 {
 	struct ashmem_range *range, *next;
 	int ret = ASHMEM_NOT_PURGED;
 
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* moved past last applicable page; we can short circuit */
-		if (range_before_page(range, pgstart))
-			break;
+	for (range = range_first(asma, pgstart);
+	     range && range->pgstart <= pgend; range = next) {
+		next = range_next(range);
 
 		/*
 		 * The user can ask us to pin pages that span multiple ranges,
@@ -489,37 +620,35 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 		 *    so we have to update one side of the range and then
 		 *    create a new range for the other side.
 		 */
-		if (page_range_in_range(range, pgstart, pgend)) {
-			ret |= range->purged;
-
-			/* Case #1: Easy. Just nuke the whole thing. */
-			if (page_range_subsumes_range(range, pgstart, pgend)) {
-				range_del(range);
-				continue;
-			}
-
-			/* Case #2: We overlap from the start, so adjust it */
-			if (range->pgstart >= pgstart) {
-				range_shrink(range, pgend + 1, range->pgend);
-				continue;
-			}
-
-			/* Case #3: We overlap from the rear, so adjust it */
-			if (range->pgend <= pgend) {
-				range_shrink(range, range->pgstart, pgstart-1);
-				continue;
-			}
-
-			/*
-			 * Case #4: We eat a chunk out of the middle. A bit
-			 * more complicated, we allocate a new range for the
-			 * second half and adjust the first chunk's endpoint.
-			 */
-			range_alloc(asma, range, range->purged,
-				    pgend + 1, range->pgend);
-			range_shrink(range, range->pgstart, pgstart - 1);
-			break;
+		ret |= range->purged;
+
+		/* Case #1: Easy. Just nuke the whole thing. */
+		if (page_range_subsumes_range(range, pgstart, pgend)) {
+			range_del(range);
+			continue;
+		}
+
+		/* Case #2: We overlap from the start, so adjust it */
+		if (range->pgstart >= pgstart) {
+			range_shrink(range, pgend + 1, range->pgend);
+			continue;
+		}
+
+		/* Case #3: We overlap from the rear, so adjust it */
+		if (range->pgend <= pgend) {
+			range_shrink(range, range->pgstart, pgstart-1);
+			continue;
 		}
+
+		/*
+		 * Case #4: We eat a chunk out of the middle. A bit
+		 * more complicated, we insert a new range for the
+		 * second half and adjust the first chunk's endpoint.
+		 */
+		range_alloc(asma, new_range, range->purged,
+			    pgend + 1, range->pgend);
+		range_shrink(range, range->pgstart, pgstart - 1);
+		break;
 	}
 
 	return ret;
@@ -528,18 +657,17 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 /*
  * ashmem_unpin - unpin the given range of pages. Returns zero on success.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex and ashmem_lru_lock.
  */
-static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
+static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend,
+			struct ashmem_range **new_range)
 {
 	struct ashmem_range *range, *next;
 	unsigned int purged = ASHMEM_NOT_PURGED;
 
-restart:
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* short circuit: this is our insertion point */
-		if (range_before_page(range, pgstart))
-			break;
+	for (range = range_first(asma, pgstart);
+	     range && range->pgstart <= pgend; range = next) {
+		next = range_next(range);
 
 		/*
 		 * The user can ask us to unpin pages that are already entirely
@@ -547,45 +675,39 @@ restart:
 		 */
 		if (page_range_subsumed_by_range(range, pgstart, pgend))
 			return 0;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			pgstart = min_t(size_t, range->pgstart, pgstart),
-			pgend = max_t(size_t, range->pgend, pgend);
-			purged |= range->purged;
-			range_del(range);
-			goto restart;
-		}
+
+		pgstart = min_t(size_t, range->pgstart, pgstart);
+		pgend = max_t(size_t, range->pgend, pgend);
+		purged |= range->purged;
+		range_del(range);
 	}
 
-	return range_alloc(asma, range, purged, pgstart, pgend);
+	range_alloc(asma, new_range, purged, pgstart, pgend);
+
+	return 0;
 }
 
 /*
  * ashmem_get_pin_status - Returns ASHMEM_IS_UNPINNED if _any_ pages in the
  * given interval are unpinned and ASHMEM_IS_PINNED otherwise.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 				 size_t pgend)
 {
-	struct ashmem_range *range;
-	int ret = ASHMEM_IS_PINNED;
-
-	list_for_each_entry(range, &asma->unpinned_list, unpinned) {
-		if (range_before_page(range, pgstart))
-			break;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			ret = ASHMEM_IS_UNPINNED;
-			break;
-		}
-	}
+	struct ashmem_range *range = range_first(asma, pgstart);
 
-	return ret;
+	if (range && range->pgstart <= pgend)
+		return ASHMEM_IS_UNPINNED;
+
+	return ASHMEM_IS_PINNED;
 }
 
 static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 			    void __user *p)
 {
+	struct ashmem_range *new_range = NULL;
 	struct ashmem_pin pin;
 	size_t pgstart, pgend;
 	int ret = -EINVAL;
@@ -612,21 +734,40 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	/* pin may split a range, unpin adds one: allocate it unlocked */
+	if (cmd != ASHMEM_GET_PIN_STATUS) {
+		new_range = kmem_cache_zalloc(ashmem_range_cachep, GFP_KERNEL);
+		if (unlikely(!new_range))
+			return -ENOMEM;
+	}
+
+	mutex_lock(&asma->mutex);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
-		ret = ashmem_pin(asma, pgstart, pgend);
+		spin_lock(&ashmem_lru_lock);
+		ret = ashmem_pin(asma, pgstart, pgend, &new_range);
+		spin_unlock(&ashmem_lru_lock);
 		break;
 	case ASHMEM_UNPIN:
-		ret = ashmem_unpin(asma, pgstart, pgend);
+		spin_lock(&ashmem_lru_lock);
+		ret = ashmem_unpin(asma, pgstart, pgend, &new_range);
+		spin_unlock(&ashmem_lru_lock);
 		break;
 	case ASHMEM_GET_PIN_STATUS:
 		ret = ashmem_get_pin_status(asma, pgstart, pgend);
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
+
+	if (new_range)
+		kmem_cache_free(ashmem_range_cachep, new_range);
+
+	/* the caller will refill the pages: not before they are truncated */
+	if (ret == ASHMEM_WAS_PURGED && cmd == ASHMEM_PIN)
+		wait_event(ashmem_purge_wait,
+			   !atomic_read(&asma->purge_inflight));
 
 	return ret;
 }
@@ -645,10 +786,12 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		break;
 	case ASHMEM_SET_SIZE:
 		ret = -EINVAL;
+		mutex_lock(&asma->mutex);
 		if (!asma->file) {
 			ret = 0;
 			asma->size = (size_t) arg;
 		}
+		mutex_unlock(&asma->mutex);
 		break;
 	case ASHMEM_GET_SIZE:
 		ret = asma->size;
@@ -667,13 +810,8 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case ASHMEM_PURGE_ALL_CACHES:
 		ret = -EPERM;
 		if (capable(CAP_SYS_ADMIN)) {
-			struct shrink_control sc = {
-				.gfp_mask = GFP_KERNEL,
-				.nr_to_scan = 0,
-			};
-			ret = ashmem_shrink(&ashmem_shrinker, &sc);
-			sc.nr_to_scan = ret;
-			ashmem_shrink(&ashmem_shrinker, &sc);
+			ret = lru_count;
+			ashmem_purge(ret);
 		}
 		break;
 	}
@@ -718,6 +856,12 @@ static int __init ashmem_init(void)
 		return -ENOMEM;
 	}
 
+	ashmem_purge_wq = create_singlethread_workqueue("ashmem_purge");
+	if (unlikely(!ashmem_purge_wq)) {
+		printk(KERN_ERR "ashmem: failed to create workqueue\n");
+		return -ENOMEM;
+	}
+
 	ret = misc_register(&ashmem_misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "ashmem: failed to register misc device!\n");
@@ -736,6 +880,7 @@ static void __exit ashmem_exit(void)
 	int ret;
 
 	unregister_shrinker(&ashmem_shrinker);
+	destroy_workqueue(ashmem_purge_wq);
 
 	ret = misc_deregister(&ashmem_misc);
 	if (unlikely(ret))
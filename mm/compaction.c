@@ -14,6 +14,9 @@
 #include <linux/backing-dev.h>
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/timer.h>
 #include "internal.h"
 
 #define CREATE_TRACE_POINTS
@@ -708,6 +711,181 @@ int compact_nodes(bool sync)
 	return COMPACT_COMPLETE;
 }
 
+/*
+ * kcompactd keeps the fragmentation index of orders KCOMPACTD_MIN_ORDER to
+ * KCOMPACTD_MAX_ORDER at or below sysctl_extfrag_threshold, i.e. where
+ * direct compaction would not be considered, so that high-order kernel
+ * allocations (DMA buffers, network drivers) do not have to stall.
+ *
+ * It checks every sysctl_kcompactd_interval_ms on a deferrable timer,
+ * but only compacts then if the CPUs are not busy.  When any high-order
+ * allocation enters the slow path, or the lowmemorykiller has killed
+ * something, it compacts right away, covering the order of that
+ * allocation too if it lies outside its usual range.
+ */
+#define KCOMPACTD_MIN_ORDER	2
+#define KCOMPACTD_MAX_ORDER	4
+/* a run that gets nowhere stretches the interval up to 8 times */
+#define KCOMPACTD_MAX_BACKOFF	3
+
+int sysctl_kcompactd_interval_ms = 1000;
+
+static struct task_struct *kcompactd_task;
+static DECLARE_WAIT_QUEUE_HEAD(kcompactd_wait);
+static struct timer_list kcompactd_timer;
+static bool kcompactd_pending;
+static bool kcompactd_demand;
+static int kcompactd_demand_order;	/* highest order woken for, or 0 */
+static unsigned int kcompactd_backoff;
+
+static void kcompactd_arm_timer(void)
+{
+	unsigned long delay;
+
+	if (!sysctl_kcompactd_interval_ms) {
+		del_timer(&kcompactd_timer);
+		return;
+	}
+	delay = msecs_to_jiffies(sysctl_kcompactd_interval_ms);
+	mod_timer(&kcompactd_timer, jiffies + (delay << kcompactd_backoff));
+}
+
+static void kcompactd_timer_fn(unsigned long data)
+{
+	kcompactd_pending = true;
+	wake_up_interruptible(&kcompactd_wait);
+}
+
+/**
+ * wakeup_kcompactd - an allocation of @order is having a hard time
+ * @order: order of the allocation, 0 if unknown
+ */
+void wakeup_kcompactd(int order)
+{
+	if (!kcompactd_task)
+		return;
+	if (order > kcompactd_demand_order)
+		kcompactd_demand_order = order;
+	if (kcompactd_demand)
+		return;
+	kcompactd_demand = true;
+	kcompactd_pending = true;
+	wake_up_interruptible(&kcompactd_wait);
+}
+
+static bool kcompactd_zone_fragmented(struct zone *zone, int order)
+{
+	return fragmentation_index(zone, order) > sysctl_extfrag_threshold;
+}
+
+/*
+ * Compact orders KCOMPACTD_MIN_ORDER to KCOMPACTD_MAX_ORDER, widened to
+ * include @demand_order if an allocation of that order woke us up.
+ * Returns true if anything was left fragmented.
+ */
+static bool kcompactd_do_work(int demand_order)
+{
+	struct zone *zone;
+	bool fragmented = false;
+	int order, min_order, max_order;
+
+	min_order = KCOMPACTD_MIN_ORDER;
+	max_order = KCOMPACTD_MAX_ORDER;
+	if (demand_order) {
+		min_order = min(min_order, demand_order);
+		max_order = max(max_order, demand_order);
+	}
+
+	count_vm_event(KCOMPACTD_WAKE);
+	lru_add_drain();
+
+	for_each_populated_zone(zone) {
+		for (order = max_order; order >= min_order; order--) {
+			unsigned long status;
+
+			if (kthread_should_stop())
+				return false;
+			if (!kcompactd_zone_fragmented(zone, order))
+				continue;
+
+			status = compact_zone_order(zone, order,
+						    GFP_HIGHUSER_MOVABLE, false);
+			if (status == COMPACT_SKIPPED)
+				continue;	/* too little free memory */
+
+			if (kcompactd_zone_fragmented(zone, order)) {
+				count_vm_event(KCOMPACTD_FAIL);
+				fragmented = true;
+			} else
+				count_vm_event(KCOMPACTD_SUCCESS);
+			cond_resched();
+		}
+	}
+	return fragmented;
+}
+
+static int kcompactd(void *unused)
+{
+	set_freezable();
+	set_user_nice(current, 19);
+
+	while (!kthread_should_stop()) {
+		bool demand;
+		int demand_order;
+
+		wait_event_freezable(kcompactd_wait, kcompactd_pending ||
+				     kthread_should_stop());
+		if (kthread_should_stop())
+			break;
+		kcompactd_pending = false;
+		demand = kcompactd_demand;
+		demand_order = kcompactd_demand_order;
+		kcompactd_demand_order = 0;
+
+		/* periodic checks only use otherwise idle time */
+		if (demand || nr_running() <= num_online_cpus()) {
+			if (kcompactd_do_work(demand_order)) {
+				if (kcompactd_backoff < KCOMPACTD_MAX_BACKOFF)
+					kcompactd_backoff++;
+			} else
+				kcompactd_backoff = 0;
+		}
+		kcompactd_demand = false;
+		kcompactd_arm_timer();
+	}
+	return 0;
+}
+
+int sysctl_kcompactd_interval_handler(struct ctl_table *table, int write,
+			void __user *buffer, size_t *length, loff_t *ppos)
+{
+	int ret;
+
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (!ret && write && kcompactd_task) {
+		kcompactd_backoff = 0;
+		kcompactd_arm_timer();
+	}
+	return ret;
+}
+
+static int __init kcompactd_init(void)
+{
+	struct task_struct *task;
+
+	init_timer_deferrable(&kcompactd_timer);
+	kcompactd_timer.function = kcompactd_timer_fn;
+	task = kthread_run(kcompactd, NULL, "kcompactd");
+	if (IS_ERR(task)) {
+		pr_err("Failed to start kcompactd\n");
+		return PTR_ERR(task);
+	}
+	kcompactd_task = task;
+	kcompactd_arm_timer();
+	return 0;
+}
+module_init(kcompactd_init)
+
 /* The written value is actually unused, all memory is compacted */
 int sysctl_compact_memory;
 
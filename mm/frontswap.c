@@ -0,0 +1,192 @@
+/*
+ * Frontswap frontend
+ *
+ * This code provides the generic "frontend" layer to call a matching
+ * "backend" driver implementation of frontswap: a synchronous store for
+ * swap pages, such as zcache's compressed RAM, that swap_writepage and
+ * swap_readpage try before any block I/O is set up.  Pages the backend
+ * refuses are written to the swap device as usual.
+ *
+ * Modelled on the cleancache frontend, mm/cleancache.c.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/frontswap.h>
+
+/*
+ * Like cleancache_enabled, read on every swap page I/O, so a global
+ * variable rather than a check of frontswap_ops.
+ */
+int frontswap_enabled;
+EXPORT_SYMBOL(frontswap_enabled);
+
+/*
+ * frontswap_ops is set by frontswap_register_ops to contain the pointers
+ * to the frontswap "backend" implementation functions.
+ */
+static struct frontswap_ops frontswap_ops;
+
+/* useful stats available in /sys/kernel/mm/frontswap */
+static unsigned long frontswap_succ_puts;
+static unsigned long frontswap_failed_puts;
+static unsigned long frontswap_gets;
+static unsigned long frontswap_flushes;
+
+/*
+ * register operations for frontswap, returning previous thus allowing
+ * detection of multiple backends and possible nesting
+ */
+struct frontswap_ops frontswap_register_ops(struct frontswap_ops *ops)
+{
+	struct frontswap_ops old = frontswap_ops;
+
+	frontswap_ops = *ops;
+	frontswap_enabled = 1;
+	return old;
+}
+EXPORT_SYMBOL(frontswap_register_ops);
+
+/* Called when a swap device is swapon'd, before any page is put to it */
+void __frontswap_init(unsigned type)
+{
+	(*frontswap_ops.init)(type);
+}
+EXPORT_SYMBOL(__frontswap_init);
+
+/*
+ * "Put" data from a page to frontswap and associate it with the page's
+ * swaptype and offset.  Page must be locked and in the swap cache.
+ * If frontswap already contains a page with matching swaptype and
+ * offset, the frontswap implementation may either overwrite the data and
+ * return success or flush the page from frontswap and return failure.
+ */
+int __frontswap_put_page(struct page *page)
+{
+	int ret = -1, dup = 0;
+	swp_entry_t entry = { .val = page_private(page), };
+	int type = swp_type(entry);
+	struct swap_info_struct *sis = page_swap_info(page);
+	pgoff_t offset = swp_offset(entry);
+
+	BUG_ON(!PageLocked(page));
+	if (!frontswap_map_get(sis))
+		return ret;	/* swapon'd before the backend registered */
+	if (frontswap_test(sis, offset))
+		dup = 1;
+	ret = (*frontswap_ops.put_page)(type, offset, page);
+	if (ret == 0) {
+		frontswap_set(sis, offset);
+		frontswap_succ_puts++;
+		if (!dup)
+			atomic_inc(&sis->frontswap_pages);
+	} else {
+		/* a failed dup always drops the older copy from frontswap */
+		if (dup) {
+			frontswap_clear(sis, offset);
+			atomic_dec(&sis->frontswap_pages);
+		}
+		frontswap_failed_puts++;
+	}
+	return ret;
+}
+EXPORT_SYMBOL(__frontswap_put_page);
+
+/*
+ * "Get" data from frontswap associated with swaptype and offset that were
+ * specified when the data was put to frontswap and use it to fill the
+ * specified page with data.  Page must be locked and in the swap cache.
+ */
+int __frontswap_get_page(struct page *page)
+{
+	int ret = -1;
+	swp_entry_t entry = { .val = page_private(page), };
+	int type = swp_type(entry);
+	struct swap_info_struct *sis = page_swap_info(page);
+	pgoff_t offset = swp_offset(entry);
+
+	BUG_ON(!PageLocked(page));
+	if (frontswap_test(sis, offset))
+		ret = (*frontswap_ops.get_page)(type, offset, page);
+	if (ret == 0)
+		frontswap_gets++;
+	return ret;
+}
+EXPORT_SYMBOL(__frontswap_get_page);
+
+/*
+ * Flush any data from frontswap associated with the specified swaptype
+ * and offset so that a subsequent "get" will fail.  Called with swap_lock
+ * held when the swap entry is freed.
+ */
+void __frontswap_flush_page(struct swap_info_struct *sis, pgoff_t offset)
+{
+	if (frontswap_test(sis, offset)) {
+		(*frontswap_ops.flush_page)(sis->type, offset);
+		atomic_dec(&sis->frontswap_pages);
+		frontswap_clear(sis, offset);
+		frontswap_flushes++;
+	}
+}
+EXPORT_SYMBOL(__frontswap_flush_page);
+
+/*
+ * Flush all data from frontswap associated with all offsets for the
+ * specified swaptype.  Called at swapoff, once nothing uses the area.
+ */
+void __frontswap_flush_area(struct swap_info_struct *sis)
+{
+	(*frontswap_ops.flush_area)(sis->type);
+	atomic_set(&sis->frontswap_pages, 0);
+	bitmap_zero(sis->frontswap_map, sis->max);
+}
+EXPORT_SYMBOL(__frontswap_flush_area);
+
+#ifdef CONFIG_SYSFS
+
+/* see Documentation/ABI/xxx/sysfs-kernel-mm-frontswap */
+
+#define FRONTSWAP_SYSFS_RO(_name) \
+	static ssize_t frontswap_##_name##_show(struct kobject *kobj, \
+				struct kobj_attribute *attr, char *buf) \
+	{ \
+		return sprintf(buf, "%lu\n", frontswap_##_name); \
+	} \
+	static struct kobj_attribute frontswap_##_name##_attr = { \
+		.attr = { .name = __stringify(_name), .mode = 0444 }, \
+		.show = frontswap_##_name##_show, \
+	}
+
+FRONTSWAP_SYSFS_RO(succ_puts);
+FRONTSWAP_SYSFS_RO(failed_puts);
+FRONTSWAP_SYSFS_RO(gets);
+FRONTSWAP_SYSFS_RO(flushes);
+
+static struct attribute *frontswap_attrs[] = {
+	&frontswap_succ_puts_attr.attr,
+	&frontswap_failed_puts_attr.attr,
+	&frontswap_gets_attr.attr,
+	&frontswap_flushes_attr.attr,
+	NULL,
+};
+
+static struct attribute_group frontswap_attr_group = {
+	.attrs = frontswap_attrs,
+	.name = "frontswap",
+};
+
+#endif /* CONFIG_SYSFS */
+
+static int __init init_frontswap(void)
+{
+#ifdef CONFIG_SYSFS
+	if (sysfs_create_group(mm_kobj, &frontswap_attr_group))
+		pr_err("frontswap: can't create sysfs\n");
+#endif /* CONFIG_SYSFS */
+	return 0;
+}
+module_init(init_frontswap)
@@ -36,6 +36,7 @@
 #include <linux/hashtable.h>
 #include <linux/freezer.h>
 #include <linux/oom.h>
+#include <linux/earlysuspend.h>
 
 #include <asm/tlbflush.h>
 #include "internal.h"
@@ -188,6 +189,35 @@ static unsigned int ksm_thread_pages_to_scan = 256;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 1000;
 
+/*
+ * When adaptive, ksmd scans up to pages_to_scan_max pages per batch while
+ * merging pays off, and backs off towards sleep_millisecs_max when it does
+ * not; pages_to_scan and sleep_millisecs are then the lower bounds.
+ */
+static unsigned int ksm_thread_adaptive = 1;
+static unsigned int ksm_thread_pages_to_scan_max = 2048;
+static unsigned int ksm_thread_sleep_millisecs_max = 20000;
+
+/* Percentage of one cpu ksmd may use when adaptive, 0 for no limit */
+static unsigned int ksm_thread_cpu_budget = 5;
+
+/* Full speed for this long after an area was madvised MADV_MERGEABLE */
+#define KSM_BOOST_MSECS	5000
+
+/* What the last batch chose, and the merge yield (permille) it saw */
+static unsigned int ksm_cur_pages_to_scan = 256;
+static unsigned int ksm_cur_sleep_millisecs = 1000;
+static unsigned int ksm_scan_yield;
+
+/* Cpu time ksmd has spent scanning, in nanoseconds */
+static u64 ksm_scan_ns;
+
+static unsigned long ksm_boost_until;
+static bool ksm_thread_kicked;
+
+/* Set while the screen is off: ksmd does not scan then */
+static bool ksm_suspended;
+
 #define KSM_RUN_STOP	0
 #define KSM_RUN_MERGE	1
 #define KSM_RUN_UNMERGE	2
@@ -534,6 +564,7 @@ static void remove_rmap_item_from_tree(struct rmap_item *rmap_item)
 			ksm_pages_sharing--;
 		else
 			ksm_pages_shared--;
+		rmap_item->mm->ksm_merging_pages--;
 
 		put_anon_vma(rmap_item->anon_vma);
 		rmap_item->address &= PAGE_MASK;
@@ -1151,6 +1182,7 @@ static void stable_tree_append(struct rmap_item *rmap_item,
 		ksm_pages_sharing++;
 	else
 		ksm_pages_shared++;
+	rmap_item->mm->ksm_merging_pages++;
 }
 
 /*
@@ -1401,43 +1433,112 @@ next_mm:
  * ksm_do_scan  - the ksm scanner main worker function.
  * @scan_npages - number of pages we want to scan before we return.
  */
-static void ksm_do_scan(unsigned int scan_npages)
+static unsigned int ksm_do_scan(unsigned int scan_npages)
 {
 	struct rmap_item *rmap_item;
 	struct page *uninitialized_var(page);
+	unsigned int scanned = 0;
+	u64 start, delta;
 
 	while (scan_npages-- && likely(!freezing(current))) {
 		cond_resched();
+		start = local_clock();
 		rmap_item = scan_get_next_rmap_item(&page);
 		if (!rmap_item)
-			return;
+			break;
 		if (!PageKsm(page) || !in_stable_tree(rmap_item))
 			cmp_and_merge_page(page, rmap_item);
 		put_page(page);
+
+		/* the mm_slot holds a reference on rmap_item->mm */
+		delta = local_clock() - start;
+		rmap_item->mm->ksm_scan_ns += delta;
+		rmap_item->mm->ksm_scanned_pages++;
+		ksm_scan_ns += delta;
+		scanned++;
 	}
+	return scanned;
+}
+
+/*
+ * ksm_adapt - choose the size of the next batch and the sleep before it,
+ * from how many pages the last batch merged and how long it took.
+ */
+static void ksm_adapt(unsigned int scanned, long merged, u64 ns)
+{
+	unsigned int yield = 0, pages, msecs, budget;
+	unsigned int pages_max, msecs_max;
+	u64 min_msecs;
+
+	if (scanned && merged > 0)
+		yield = min_t(unsigned long, merged * 1000 / scanned, 1000);
+	ksm_scan_yield = (3 * ksm_scan_yield + yield) / 4;
+
+	pages = ksm_thread_pages_to_scan;
+	msecs = ksm_thread_sleep_millisecs;
+	if (!ksm_thread_adaptive)
+		goto out;
+
+	pages_max = max(ksm_thread_pages_to_scan_max, pages);
+	msecs_max = max(ksm_thread_sleep_millisecs_max, msecs);
+
+	if (time_before(jiffies, ksm_boost_until)) {
+		pages = pages_max;
+	} else if (ksm_scan_yield) {
+		/* a yield of 10% or more is worth scanning at full speed */
+		pages += (pages_max - pages) *
+			 min(ksm_scan_yield, 100U) / 100;
+	} else {
+		/* nothing merges: back off, doubling the sleep each time */
+		msecs = clamp(ksm_cur_sleep_millisecs * 2, msecs, msecs_max);
+	}
+
+	/* sleep long enough that the scanning stays within the budget */
+	budget = ksm_thread_cpu_budget;
+	if (budget && budget < 100) {
+		min_msecs = div_u64(ns * (100 - budget), budget * NSEC_PER_MSEC);
+		if (min_msecs > msecs)
+			msecs = min_t(u64, min_msecs, msecs_max);
+	}
+out:
+	ksm_cur_pages_to_scan = pages;
+	ksm_cur_sleep_millisecs = msecs;
 }
 
 static int ksmd_should_run(void)
 {
-	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
+	return (ksm_run & KSM_RUN_MERGE) && !ksm_suspended &&
+		!list_empty(&ksm_mm_head.mm_list);
 }
 
 static int ksm_scan_thread(void *nothing)
 {
+	unsigned long sharing;
+	unsigned int scanned;
+	u64 ns;
+
 	set_freezable();
 	set_user_nice(current, 5);
 
 	while (!kthread_should_stop()) {
 		mutex_lock(&ksm_thread_mutex);
-		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
+		if (ksmd_should_run()) {
+			sharing = ksm_pages_sharing;
+			ns = ksm_scan_ns;
+			scanned = ksm_do_scan(ksm_cur_pages_to_scan);
+			ksm_adapt(scanned, (long)(ksm_pages_sharing - sharing),
+				  ksm_scan_ns - ns);
+		}
 		mutex_unlock(&ksm_thread_mutex);
 
 		try_to_freeze();
 
 		if (ksmd_should_run()) {
-			schedule_timeout_interruptible(
-				msecs_to_jiffies(ksm_thread_sleep_millisecs));
+			ksm_thread_kicked = false;
+			wait_event_freezable_timeout(ksm_thread_wait,
+				ksm_thread_kicked || !ksmd_should_run() ||
+				kthread_should_stop(),
+				msecs_to_jiffies(ksm_cur_sleep_millisecs));
 		} else {
 			wait_event_freezable(ksm_thread_wait,
 				ksmd_should_run() || kthread_should_stop());
@@ -1446,6 +1547,28 @@ static int ksm_scan_thread(void *nothing)
 	return 0;
 }
 
+/*
+ * An area was just madvised MADV_MERGEABLE: this is usually an app that
+ * has just started and is about to fill it, so scan its mm next, and scan
+ * at full speed for a while when adaptive.
+ */
+static void ksm_madvised(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+
+	spin_lock(&ksm_mmlist_lock);
+	mm_slot = get_mm_slot(mm);
+	if (mm_slot && mm_slot != ksm_scan.mm_slot)
+		list_move(&mm_slot->mm_list, &ksm_scan.mm_slot->mm_list);
+	spin_unlock(&ksm_mmlist_lock);
+
+	if (ksm_thread_adaptive) {
+		ksm_boost_until = jiffies + msecs_to_jiffies(KSM_BOOST_MSECS);
+		ksm_thread_kicked = true;
+		wake_up_interruptible(&ksm_thread_wait);
+	}
+}
+
 int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 		unsigned long end, int advice, unsigned long *vm_flags)
 {
@@ -1468,6 +1591,7 @@ int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
 			if (err)
 				return err;
 		}
+		ksm_madvised(mm);
 
 		*vm_flags |= VM_MERGEABLE;
 		break;
@@ -1838,6 +1962,8 @@ static ssize_t sleep_millisecs_store(struct kobject *kobj,
 		return -EINVAL;
 
 	ksm_thread_sleep_millisecs = msecs;
+	if (!ksm_thread_adaptive)
+		ksm_cur_sleep_millisecs = msecs;
 
 	return count;
 }
@@ -1861,11 +1987,70 @@ static ssize_t pages_to_scan_store(struct kobject *kobj,
 		return -EINVAL;
 
 	ksm_thread_pages_to_scan = nr_pages;
+	if (!ksm_thread_adaptive)
+		ksm_cur_pages_to_scan = nr_pages;
 
 	return count;
 }
 KSM_ATTR(pages_to_scan);
 
+/* show and store for a plain unsigned int tunable of the adaptive scan */
+#define KSM_ADAPT_ATTR(_name, _var, _max)				\
+static ssize_t _name##_show(struct kobject *kobj,			\
+			    struct kobj_attribute *attr, char *buf)	\
+{									\
+	return sprintf(buf, "%u\n", _var);				\
+}									\
+static ssize_t _name##_store(struct kobject *kobj,			\
+			     struct kobj_attribute *attr,		\
+			     const char *buf, size_t count)		\
+{									\
+	unsigned long val;						\
+	int err;							\
+									\
+	err = strict_strtoul(buf, 10, &val);				\
+	if (err || val > (_max))					\
+		return -EINVAL;						\
+									\
+	_var = val;							\
+	return count;							\
+}									\
+KSM_ATTR(_name)
+
+KSM_ADAPT_ATTR(adaptive, ksm_thread_adaptive, 1);
+KSM_ADAPT_ATTR(pages_to_scan_max, ksm_thread_pages_to_scan_max, UINT_MAX);
+KSM_ADAPT_ATTR(sleep_millisecs_max, ksm_thread_sleep_millisecs_max, UINT_MAX);
+KSM_ADAPT_ATTR(cpu_budget, ksm_thread_cpu_budget, 100);
+
+static ssize_t cur_pages_to_scan_show(struct kobject *kobj,
+				      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_cur_pages_to_scan);
+}
+KSM_ATTR_RO(cur_pages_to_scan);
+
+static ssize_t cur_sleep_millisecs_show(struct kobject *kobj,
+					struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_cur_sleep_millisecs);
+}
+KSM_ATTR_RO(cur_sleep_millisecs);
+
+static ssize_t scan_yield_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_scan_yield);
+}
+KSM_ATTR_RO(scan_yield);
+
+static ssize_t scan_cpu_msecs_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%llu\n",
+		       (unsigned long long)div_u64(ksm_scan_ns, NSEC_PER_MSEC));
+}
+KSM_ATTR_RO(scan_cpu_msecs);
+
 static ssize_t run_show(struct kobject *kobj, struct kobj_attribute *attr,
 			char *buf)
 {
@@ -1964,6 +2149,14 @@ KSM_ATTR_RO(full_scans);
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
+	&adaptive_attr.attr,
+	&pages_to_scan_max_attr.attr,
+	&sleep_millisecs_max_attr.attr,
+	&cpu_budget_attr.attr,
+	&cur_pages_to_scan_attr.attr,
+	&cur_sleep_millisecs_attr.attr,
+	&scan_yield_attr.attr,
+	&scan_cpu_msecs_attr.attr,
 	&run_attr.attr,
 	&pages_shared_attr.attr,
 	&pages_sharing_attr.attr,
@@ -1979,6 +2172,26 @@ static struct attribute_group ksm_attr_group = {
 };
 #endif /* CONFIG_SYSFS */
 
+#ifdef CONFIG_HAS_EARLYSUSPEND
+/* Nothing that is worth merging happens while the screen is off. */
+static void ksm_early_suspend(struct early_suspend *h)
+{
+	ksm_suspended = true;
+}
+
+static void ksm_late_resume(struct early_suspend *h)
+{
+	ksm_suspended = false;
+	wake_up_interruptible(&ksm_thread_wait);
+}
+
+static struct early_suspend ksm_early_suspend_desc = {
+	.level = EARLY_SUSPEND_LEVEL_DISABLE_FB,
+	.suspend = ksm_early_suspend,
+	.resume = ksm_late_resume,
+};
+#endif
+
 static int __init ksm_init(void)
 {
 	struct task_struct *ksm_thread;
@@ -2014,6 +2227,7 @@ static int __init ksm_init(void)
 	 */
 	hotplug_memory_notifier(ksm_memory_callback, 100);
 #endif
+	register_early_suspend(&ksm_early_suspend_desc);
 	return 0;
 
 out_free:
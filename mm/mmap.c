@@ -1315,6 +1315,8 @@ munmap_back:
 
 	vma_link(mm, vma, prev, rb_link, rb_parent);
 	file = vma->vm_file;
+	if (file)
+		readahead_pattern_replay(file);
 
 	/* Once vma denies write, undo our temporary denial count */
 	if (correct_wcount)
@@ -0,0 +1,559 @@
+/*
+ * mm/readahead_pattern.c - record file access patterns, replay them later
+ *
+ * Launching an app mostly faults in scattered pages of its APK and dex
+ * files, each fault a small synchronous read that readahead cannot
+ * predict.  But the pages needed are nearly the same on every start.
+ *
+ * While recording (vm.readahead_record_secs), every page of an APK, dex
+ * or library file that is read or faulted in is noted.  The result can
+ * be read from /proc/readahead_pattern, one line per run of pages:
+ *
+ *	<path> <first page> <number of pages>
+ *
+ * Writing such lines back (e.g. from init, early in the next boot)
+ * loads them for replay: the first open or mmap of a file with a
+ * pattern then reads all of its pages with one batched, asynchronous
+ * readahead, and the pattern is dropped.
+ *
+ * Storing the pattern between boots is up to userspace.
+ *
+ * Licensed under the GPL-2.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/slab.h>
+#include <linux/dcache.h>
+#include <linux/hash.h>
+#include <linux/file.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
+#include <linux/blkdev.h>
+#include <linux/sysctl.h>
+#include <linux/uaccess.h>
+
+#define RA_PATTERN_HASH_BITS	8
+#define RA_PATTERN_MAX_FILES	1024
+/* pages beyond this offset are not recorded: 256MB */
+#define RA_PATTERN_MAX_PAGES	(256UL << (20 - PAGE_CACHE_SHIFT))
+#define RA_PATTERN_LINE_MAX	(PATH_MAX + 48)
+
+bool ra_pattern_recording __read_mostly;
+unsigned int ra_pattern_pending __read_mostly;
+int sysctl_readahead_record_secs;
+
+static const char * const ra_pattern_suffixes[] = {
+	".apk", ".dex", ".odex", ".jar", ".so",
+};
+
+/* pages accessed in one file while recording */
+struct ra_record {
+	struct hlist_node	hash;
+	dev_t			dev;
+	unsigned long		ino;
+	unsigned long		nr_pages;	/* bits in bitmap */
+	char			*path;
+	unsigned long		bitmap[0];
+};
+
+struct ra_range {
+	pgoff_t			start;
+	unsigned long		nr;
+};
+
+/* a loaded pattern, waiting for its file to be opened */
+struct ra_replay {
+	struct hlist_node	hash;
+	unsigned int		nr_ranges;
+	unsigned int		max_ranges;
+	struct ra_range		*ranges;
+	char			path[0];
+};
+
+struct ra_replay_work {
+	struct work_struct	work;
+	struct file		*file;
+	struct ra_replay	*replay;
+};
+
+/* ra_record_lock protects ra_records, ra_pattern_mutex ra_replays */
+static DEFINE_SPINLOCK(ra_record_lock);
+static struct hlist_head ra_records[1 << RA_PATTERN_HASH_BITS];
+static unsigned int ra_nr_records;
+static DEFINE_MUTEX(ra_pattern_mutex);
+static struct hlist_head ra_replays[1 << RA_PATTERN_HASH_BITS];
+
+static void ra_record_stop(struct work_struct *work)
+{
+	ra_pattern_recording = false;
+	sysctl_readahead_record_secs = 0;
+}
+static DECLARE_DELAYED_WORK(ra_record_stop_work, ra_record_stop);
+
+static bool ra_pattern_wanted(struct file *file)
+{
+	const struct qstr *name = &file->f_path.dentry->d_name;
+	int i;
+
+	if (!S_ISREG(file->f_mapping->host->i_mode))
+		return false;
+	for (i = 0; i < ARRAY_SIZE(ra_pattern_suffixes); i++) {
+		unsigned int len = strlen(ra_pattern_suffixes[i]);
+
+		if (name->len > len &&
+		    !memcmp(name->name + name->len - len,
+			    ra_pattern_suffixes[i], len))
+			return true;
+	}
+	return false;
+}
+
+/* Returns the path of @file in a kmalloc()ed buffer, or NULL. */
+static char *ra_pattern_path(struct file *file)
+{
+	char *buf, *path;
+
+	buf = (char *)__get_free_page(GFP_KERNEL);
+	if (!buf)
+		return NULL;
+	path = d_path(&file->f_path, buf, PAGE_SIZE);
+	path = IS_ERR(path) ? NULL : kstrdup(path, GFP_KERNEL);
+	free_page((unsigned long)buf);
+	return path;
+}
+
+static struct hlist_head *ra_record_bucket(dev_t dev, unsigned long ino)
+{
+	return &ra_records[hash_long(ino ^ dev, RA_PATTERN_HASH_BITS)];
+}
+
+static struct ra_record *ra_record_find(struct inode *inode)
+{
+	struct hlist_node *node;
+	struct ra_record *rec;
+
+	hlist_for_each_entry(rec, node,
+			     ra_record_bucket(inode->i_sb->s_dev, inode->i_ino),
+			     hash)
+		if (rec->ino == inode->i_ino && rec->dev == inode->i_sb->s_dev)
+			return rec;
+	return NULL;
+}
+
+static void ra_record_free(struct ra_record *rec)
+{
+	kfree(rec->path);
+	kfree(rec);
+}
+
+static struct ra_record *ra_record_alloc(struct file *file)
+{
+	struct inode *inode = file->f_mapping->host;
+	struct ra_record *rec;
+	unsigned long nr_pages;
+
+	nr_pages = DIV_ROUND_UP(i_size_read(inode), PAGE_CACHE_SIZE);
+	nr_pages = min(nr_pages, RA_PATTERN_MAX_PAGES);
+	rec = kzalloc(sizeof(*rec) + BITS_TO_LONGS(nr_pages) * sizeof(long),
+		      GFP_KERNEL);
+	if (!rec)
+		return NULL;
+	rec->path = ra_pattern_path(file);
+	if (!rec->path) {
+		kfree(rec);
+		return NULL;
+	}
+	rec->dev = inode->i_sb->s_dev;
+	rec->ino = inode->i_ino;
+	rec->nr_pages = nr_pages;
+	return rec;
+}
+
+/*
+ * __readahead_pattern_access - note an access to page @index of @file
+ *
+ * Called from the read and fault paths while recording.
+ */
+void __readahead_pattern_access(struct file *file, pgoff_t index)
+{
+	struct inode *inode = file->f_mapping->host;
+	struct ra_record *rec;
+
+	if (!ra_pattern_wanted(file))
+		return;
+
+	spin_lock(&ra_record_lock);
+	rec = ra_record_find(inode);
+	if (rec && index < rec->nr_pages)
+		__set_bit(index, rec->bitmap);
+	spin_unlock(&ra_record_lock);
+	if (rec || ACCESS_ONCE(ra_nr_records) >= RA_PATTERN_MAX_FILES)
+		return;
+
+	rec = ra_record_alloc(file);
+	if (!rec)
+		return;
+	spin_lock(&ra_record_lock);
+	if (ra_pattern_recording && ra_nr_records < RA_PATTERN_MAX_FILES &&
+	    !ra_record_find(inode)) {
+		hlist_add_head(&rec->hash,
+			       ra_record_bucket(rec->dev, rec->ino));
+		ra_nr_records++;
+		if (index < rec->nr_pages)
+			__set_bit(index, rec->bitmap);
+		rec = NULL;
+	}
+	spin_unlock(&ra_record_lock);
+	if (rec)
+		ra_record_free(rec);
+}
+
+static void ra_records_clear(void)
+{
+	struct hlist_head list = HLIST_HEAD_INIT;
+	struct hlist_node *node, *tmp;
+	struct ra_record *rec;
+	int i;
+
+	spin_lock(&ra_record_lock);
+	for (i = 0; i < ARRAY_SIZE(ra_records); i++) {
+		hlist_for_each_entry_safe(rec, node, tmp, &ra_records[i],
+					  hash) {
+			hlist_del(&rec->hash);
+			hlist_add_head(&rec->hash, &list);
+		}
+	}
+	ra_nr_records = 0;
+	spin_unlock(&ra_record_lock);
+
+	hlist_for_each_entry_safe(rec, node, tmp, &list, hash)
+		ra_record_free(rec);
+}
+
+int readahead_record_sysctl_handler(ctl_table *table, int write,
+				    void __user *buffer, size_t *length,
+				    loff_t *ppos)
+{
+	int ret;
+
+	ret = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (ret || !write)
+		return ret;
+
+	mutex_lock(&ra_pattern_mutex);
+	cancel_delayed_work_sync(&ra_record_stop_work);
+	if (sysctl_readahead_record_secs > 0) {
+		/* a new recording starts from scratch */
+		if (!ra_pattern_recording)
+			ra_records_clear();
+		ra_pattern_recording = true;
+		schedule_delayed_work(&ra_record_stop_work,
+				      sysctl_readahead_record_secs * HZ);
+	} else
+		ra_pattern_recording = false;
+	mutex_unlock(&ra_pattern_mutex);
+	return 0;
+}
+
+static struct hlist_head *ra_replay_bucket(const char *path)
+{
+	unsigned int hash = full_name_hash(path, strlen(path));
+
+	return &ra_replays[hash_32(hash, RA_PATTERN_HASH_BITS)];
+}
+
+static struct ra_replay *ra_replay_find(const char *path)
+{
+	struct hlist_node *node;
+	struct ra_replay *replay;
+
+	hlist_for_each_entry(replay, node, ra_replay_bucket(path), hash)
+		if (!strcmp(replay->path, path))
+			return replay;
+	return NULL;
+}
+
+static void ra_replay_free(struct ra_replay *replay)
+{
+	kfree(replay->ranges);
+	kfree(replay);
+}
+
+static void ra_replay_fn(struct work_struct *work)
+{
+	struct ra_replay_work *w = container_of(work, struct ra_replay_work,
+						work);
+	struct address_space *mapping = w->file->f_mapping;
+	struct ra_replay *replay = w->replay;
+	struct blk_plug plug;
+	pgoff_t end;
+	int i;
+
+	end = DIV_ROUND_UP(i_size_read(mapping->host), PAGE_CACHE_SIZE);
+	blk_start_plug(&plug);
+	for (i = 0; i < replay->nr_ranges; i++) {
+		struct ra_range *r = &replay->ranges[i];
+
+		if (r->start >= end)
+			continue;
+		force_page_cache_readahead(mapping, w->file, r->start,
+					   min(r->nr, end - r->start));
+	}
+	blk_finish_plug(&plug);
+
+	fput(w->file);
+	ra_replay_free(replay);
+	kfree(w);
+}
+
+/*
+ * __readahead_pattern_replay - start reading @file's pattern, if any
+ *
+ * Called on open and mmap while patterns are loaded.
+ */
+void __readahead_pattern_replay(struct file *file)
+{
+	struct ra_replay_work *w;
+	struct ra_replay *replay;
+	char *path;
+
+	if (!(file->f_mode & FMODE_READ) || !ra_pattern_wanted(file))
+		return;
+	path = ra_pattern_path(file);
+	if (!path)
+		return;
+
+	mutex_lock(&ra_pattern_mutex);
+	replay = ra_replay_find(path);
+	if (replay) {
+		hlist_del(&replay->hash);
+		ra_pattern_pending--;
+	}
+	mutex_unlock(&ra_pattern_mutex);
+	kfree(path);
+	if (!replay)
+		return;
+
+	w = kmalloc(sizeof(*w), GFP_KERNEL);
+	if (!w) {
+		ra_replay_free(replay);
+		return;
+	}
+	INIT_WORK(&w->work, ra_replay_fn);
+	get_file(file);
+	w->file = file;
+	w->replay = replay;
+	queue_work(system_unbound_wq, &w->work);
+}
+
+/* Caller holds ra_pattern_mutex. */
+static int ra_replay_add(const char *path, pgoff_t start, unsigned long nr)
+{
+	struct ra_replay *replay;
+	struct ra_range *ranges;
+
+	replay = ra_replay_find(path);
+	if (!replay) {
+		if (ra_pattern_pending >= RA_PATTERN_MAX_FILES)
+			return -ENOSPC;
+		replay = kzalloc(sizeof(*replay) + strlen(path) + 1,
+				 GFP_KERNEL);
+		if (!replay)
+			return -ENOMEM;
+		strcpy(replay->path, path);
+		hlist_add_head(&replay->hash, ra_replay_bucket(path));
+		ra_pattern_pending++;
+	}
+
+	if (replay->nr_ranges == replay->max_ranges) {
+		unsigned int max = max(replay->max_ranges * 2, 16U);
+
+		ranges = krealloc(replay->ranges, max * sizeof(*ranges),
+				  GFP_KERNEL);
+		if (!ranges)
+			return -ENOMEM;
+		replay->ranges = ranges;
+		replay->max_ranges = max;
+	}
+	replay->ranges[replay->nr_ranges].start = start;
+	replay->ranges[replay->nr_ranges].nr = nr;
+	replay->nr_ranges++;
+	return 0;
+}
+
+static int ra_pattern_show(struct seq_file *m, void *v)
+{
+	struct hlist_node *node;
+	struct ra_record *rec;
+	unsigned long start, end;
+	int i;
+
+	spin_lock(&ra_record_lock);
+	for (i = 0; i < ARRAY_SIZE(ra_records); i++) {
+		hlist_for_each_entry(rec, node, &ra_records[i], hash) {
+			start = find_first_bit(rec->bitmap, rec->nr_pages);
+			while (start < rec->nr_pages) {
+				end = find_next_zero_bit(rec->bitmap,
+							 rec->nr_pages, start);
+				seq_printf(m, "%s %lu %lu\n", rec->path, start,
+					   end - start);
+				start = find_next_bit(rec->bitmap,
+						      rec->nr_pages, end);
+			}
+		}
+	}
+	spin_unlock(&ra_record_lock);
+	return 0;
+}
+
+/* partial line left over from the previous write() */
+struct ra_pattern_writer {
+	size_t			len;
+	char			buf[RA_PATTERN_LINE_MAX];
+};
+
+static int ra_pattern_parse(char *line)
+{
+	char *path, *p;
+	unsigned long start, nr;
+
+	line = strim(line);
+	if (!*line)
+		return 0;
+	/* the path is everything up to the last two fields */
+	p = strrchr(line, ' ');
+	if (!p || kstrtoul(p + 1, 10, &nr))
+		return -EINVAL;
+	*p = '\0';
+	p = strrchr(line, ' ');
+	if (!p || kstrtoul(p + 1, 10, &start))
+		return -EINVAL;
+	*p = '\0';
+	path = line;
+	if (*path != '/' || !nr || start >= RA_PATTERN_MAX_PAGES)
+		return -EINVAL;
+	return ra_replay_add(path, start, nr);
+}
+
+/*
+ * Append @len bytes to the writer's line buffer and parse every line
+ * completed by them.  Called with ra_pattern_mutex held.
+ */
+static int ra_pattern_feed(struct ra_pattern_writer *w, const char *data,
+			   size_t len)
+{
+	size_t done = 0, chunk;
+	char *nl;
+	int ret;
+
+	while (done < len) {
+		chunk = min(len - done, sizeof(w->buf) - 1 - w->len);
+		if (!chunk) {
+			/* line too long */
+			w->len = 0;
+			return -EINVAL;
+		}
+		memcpy(w->buf + w->len, data + done, chunk);
+		w->len += chunk;
+		w->buf[w->len] = '\0';
+		done += chunk;
+
+		while ((nl = strchr(w->buf, '\n'))) {
+			*nl = '\0';
+			ret = ra_pattern_parse(w->buf);
+			w->len -= nl + 1 - w->buf;
+			memmove(w->buf, nl + 1, w->len + 1);
+			if (ret)
+				return ret;
+		}
+	}
+	return 0;
+}
+
+/*
+ * The user buffer is copied in before ra_pattern_mutex is taken: mmap
+ * replays patterns under mmap_sem, and a fault on the buffer would take
+ * mmap_sem inside the mutex.
+ */
+static ssize_t ra_pattern_write(struct file *file, const char __user *ubuf,
+				size_t count, loff_t *ppos)
+{
+	struct ra_pattern_writer *w = ((struct seq_file *)
+				       file->private_data)->private;
+	size_t done = 0, chunk;
+	char *kbuf;
+	int ret = 0;
+
+	kbuf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!kbuf)
+		return -ENOMEM;
+
+	while (done < count) {
+		chunk = min_t(size_t, count - done, PAGE_SIZE);
+		if (copy_from_user(kbuf, ubuf + done, chunk)) {
+			ret = -EFAULT;
+			break;
+		}
+		mutex_lock(&ra_pattern_mutex);
+		ret = ra_pattern_feed(w, kbuf, chunk);
+		mutex_unlock(&ra_pattern_mutex);
+		if (ret)
+			break;
+		done += chunk;
+	}
+
+	kfree(kbuf);
+	return ret ? ret : count;
+}
+
+static int ra_pattern_open(struct inode *inode, struct file *file)
+{
+	struct ra_pattern_writer *w = NULL;
+	int ret;
+
+	if (file->f_mode & FMODE_WRITE) {
+		w = kzalloc(sizeof(*w), GFP_KERNEL);
+		if (!w)
+			return -ENOMEM;
+	}
+	ret = single_open(file, ra_pattern_show, w);
+	if (ret)
+		kfree(w);
+	return ret;
+}
+
+static int ra_pattern_release(struct inode *inode, struct file *file)
+{
+	struct ra_pattern_writer *w = ((struct seq_file *)
+				       file->private_data)->private;
+
+	/* a last line without newline */
+	if (w && w->len) {
+		mutex_lock(&ra_pattern_mutex);
+		ra_pattern_parse(w->buf);
+		mutex_unlock(&ra_pattern_mutex);
+	}
+	kfree(w);
+	return single_release(inode, file);
+}
+
+static const struct file_operations ra_pattern_fops = {
+	.open		= ra_pattern_open,
+	.read		= seq_read,
+	.write		= ra_pattern_write,
+	.llseek		= seq_lseek,
+	.release	= ra_pattern_release,
+};
+
+static int __init readahead_pattern_init(void)
+{
+	if (!proc_create("readahead_pattern", S_IRUSR | S_IWUSR, NULL,
+			 &ra_pattern_fops))
+		return -ENOMEM;
+	return 0;
+}
+module_init(readahead_pattern_init);
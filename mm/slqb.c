@@ -41,20 +41,27 @@ struct slqb_page {
 	union {
 		struct {
 			unsigned long	flags;		/* mandatory */
-			atomic_t	_count;		/* mandatory */
-			unsigned int	inuse;		/* Nr of objects */
-			struct kmem_cache_list *list;	/* Pointer to list */
+			struct address_space *mapping;	/* unused, NULL */
 			void		 **freelist;	/* LIFO freelist */
+			unsigned int	inuse;		/* Nr of objects */
+			atomic_t	_count;		/* mandatory */
 			union {
 				struct list_head lru;	/* misc. list */
 				struct rcu_head rcu_head; /* for rcu freeing */
 			};
+			struct kmem_cache_list *list;	/* Pointer to list */
 		};
 		struct page page;
 	};
 };
 static inline void struct_slqb_page_wrong_size(void)
-{ BUILD_BUG_ON(sizeof(struct slqb_page) != sizeof(struct page)); }
+{
+	BUILD_BUG_ON(sizeof(struct slqb_page) != sizeof(struct page));
+	BUILD_BUG_ON(offsetof(struct slqb_page, _count) !=
+		     offsetof(struct page, _count));
+	BUILD_BUG_ON(offsetof(struct slqb_page, mapping) !=
+		     offsetof(struct page, mapping));
+}
 
 #define PG_SLQB_BIT (1 << PG_slab)
 
@@ -226,11 +233,6 @@ static inline int slab_poison(struct kmem_cache *s)
 /* Internal SLQB flags */
 #define __OBJECT_POISON		0x80000000 /* Poison object */
 
-/* Not all arches define cache_line_size */
-#ifndef cache_line_size
-#define cache_line_size()	L1_CACHE_BYTES
-#endif
-
 #ifdef CONFIG_SMP
 static struct notifier_block slab_notifier;
 #endif
@@ -1107,8 +1109,175 @@ static int free_object_to_page(struct kmem_cache *s,
 }
 
 #ifdef CONFIG_SMP
-static void slab_free_to_remote(struct kmem_cache *s, struct slqb_page *page,
-				void *object, struct kmem_cache_cpu *c);
+static inline void magazine_add(struct kmem_cache *s,
+				struct slqb_magazine *mag, void *object)
+{
+	struct kmlist *r = &mag->list;
+
+	if (!r->head)
+		r->head = object;
+	else
+		set_freepointer(s, r->tail, object);
+	set_freepointer(s, object, NULL);
+	r->tail = object;
+	r->nr++;
+}
+
+/*
+ * Flush a magazine of objects back to the list from where they originate.
+ * They end up on that list's remotely freed list, and eventually we set it's
+ * remote_free_check if there are enough objects on it.
+ *
+ * This seems convoluted, but it keeps is from stomping on the target CPU's
+ * fastpath cachelines.
+ *
+ * Must be called with interrupts disabled.
+ */
+static void flush_magazine(struct kmem_cache *s, struct kmem_cache_cpu *c,
+				struct slqb_magazine *mag)
+{
+	struct kmlist *src;
+	struct kmem_cache_list *dst;
+	unsigned int nr;
+	int set;
+
+	src = &mag->list;
+	nr = src->nr;
+	if (unlikely(!nr))
+		return;
+
+#ifdef CONFIG_SLQB_STATS
+	{
+		struct kmem_cache_list *l = &c->list;
+
+		slqb_stat_inc(l, FLUSH_RFREE_LIST);
+		slqb_stat_add(l, FLUSH_RFREE_LIST_OBJECTS, nr);
+	}
+#endif
+
+	dst = mag->dst;
+
+	/*
+	 * Less common case, dst is filling up so free synchronously.
+	 * No point in having remote CPU free thse as it will just
+	 * free them back to the page list anyway.
+	 */
+	if (unlikely(dst->remote_free.list.nr > (slab_hiwater(s) >> 1))) {
+		void **head;
+
+		head = src->head;
+		spin_lock(&dst->page_lock);
+		do {
+			struct slqb_page *page;
+			void **object;
+
+			object = head;
+			VM_BUG_ON(!object);
+			head = get_freepointer(s, object);
+			page = virt_to_head_slqb_page(object);
+
+			free_object_to_page(s, dst, page, object);
+			nr--;
+		} while (nr);
+		spin_unlock(&dst->page_lock);
+
+		src->head = NULL;
+		src->tail = NULL;
+		src->nr = 0;
+
+		return;
+	}
+
+	spin_lock(&dst->remote_free.lock);
+
+	if (!dst->remote_free.list.head)
+		dst->remote_free.list.head = src->head;
+	else
+		set_freepointer(s, dst->remote_free.list.tail, src->head);
+	dst->remote_free.list.tail = src->tail;
+
+	src->head = NULL;
+	src->tail = NULL;
+	src->nr = 0;
+
+	if (dst->remote_free.list.nr < slab_freebatch(s))
+		set = 1;
+	else
+		set = 0;
+
+	dst->remote_free.list.nr += nr;
+
+	if (unlikely(dst->remote_free.list.nr >= slab_freebatch(s) && set))
+		dst->remote_free_check = 1;
+
+	spin_unlock(&dst->remote_free.lock);
+}
+
+/*
+ * Flush all of this CPU's magazines.
+ *
+ * Must be called with interrupts disabled.
+ */
+static void flush_remote_free_cache(struct kmem_cache *s,
+				struct kmem_cache_cpu *c)
+{
+	int i;
+
+	for (i = 0; i < SLQB_NR_MAGAZINES; i++)
+		flush_magazine(s, c, &c->mag[i]);
+}
+
+/*
+ * Flush the magazines that have collected a batch of objects.
+ *
+ * Must be called with interrupts disabled.
+ */
+static void flush_full_magazines(struct kmem_cache *s,
+				struct kmem_cache_cpu *c)
+{
+	int i;
+
+	for (i = 0; i < SLQB_NR_MAGAZINES; i++) {
+		if (c->mag[i].list.nr >= slab_freebatch(s))
+			flush_magazine(s, c, &c->mag[i]);
+	}
+}
+
+/*
+ * Find the magazine collecting objects for dst. If there is none, take an
+ * empty one, or else flush one early and reuse it; but if can_flush is not
+ * set (the caller holds a page_lock), return NULL instead.
+ *
+ * Must be called with interrupts disabled.
+ */
+static struct slqb_magazine *get_magazine(struct kmem_cache *s,
+				struct kmem_cache_cpu *c,
+				struct kmem_cache_list *dst, int can_flush)
+{
+	struct slqb_magazine *mag, *empty = NULL;
+	int i;
+
+	for (i = 0; i < SLQB_NR_MAGAZINES; i++) {
+		mag = &c->mag[i];
+		if (mag->dst == dst)
+			return mag;
+		if (!mag->list.nr && !empty)
+			empty = mag;
+	}
+	if (empty) {
+		empty->dst = dst;
+		return empty;
+	}
+	if (!can_flush)
+		return NULL;
+
+	mag = &c->mag[c->mag_victim];
+	c->mag_victim = (c->mag_victim + 1) % SLQB_NR_MAGAZINES;
+	flush_magazine(s, c, mag);
+	slqb_stat_inc(&c->list, FLUSH_RFREE_MAGAZINE);
+	mag->dst = dst;
+	return mag;
+}
 #endif
 
 /*
@@ -1126,6 +1295,10 @@ static void flush_free_list(struct kmem_cache *s, struct kmem_cache_list *l)
 	void **head;
 	int nr;
 	int locked = 0;
+#ifdef CONFIG_SMP
+	struct kmem_cache_cpu *c = get_cpu_slab(s, smp_processor_id());
+	struct slqb_magazine *mag;
+#endif
 
 	nr = l->freelist.nr;
 	if (unlikely(!nr))
@@ -1150,16 +1323,18 @@ static void flush_free_list(struct kmem_cache *s, struct kmem_cache_list *l)
 
 #ifdef CONFIG_SMP
 		if (page->list != l) {
-			struct kmem_cache_cpu *c;
-
-			if (locked) {
+			/*
+			 * Collect it without dropping page_lock, unless every
+			 * magazine is busy with another list. Full magazines
+			 * are handed over in one go below.
+			 */
+			mag = get_magazine(s, c, page->list, !locked);
+			if (unlikely(!mag)) {
 				spin_unlock(&l->page_lock);
 				locked = 0;
+				mag = get_magazine(s, c, page->list, 1);
 			}
-
-			c = get_cpu_slab(s, smp_processor_id());
-
-			slab_free_to_remote(s, page, object, c);
+			magazine_add(s, mag, object);
 			slqb_stat_inc(l, FLUSH_FREE_LIST_REMOTE);
 		} else
 #endif
@@ -1180,6 +1355,10 @@ static void flush_free_list(struct kmem_cache *s, struct kmem_cache_list *l)
 	l->freelist.head = head;
 	if (!l->freelist.nr)
 		l->freelist.tail = NULL;
+
+#ifdef CONFIG_SMP
+	flush_full_magazines(s, c);
+#endif
 }
 
 static void flush_free_list_all(struct kmem_cache *s, struct kmem_cache_list *l)
@@ -1610,96 +1789,6 @@ EXPORT_SYMBOL(kmem_cache_alloc_node);
 #endif
 
 #ifdef CONFIG_SMP
-/*
- * Flush this CPU's remote free list of objects back to the list from where
- * they originate. They end up on that list's remotely freed list, and
- * eventually we set it's remote_free_check if there are enough objects on it.
- *
- * This seems convoluted, but it keeps is from stomping on the target CPU's
- * fastpath cachelines.
- *
- * Must be called with interrupts disabled.
- */
-static void flush_remote_free_cache(struct kmem_cache *s,
-				struct kmem_cache_cpu *c)
-{
-	struct kmlist *src;
-	struct kmem_cache_list *dst;
-	unsigned int nr;
-	int set;
-
-	src = &c->rlist;
-	nr = src->nr;
-	if (unlikely(!nr))
-		return;
-
-#ifdef CONFIG_SLQB_STATS
-	{
-		struct kmem_cache_list *l = &c->list;
-
-		slqb_stat_inc(l, FLUSH_RFREE_LIST);
-		slqb_stat_add(l, FLUSH_RFREE_LIST_OBJECTS, nr);
-	}
-#endif
-
-	dst = c->remote_cache_list;
-
-	/*
-	 * Less common case, dst is filling up so free synchronously.
-	 * No point in having remote CPU free thse as it will just
-	 * free them back to the page list anyway.
-	 */
-	if (unlikely(dst->remote_free.list.nr > (slab_hiwater(s) >> 1))) {
-		void **head;
-
-		head = src->head;
-		spin_lock(&dst->page_lock);
-		do {
-			struct slqb_page *page;
-			void **object;
-
-			object = head;
-			VM_BUG_ON(!object);
-			head = get_freepointer(s, object);
-			page = virt_to_head_slqb_page(object);
-
-			free_object_to_page(s, dst, page, object);
-			nr--;
-		} while (nr);
-		spin_unlock(&dst->page_lock);
-
-		src->head = NULL;
-		src->tail = NULL;
-		src->nr = 0;
-
-		return;
-	}
-
-	spin_lock(&dst->remote_free.lock);
-
-	if (!dst->remote_free.list.head)
-		dst->remote_free.list.head = src->head;
-	else
-		set_freepointer(s, dst->remote_free.list.tail, src->head);
-	dst->remote_free.list.tail = src->tail;
-
-	src->head = NULL;
-	src->tail = NULL;
-	src->nr = 0;
-
-	if (dst->remote_free.list.nr < slab_freebatch(s))
-		set = 1;
-	else
-		set = 0;
-
-	dst->remote_free.list.nr += nr;
-
-	if (unlikely(dst->remote_free.list.nr >= slab_freebatch(s) && set))
-		dst->remote_free_check = 1;
-
-	spin_unlock(&dst->remote_free.lock);
-}
-
 /*
  * Free an object to this CPU's remote free list.
  *
@@ -1709,28 +1798,13 @@ static noinline void slab_free_to_remote(struct kmem_cache *s,
 				struct slqb_page *page, void *object,
 				struct kmem_cache_cpu *c)
 {
-	struct kmlist *r;
+	struct slqb_magazine *mag;
 
-	/*
-	 * Our remote free list corresponds to a different list. Must
-	 * flush it and switch.
-	 */
-	if (page->list != c->remote_cache_list) {
-		flush_remote_free_cache(s, c);
-		c->remote_cache_list = page->list;
-	}
+	mag = get_magazine(s, c, page->list, 1);
+	magazine_add(s, mag, object);
 
-	r = &c->rlist;
-	if (!r->head)
-		r->head = object;
-	else
-		set_freepointer(s, r->tail, object);
-	set_freepointer(s, object, NULL);
-	r->tail = object;
-	r->nr++;
-
-	if (unlikely(r->nr >= slab_freebatch(s)))
-		flush_remote_free_cache(s, c);
+	if (unlikely(mag->list.nr >= slab_freebatch(s)))
+		flush_magazine(s, c, mag);
 }
 #endif
 
@@ -1942,10 +2016,8 @@ static void init_kmem_cache_cpu(struct kmem_cache *s,
 
 	c->colour_next		= 0;
 #ifdef CONFIG_SMP
-	c->rlist.nr		= 0;
-	c->rlist.head		= NULL;
-	c->rlist.tail		= NULL;
-	c->remote_cache_list	= NULL;
+	memset(c->mag, 0, sizeof(c->mag));
+	c->mag_victim		= 0;
 #endif
 }
 
@@ -3140,8 +3212,7 @@ static int __cpuinit slab_cpuup_callback(struct notifier_block *nfb,
 
 	case CPU_DOWN_PREPARE:
 	case CPU_DOWN_PREPARE_FROZEN:
-		cancel_rearming_delayed_work(&per_cpu(slqb_cache_trim_work,
-					cpu));
+		cancel_delayed_work_sync(&per_cpu(slqb_cache_trim_work, cpu));
 		per_cpu(slqb_cache_trim_work, cpu).work.func = NULL;
 		break;
 
@@ -3635,6 +3706,7 @@ STAT_ATTR(FLUSH_RFREE_LIST, flush_rfree_list);
 STAT_ATTR(FLUSH_RFREE_LIST_OBJECTS, flush_rfree_list_objects);
 STAT_ATTR(CLAIM_REMOTE_LIST, claim_remote_list);
 STAT_ATTR(CLAIM_REMOTE_LIST_OBJECTS, claim_remote_list_objects);
+STAT_ATTR(FLUSH_RFREE_MAGAZINE, flush_rfree_magazine);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -3673,6 +3745,7 @@ static struct attribute *slab_attrs[] = {
 	&flush_rfree_list_objects_attr.attr,
 	&claim_remote_list_attr.attr,
 	&claim_remote_list_objects_attr.attr,
+	&flush_rfree_magazine_attr.attr,
 #endif
 #ifdef CONFIG_FAILSLAB
 	&failslab_attr.attr,
@@ -183,6 +183,46 @@ int invalidate_inode_page(struct page *page)
 	return invalidate_complete_page(mapping, page);
 }
 
+/*
+ * Remove the shadow entries of evicted pages in [start, end], see
+ * mm/workingset.c.  Entries are collected first and deleted by index,
+ * as deleting can shrink the tree under the looked up slots.
+ */
+static void clear_shadow_entries(struct address_space *mapping,
+				 pgoff_t start, pgoff_t end)
+{
+	void **slots[PAGEVEC_SIZE];
+	unsigned long indices[PAGEVEC_SIZE];
+	unsigned long shadows[PAGEVEC_SIZE];
+	pgoff_t index = start;
+	unsigned int nr, nr_shadows, i;
+
+	while (mapping->nrshadows && index <= end) {
+		spin_lock_irq(&mapping->tree_lock);
+		nr = radix_tree_gang_lookup_slot(&mapping->page_tree, slots,
+						 indices, index, PAGEVEC_SIZE);
+		nr_shadows = 0;
+		for (i = 0; i < nr && indices[i] <= end; i++) {
+			void *entry;
+
+			entry = radix_tree_deref_slot_protected(slots[i],
+							&mapping->tree_lock);
+			if (radix_tree_exceptional_entry(entry))
+				shadows[nr_shadows++] = indices[i];
+		}
+		for (i = 0; i < nr_shadows; i++) {
+			radix_tree_delete(&mapping->page_tree, shadows[i]);
+			mapping->nrshadows--;
+		}
+		spin_unlock_irq(&mapping->tree_lock);
+
+		if (!nr || indices[nr - 1] >= end)
+			break;
+		index = indices[nr - 1] + 1;
+		cond_resched();
+	}
+}
+
 /**
  * truncate_inode_pages - truncate range of pages specified by start & end byte offsets
  * @mapping: mapping to truncate
@@ -202,6 +242,8 @@ int invalidate_inode_page(struct page *page)
  * We pass down the cache-hot hint to the page freeing code.  Even if the
  * mapping is large, it is probably the case that the final pages are the most
  * recently touched, and freeing happens in ascending file offset order.
+ *
+ * Shadow entries of evicted pages in the range are removed as well.
  */
 void truncate_inode_pages_range(struct address_space *mapping,
 				loff_t lstart, loff_t lend)
@@ -214,8 +256,12 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	int i;
 
 	cleancache_flush_inode(mapping);
-	if (mapping->nrpages == 0)
-		return;
+	if (mapping->nrpages == 0) {
+		/* pairs with the smp_wmb() in page_cache_tree_delete() */
+		smp_rmb();
+		if (mapping->nrshadows == 0)
+			return;
+	}
 
 	BUG_ON((lend & (PAGE_CACHE_SIZE - 1)) != (PAGE_CACHE_SIZE - 1));
 	end = (lend >> PAGE_CACHE_SHIFT);
@@ -292,6 +338,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 		mem_cgroup_uncharge_end();
 		index++;
 	}
+	clear_shadow_entries(mapping, start, end);
 	cleancache_flush_inode(mapping);
 }
 EXPORT_SYMBOL(truncate_inode_pages_range);
@@ -401,7 +448,7 @@ invalidate_complete_page2(struct address_space *mapping, struct page *page)
 		goto failed;
 
 	BUG_ON(page_has_private(page));
-	__delete_from_page_cache(page);
+	__delete_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 
@@ -709,6 +709,8 @@ const char * const vmstat_text[] = {
 	"nr_shmem",
 	"nr_dirtied",
 	"nr_written",
+	"workingset_refault",
+	"workingset_activate",
 
 #ifdef CONFIG_NUMA
 	"numa_hit",
@@ -764,6 +766,9 @@ const char * const vmstat_text[] = {
 	"compact_stall",
 	"compact_fail",
 	"compact_success",
+	"kcompactd_wake",
+	"kcompactd_success",
+	"kcompactd_fail",
 #endif
 
 #ifdef CONFIG_HUGETLB_PAGE
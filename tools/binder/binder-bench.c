@@ -0,0 +1,421 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -g -o binder-bench binder-bench.c -lpthread */
+
+/*
+ * binder-bench - round-trip binder transaction throughput and latency
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * A forked server process becomes the binder context manager and runs a
+ * pool of looper threads that reply to every transaction with a payload
+ * of the same size. The parent runs N client threads, each sending
+ * synchronous transactions to handle 0 back to back for the given time.
+ * Aggregate transactions/s and the round-trip latency distribution are
+ * reported, which shows how well the driver scales with concurrent
+ * callers.
+ *
+ * The context manager can only be claimed once, so servicemanager must
+ * not be running (or this must run on a device without it), and the
+ * uid must match binder_context_mgr_uid if that has already been set.
+ *
+ *	binder-bench [-t threads] [-l server_threads] [-s size] [-d secs]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../../drivers/staging/android/binder.h"
+
+#define BINDER_DEV	"/dev/binder"
+#define SERVER_VM_SZ	(1024 * 1024)
+#define CLIENT_VM_SZ	(128 * 1024)
+#define MAX_PAYLOAD	4096
+
+static int nr_threads = 1;
+static int nr_loopers = 4;
+static size_t payload_size = 16;
+static int duration = 5;
+static volatile int stop;
+
+struct bench_thread {
+	pthread_t tid;
+	int idx;
+	int fd;
+	unsigned long count;
+	double *lat;		/* round-trip times, us */
+	unsigned long lat_alloc;
+	int err;
+};
+
+static pthread_barrier_t barrier;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int open_binder(size_t vm_size)
+{
+	struct binder_version version;
+	void *map;
+	int fd;
+
+	fd = open(BINDER_DEV, O_RDWR);
+	if (fd < 0)
+		return -1;
+	if (ioctl(fd, BINDER_VERSION, &version) < 0 ||
+	    version.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "binder protocol version mismatch\n");
+		close(fd);
+		errno = EPROTO;
+		return -1;
+	}
+	map = mmap(NULL, vm_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int binder_io(int fd, void *wbuf, size_t wlen, void *rbuf, size_t rlen,
+		     size_t *rconsumed)
+{
+	struct binder_write_read bwr;
+	int ret;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_size = wlen;
+	bwr.write_buffer = (unsigned long)wbuf;
+	bwr.read_size = rlen;
+	bwr.read_buffer = (unsigned long)rbuf;
+	do {
+		ret = ioctl(fd, BINDER_WRITE_READ, &bwr);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return errno;
+	if (rconsumed)
+		*rconsumed = bwr.read_consumed;
+	return 0;
+}
+
+/* Append one command and its argument to a write buffer. */
+static size_t put_cmd(uint8_t *buf, size_t off, uint32_t cmd,
+		      const void *arg, size_t arg_len)
+{
+	memcpy(buf + off, &cmd, sizeof(cmd));
+	memcpy(buf + off + sizeof(cmd), arg, arg_len);
+	return off + sizeof(cmd) + arg_len;
+}
+
+static void *looper_thread(void *arg)
+{
+	int fd = (long)arg;
+	uint32_t rbuf[128];
+	uint8_t wbuf[128];
+	static uint8_t reply_data[MAX_PAYLOAD];
+	uint32_t cmd = BC_ENTER_LOOPER;
+	size_t wlen, rlen, off;
+
+	wlen = put_cmd(wbuf, 0, cmd, NULL, 0);
+	for (;;) {
+		if (binder_io(fd, wbuf, wlen, rbuf, sizeof(rbuf), &rlen))
+			break;
+		wlen = 0;
+		for (off = 0; off < rlen; ) {
+			struct binder_transaction_data tr;
+			const void *buffer;
+
+			memcpy(&cmd, (uint8_t *)rbuf + off, sizeof(cmd));
+			off += sizeof(cmd);
+			if (cmd != BR_TRANSACTION) {
+				off += _IOC_SIZE(cmd);
+				continue;
+			}
+			memcpy(&tr, (uint8_t *)rbuf + off, sizeof(tr));
+			off += sizeof(tr);
+
+			buffer = tr.data.ptr.buffer;
+			wlen = put_cmd(wbuf, wlen, BC_FREE_BUFFER,
+				       &buffer, sizeof(buffer));
+			if (tr.flags & TF_ONE_WAY)
+				continue;
+			memset(&tr, 0, sizeof(tr));
+			tr.data_size = payload_size;
+			tr.data.ptr.buffer = reply_data;
+			wlen = put_cmd(wbuf, wlen, BC_REPLY, &tr, sizeof(tr));
+		}
+	}
+	return NULL;
+}
+
+/* Never returns: serves transactions until killed by the parent. */
+static void run_server(int ready_fd)
+{
+	pthread_t tid;
+	size_t max_threads = 0;
+	int fd, i;
+	char c = 0;
+
+	fd = open_binder(SERVER_VM_SZ);
+	if (fd < 0) {
+		perror("server: " BINDER_DEV);
+		exit(1);
+	}
+	/* a fixed pool, no BR_SPAWN_LOOPER */
+	ioctl(fd, BINDER_SET_MAX_THREADS, &max_threads);
+	if (ioctl(fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		perror("server: BINDER_SET_CONTEXT_MGR");
+		exit(1);
+	}
+	for (i = 0; i < nr_loopers; i++) {
+		if (pthread_create(&tid, NULL, looper_thread, (void *)(long)fd)) {
+			perror("server: pthread_create");
+			exit(1);
+		}
+	}
+	if (write(ready_fd, &c, 1) != 1)
+		exit(1);
+	for (;;)
+		pause();
+}
+
+static int add_sample(struct bench_thread *t, double us)
+{
+	if (t->count == t->lat_alloc) {
+		unsigned long n = t->lat_alloc ? t->lat_alloc * 2 : 65536;
+		double *lat = realloc(t->lat, n * sizeof(*lat));
+
+		if (!lat)
+			return ENOMEM;
+		t->lat = lat;
+		t->lat_alloc = n;
+	}
+	t->lat[t->count++] = us;
+	return 0;
+}
+
+/* One synchronous call to handle 0, returns 0 or an errno value. */
+static int do_call(struct bench_thread *t, const void **reply_buf)
+{
+	static uint8_t data[MAX_PAYLOAD];
+	struct binder_transaction_data tr;
+	uint32_t rbuf[64];
+	uint8_t wbuf[128];
+	size_t wlen = 0, rlen, off;
+	uint32_t cmd;
+	int err;
+
+	/* the previous reply is freed together with the next call */
+	if (*reply_buf)
+		wlen = put_cmd(wbuf, wlen, BC_FREE_BUFFER,
+			       reply_buf, sizeof(*reply_buf));
+	*reply_buf = NULL;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.target.handle = 0;
+	tr.code = 1;
+	tr.data_size = payload_size;
+	tr.data.ptr.buffer = data;
+	wlen = put_cmd(wbuf, wlen, BC_TRANSACTION, &tr, sizeof(tr));
+
+	for (;;) {
+		err = binder_io(t->fd, wbuf, wlen, rbuf, sizeof(rbuf), &rlen);
+		if (err)
+			return err;
+		wlen = 0;
+		for (off = 0; off < rlen; ) {
+			memcpy(&cmd, (uint8_t *)rbuf + off, sizeof(cmd));
+			off += sizeof(cmd);
+			switch (cmd) {
+			case BR_REPLY:
+				memcpy(&tr, (uint8_t *)rbuf + off, sizeof(tr));
+				*reply_buf = tr.data.ptr.buffer;
+				return 0;
+			case BR_DEAD_REPLY:
+			case BR_FAILED_REPLY:
+				return EPIPE;
+			default:
+				off += _IOC_SIZE(cmd);
+				break;
+			}
+		}
+	}
+}
+
+static void *client_thread(void *arg)
+{
+	struct bench_thread *t = arg;
+	const void *reply_buf = NULL;
+	double t0, t1;
+
+	pthread_barrier_wait(&barrier);
+	while (!stop && !t->err) {
+		t0 = now();
+		t->err = do_call(t, &reply_buf);
+		t1 = now();
+		if (!t->err)
+			t->err = add_sample(t, (t1 - t0) * 1e6);
+	}
+	pthread_barrier_wait(&barrier);
+	return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t threads] [-l server_threads] [-s size] [-d secs]\n"
+		"  -t  number of client threads (default 1)\n"
+		"  -l  number of server looper threads (default 4)\n"
+		"  -s  payload size in bytes, each way (default 16, max %d)\n"
+		"  -d  run time in seconds (default 5)\n", prog, MAX_PAYLOAD);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_thread *threads;
+	unsigned long total = 0, n;
+	double t0, elapsed, sum = 0, *all;
+	int fd, opt, i, err = 0;
+	int ready[2];
+	pid_t server;
+	char c;
+
+	while ((opt = getopt(argc, argv, "t:l:s:d:")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'l':
+			nr_loopers = atoi(optarg);
+			break;
+		case 's':
+			payload_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || nr_threads <= 0 || nr_loopers <= 0 ||
+	    payload_size > MAX_PAYLOAD || duration <= 0)
+		usage(argv[0]);
+
+	if (pipe(ready)) {
+		perror("pipe");
+		return 1;
+	}
+	server = fork();
+	if (server < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (server == 0) {
+		close(ready[0]);
+		run_server(ready[1]);
+	}
+	close(ready[1]);
+	if (read(ready[0], &c, 1) != 1) {
+		fprintf(stderr, "server failed to start\n");
+		waitpid(server, NULL, 0);
+		return 1;
+	}
+
+	fd = open_binder(CLIENT_VM_SZ);
+	if (fd < 0) {
+		perror(BINDER_DEV);
+		kill(server, SIGKILL);
+		return 1;
+	}
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads)
+		return 1;
+	pthread_barrier_init(&barrier, NULL, nr_threads + 1);
+
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].idx = i;
+		threads[i].fd = fd;
+		if (pthread_create(&threads[i].tid, NULL, client_thread,
+				   &threads[i])) {
+			perror("pthread_create");
+			kill(server, SIGKILL);
+			return 1;
+		}
+	}
+
+	pthread_barrier_wait(&barrier);
+	t0 = now();
+	sleep(duration);
+	stop = 1;
+	pthread_barrier_wait(&barrier);
+	elapsed = now() - t0;
+
+	kill(server, SIGKILL);
+	waitpid(server, NULL, 0);
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		if (threads[i].err) {
+			fprintf(stderr, "thread %d: %s\n", i,
+				strerror(threads[i].err));
+			err = 1;
+		}
+		total += threads[i].count;
+	}
+	if (err || !total)
+		return 1;
+
+	all = malloc(total * sizeof(*all));
+	if (!all)
+		return 1;
+	for (i = 0, n = 0; i < nr_threads; i++) {
+		memcpy(all + n, threads[i].lat,
+		       threads[i].count * sizeof(*all));
+		n += threads[i].count;
+		free(threads[i].lat);
+	}
+	qsort(all, total, sizeof(*all), cmp_double);
+	for (n = 0; n < total; n++)
+		sum += all[n];
+
+	printf("%d client threads, %d server threads, %zu byte payload\n",
+	       nr_threads, nr_loopers, payload_size);
+	printf("  transactions: %lu in %.2f s, %.0f/s\n",
+	       total, elapsed, total / elapsed);
+	printf("  latency us:   avg %.1f  p50 %.1f  p99 %.1f  max %.1f\n",
+	       sum / total, all[total / 2], all[total * 99 / 100],
+	       all[total - 1]);
+
+	free(all);
+	free(threads);
+	return 0;
+}
@@ -0,0 +1,431 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -g -o iosched-bench iosched-bench.c -lpthread */
+
+/*
+ * iosched-bench - replay block traces against each I/O scheduler
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Every trace is replayed once per elevator against the same device, at
+ * the pace it was captured, and for each run the program reports the
+ * read latency percentiles and the read and write throughput. Meant to
+ * be run against emmcsim0 (CONFIG_BLK_DEV_EMMC_SIM), whose timing model
+ * makes runs reproducible; any other device is overwritten, so it is
+ * only accepted with -f.
+ *
+ * A trace is the text that blkparse prints for the queue events of a
+ * blktrace capture, one I/O per line:
+ *
+ *	blktrace -d /dev/block/mmcblk0 -o launch	(while the app starts)
+ *	blkparse -i launch -a queue -f "%T.%9t %d %S %n\n" -o launch.txt
+ *
+ * Reads and sync writes are replayed with O_DIRECT, async writes go
+ * through the page cache and are pushed to writeback right away, so
+ * that the elevator sees the same sync/async mix as on the device the
+ * trace came from. Offsets beyond the end of the device wrap around.
+ *
+ *	iosched-bench [-d dev] [-e elv,elv,...] [-t threads] [-s speed] [-f]
+ *		      trace...
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define SECTOR_SZ	512
+#define MAX_IO		(1 << 20)
+#define DEF_DEV		"/dev/block/emmcsim0"
+#define DEF_ELVS	"noop,deadline,cfq,row,sio,vr,zen,bfq"
+
+enum io_op {
+	IO_READ,
+	IO_WRITE_SYNC,
+	IO_WRITE_ASYNC,
+	IO_FLUSH,
+	IO_DISCARD,
+};
+
+struct io {
+	uint64_t	at_ns;		/* offset from the start of the trace */
+	uint64_t	off;
+	uint32_t	len;
+	enum io_op	op;
+	double		issued;
+	double		lat;
+};
+
+static const char *dev = DEF_DEV;
+static char *elvs;
+static int nr_threads = 16;
+static double speed = 1.0;
+static int force;
+
+static int fd_direct, fd_buffered;
+static uint64_t dev_size;
+
+/* replay state, shared between the dispatcher and the workers */
+static struct io *ios;
+static size_t nr_ios, released, next_io;
+static int replay_done;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int parse_line(const char *line, struct io *io)
+{
+	unsigned long long sec, nsec, sector;
+	unsigned int nr;
+	char rwbs[16];
+
+	if (sscanf(line, "%llu.%llu %15s %llu %u",
+		   &sec, &nsec, rwbs, &sector, &nr) != 5)
+		return -1;
+
+	io->at_ns = sec * 1000000000ULL + nsec;
+	io->len = nr * SECTOR_SZ;
+	if (io->len > MAX_IO)
+		io->len = MAX_IO;
+
+	if (strchr(rwbs, 'D'))
+		io->op = IO_DISCARD;
+	else if (strchr(rwbs, 'R'))
+		io->op = IO_READ;
+	else if (strchr(rwbs, 'W') && io->len)
+		io->op = strchr(rwbs, 'S') ? IO_WRITE_SYNC : IO_WRITE_ASYNC;
+	else if (rwbs[0] == 'F')
+		io->op = IO_FLUSH;
+	else
+		return -1;
+
+	if (io->op != IO_FLUSH && !io->len)
+		return -1;
+
+	io->off = (sector * SECTOR_SZ) % dev_size;
+	if (io->off + io->len > dev_size)
+		io->off = dev_size - io->len;
+	return 0;
+}
+
+static int load_trace(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	size_t alloc = 0;
+	char line[256];
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	nr_ios = 0;
+	while (fgets(line, sizeof(line), f)) {
+		if (nr_ios == alloc) {
+			alloc = alloc ? alloc * 2 : 4096;
+			ios = realloc(ios, alloc * sizeof(*ios));
+			if (!ios) {
+				perror("realloc");
+				exit(1);
+			}
+		}
+		memset(&ios[nr_ios], 0, sizeof(*ios));
+		if (!parse_line(line, &ios[nr_ios]))
+			nr_ios++;
+	}
+	fclose(f);
+
+	if (!nr_ios) {
+		fprintf(stderr, "%s: no I/O found\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+static void do_io(struct io *io, char *buf)
+{
+	uint64_t range[2];
+	ssize_t ret = 0;
+
+	switch (io->op) {
+	case IO_READ:
+		ret = pread(fd_direct, buf, io->len, io->off);
+		break;
+	case IO_WRITE_SYNC:
+		ret = pwrite(fd_direct, buf, io->len, io->off);
+		break;
+	case IO_WRITE_ASYNC:
+		ret = pwrite(fd_buffered, buf, io->len, io->off);
+		if (ret >= 0)
+			ret = sync_file_range(fd_buffered, io->off, io->len,
+					      SYNC_FILE_RANGE_WRITE);
+		break;
+	case IO_FLUSH:
+		ret = fdatasync(fd_direct);
+		break;
+	case IO_DISCARD:
+		range[0] = io->off;
+		range[1] = io->len;
+		ret = ioctl(fd_direct, BLKDISCARD, range);
+		if (ret < 0 && errno == EOPNOTSUPP)
+			ret = 0;
+		break;
+	}
+	if (ret < 0)
+		perror("replaying I/O");
+}
+
+static void *worker(void *unused)
+{
+	struct io *io;
+	char *buf;
+
+	(void)unused;
+	if (posix_memalign((void **)&buf, 4096, MAX_IO)) {
+		perror("posix_memalign");
+		exit(1);
+	}
+	memset(buf, 0x5a, MAX_IO);
+
+	for (;;) {
+		pthread_mutex_lock(&lock);
+		while (next_io == released && !replay_done)
+			pthread_cond_wait(&cond, &lock);
+		if (next_io == released) {
+			pthread_mutex_unlock(&lock);
+			break;
+		}
+		io = &ios[next_io++];
+		pthread_mutex_unlock(&lock);
+
+		do_io(io, buf);
+		io->lat = now() - io->issued;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static void sleep_until(double t)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)t;
+	ts.tv_nsec = (long)((t - ts.tv_sec) * 1e9);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR)
+		;
+}
+
+/* Replays ios[], returns the wall time it took. */
+static double replay(void)
+{
+	pthread_t *threads = calloc(nr_threads, sizeof(*threads));
+	double start, elapsed;
+	size_t i;
+	int t;
+
+	released = next_io = 0;
+	replay_done = 0;
+	for (t = 0; t < nr_threads; t++)
+		pthread_create(&threads[t], NULL, worker, NULL);
+
+	start = now();
+	for (i = 0; i < nr_ios; i++) {
+		sleep_until(start + (ios[i].at_ns - ios[0].at_ns) / 1e9 / speed);
+		ios[i].issued = now();
+		pthread_mutex_lock(&lock);
+		released = i + 1;
+		pthread_cond_signal(&cond);
+		pthread_mutex_unlock(&lock);
+	}
+
+	pthread_mutex_lock(&lock);
+	replay_done = 1;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+	for (t = 0; t < nr_threads; t++)
+		pthread_join(threads[t], NULL);
+
+	/* leave nothing behind for the next run */
+	fsync(fd_buffered);
+	elapsed = now() - start;
+	ioctl(fd_buffered, BLKFLSBUF, 0);
+
+	free(threads);
+	return elapsed;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report(const char *elv, const char *trace, double elapsed)
+{
+	double *lat = calloc(nr_ios, sizeof(*lat));
+	uint64_t rbytes = 0, wbytes = 0;
+	size_t i, n = 0;
+
+	for (i = 0; i < nr_ios; i++) {
+		if (ios[i].op == IO_READ) {
+			lat[n++] = ios[i].lat;
+			rbytes += ios[i].len;
+		} else if (ios[i].op == IO_WRITE_SYNC ||
+			   ios[i].op == IO_WRITE_ASYNC) {
+			wbytes += ios[i].len;
+		}
+	}
+
+	printf("%-9s %-16s %7zu", elv, trace, n);
+	if (n) {
+		qsort(lat, n, sizeof(*lat), cmp_double);
+		printf(" %8.0f %8.0f %8.0f %8.0f %9.0f",
+		       lat[n / 2] * 1e6, lat[n - n / 10 - 1] * 1e6,
+		       lat[n - n / 100 - 1] * 1e6,
+		       lat[n - n / 1000 - 1] * 1e6, lat[n - 1] * 1e6);
+	} else {
+		printf(" %8s %8s %8s %8s %9s", "-", "-", "-", "-", "-");
+	}
+	printf(" %8.2f %8.2f %8.2f\n", rbytes / elapsed / (1 << 20),
+	       wbytes / elapsed / (1 << 20), elapsed);
+	free(lat);
+}
+
+/* Switches @dev to @elv, returns 0 if the elevator is now in use. */
+static int set_elevator(const char *elv)
+{
+	const char *name = strrchr(dev, '/');
+	char path[256], cur[256], want[64];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/sys/block/%s/queue/scheduler",
+		 name ? name + 1 : dev);
+	f = fopen(path, "w");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	fprintf(f, "%s\n", elv);
+	fclose(f);
+
+	f = fopen(path, "r");
+	if (!f || !fgets(cur, sizeof(cur), f)) {
+		perror(path);
+		if (f)
+			fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	snprintf(want, sizeof(want), "[%s]", elv);
+	return strstr(cur, want) ? 0 : -1;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d dev] [-e elv,elv,...] [-t threads] [-s speed] "
+		"[-f] trace...\n"
+		"  -d  device to replay on (default " DEF_DEV ")\n"
+		"  -e  elevators to compare (default " DEF_ELVS ")\n"
+		"  -t  threads issuing I/O, i.e. the most I/O in flight "
+		"(default 16)\n"
+		"  -s  replay speed, 2 is twice as fast as captured "
+		"(default 1)\n"
+		"  -f  allow a device other than emmcsim0; it is overwritten\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *trace;
+	char *elv, *save;
+	double elapsed;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "d:e:t:s:f")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'e':
+			elvs = optarg;
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 's':
+			speed = atof(optarg);
+			break;
+		case 'f':
+			force = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind == argc || nr_threads <= 0 || speed <= 0)
+		usage(argv[0]);
+	if (!strstr(dev, "emmcsim") && !force) {
+		fprintf(stderr, "%s: replaying writes destroys its contents, "
+			"use -f if that is intended\n", dev);
+		return 1;
+	}
+	if (!elvs)
+		elvs = strdup(DEF_ELVS);
+
+	fd_direct = open(dev, O_RDWR | O_DIRECT);
+	fd_buffered = open(dev, O_RDWR);
+	if (fd_direct < 0 || fd_buffered < 0) {
+		perror(dev);
+		return 1;
+	}
+	if (ioctl(fd_direct, BLKGETSIZE64, &dev_size) || dev_size < MAX_IO) {
+		fprintf(stderr, "%s: cannot use device size\n", dev);
+		return 1;
+	}
+
+	printf("elevator  trace              reads  p50(us)  p90(us)  p99(us) "
+	       "p999(us)   max(us)  rd MB/s  wr MB/s  time(s)\n");
+	for (elv = strtok_r(elvs, ",", &save); elv;
+	     elv = strtok_r(NULL, ",", &save)) {
+		if (set_elevator(elv)) {
+			printf("%-9s not available\n", elv);
+			continue;
+		}
+		for (i = optind; i < argc; i++) {
+			if (load_trace(argv[i]))
+				return 1;
+			trace = strrchr(argv[i], '/');
+			elapsed = replay();
+			report(elv, trace ? trace + 1 : argv[i], elapsed);
+		}
+	}
+
+	free(ios);
+	close(fd_direct);
+	close(fd_buffered);
+	return 0;
+}
@@ -0,0 +1,279 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -g -o logger-bench logger-bench.c -lpthread */
+
+/*
+ * logger-bench - concurrent write throughput of the Android logger
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * For each thread count from 1 to N, that many threads write log entries
+ * the way liblog does (priority, tag and message as one writev()) back to
+ * back for the given time, and the aggregate writes/s is reported. With
+ * -r a reader drains the log at the same time like logcat does, and the
+ * entries it got and how often it was woken up are reported too; the
+ * ratio shows how well reader wakeups are batched.
+ *
+ * The entries end up in the log like any other, so use a log nobody
+ * needs to look at (log_radio on most devices) or flush it afterwards.
+ *
+ *	logger-bench [-t max_threads] [-s msg_size] [-d secs] [-r] [log]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/poll.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "../../drivers/staging/android/logger.h"
+
+#define LOG_DEV		"/dev/log/radio"
+#define BENCH_TAG	"logger-bench"
+#define PRIO_INFO	4
+
+static const char *log_path = LOG_DEV;
+static int max_threads = 4;
+static size_t msg_size = 64;
+static int duration = 2;
+static int with_reader;
+static volatile int stop;
+
+struct bench_thread {
+	pthread_t tid;
+	int idx;
+	unsigned long count;
+	int err;
+};
+
+struct bench_reader {
+	pthread_t tid;
+	int fd;
+	unsigned long count;	/* entries read */
+	unsigned long wakeups;	/* times poll() found entries */
+	int err;
+};
+
+static pthread_barrier_t barrier;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct bench_thread *t = arg;
+	unsigned char prio = PRIO_INFO;
+	struct iovec vec[3];
+	char *msg;
+	int fd;
+
+	msg = malloc(msg_size);
+	fd = open(log_path, O_WRONLY);
+	if (!msg || fd < 0) {
+		t->err = msg ? errno : ENOMEM;
+		pthread_barrier_wait(&barrier);
+		pthread_barrier_wait(&barrier);
+		free(msg);
+		return NULL;
+	}
+	memset(msg, 'a' + t->idx % 26, msg_size - 1);
+	msg[msg_size - 1] = '\0';
+
+	vec[0].iov_base = &prio;
+	vec[0].iov_len = 1;
+	vec[1].iov_base = BENCH_TAG;
+	vec[1].iov_len = sizeof(BENCH_TAG);
+	vec[2].iov_base = msg;
+	vec[2].iov_len = msg_size;
+
+	pthread_barrier_wait(&barrier);
+	while (!stop) {
+		if (writev(fd, vec, 3) < 0) {
+			if (errno == EINTR)
+				continue;
+			t->err = errno;
+			break;
+		}
+		t->count++;
+	}
+	pthread_barrier_wait(&barrier);
+
+	close(fd);
+	free(msg);
+	return NULL;
+}
+
+/* Like logcat: sleep in poll(), then read until the log is empty. */
+static void *reader_thread(void *arg)
+{
+	struct bench_reader *r = arg;
+	char buf[LOGGER_ENTRY_MAX_LEN];
+	struct pollfd pfd = { .fd = r->fd, .events = POLLIN };
+	ssize_t ret;
+
+	while (!stop) {
+		ret = poll(&pfd, 1, 100);
+		if (ret <= 0) {
+			if (ret < 0 && errno != EINTR) {
+				r->err = errno;
+				break;
+			}
+			continue;
+		}
+		r->wakeups++;
+		while ((ret = read(r->fd, buf, sizeof(buf))) > 0)
+			r->count++;
+		if (ret < 0 && errno != EAGAIN && errno != EINTR) {
+			r->err = errno;
+			break;
+		}
+	}
+	return NULL;
+}
+
+static int run(int nr_threads, double *rate, struct bench_reader *r)
+{
+	struct bench_thread *threads;
+	unsigned long total = 0;
+	double t0, elapsed;
+	int i, err = 0;
+
+	*rate = 0;
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads)
+		return ENOMEM;
+	pthread_barrier_init(&barrier, NULL, nr_threads + 1);
+	stop = 0;
+
+	if (r) {
+		memset(r, 0, sizeof(*r));
+		r->fd = open(log_path, O_RDONLY | O_NONBLOCK);
+		if (r->fd < 0 || ioctl(r->fd, LOGGER_FLUSH_LOG) < 0) {
+			err = errno;
+			goto out;
+		}
+		if (pthread_create(&r->tid, NULL, reader_thread, r)) {
+			err = errno;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].idx = i;
+		if (pthread_create(&threads[i].tid, NULL, writer_thread,
+				   &threads[i])) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+
+	pthread_barrier_wait(&barrier);
+	t0 = now();
+	sleep(duration);
+	stop = 1;
+	pthread_barrier_wait(&barrier);
+	elapsed = now() - t0;
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		if (threads[i].err) {
+			fprintf(stderr, "thread %d: %s\n", i,
+				strerror(threads[i].err));
+			err = threads[i].err;
+		}
+		total += threads[i].count;
+	}
+	if (r) {
+		pthread_join(r->tid, NULL);
+		if (r->err) {
+			fprintf(stderr, "reader: %s\n", strerror(r->err));
+			err = r->err;
+		}
+	}
+	*rate = total / elapsed;
+out:
+	if (r && r->fd >= 0)
+		close(r->fd);
+	pthread_barrier_destroy(&barrier);
+	free(threads);
+	return err;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t max_threads] [-s size] [-d secs] [-r] [log]\n"
+		"  -t  run with 1 up to this many writer threads (default 4)\n"
+		"  -s  message size in bytes (default 64, max %d)\n"
+		"  -d  seconds to run each thread count (default 2)\n"
+		"  -r  drain the log with a reader while writing\n"
+		"  log defaults to " LOG_DEV "\n", prog,
+		(int)(LOGGER_ENTRY_MAX_PAYLOAD - sizeof(BENCH_TAG) - 1));
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_reader reader;
+	double rate, base = 0;
+	int opt, n, err;
+
+	while ((opt = getopt(argc, argv, "t:s:d:r")) != -1) {
+		switch (opt) {
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 's':
+			msg_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'r':
+			with_reader = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind < argc - 1 || max_threads <= 0 || duration <= 0 ||
+	    !msg_size ||
+	    msg_size > LOGGER_ENTRY_MAX_PAYLOAD - sizeof(BENCH_TAG) - 1)
+		usage(argv[0]);
+	if (optind == argc - 1)
+		log_path = argv[optind];
+
+	printf("%s: %zu byte messages, %d s per run%s\n", log_path, msg_size,
+	       duration, with_reader ? ", with reader" : "");
+	printf("threads    writes/s   per thread  scaling%s\n",
+	       with_reader ? "      read wakeups" : "");
+	for (n = 1; n <= max_threads; n++) {
+		err = run(n, &rate, with_reader ? &reader : NULL);
+		if (err) {
+			fprintf(stderr, "%s: %s\n", log_path, strerror(err));
+			return 1;
+		}
+		if (n == 1)
+			base = rate;
+		printf("%7d %11.0f %12.0f %8.2f", n, rate, rate / n,
+		       base ? rate / base : 0);
+		if (with_reader)
+			printf(" %9lu %7lu", reader.count, reader.wakeups);
+		printf("\n");
+	}
+	return 0;
+}
@@ -0,0 +1,300 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -g -o swap-bench swap-bench.c */
+
+/*
+ * swap-bench - swap-out / swap-in latency of whatever swap is configured
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * The program puts itself into a memory cgroup limited to limit_mb and
+ * writes size_mb of anonymous memory, so that reclaim has to swap out
+ * the part that does not fit. It then reads the memory back in the same
+ * order, so every page that was swapped out has to be swapped in again.
+ * For both passes it reports the time per page touched, its percentiles,
+ * and the time per page actually swapped (from pswpout/pswpin), and
+ * checks that the data survived.
+ *
+ * Run it once with a zram device as swap, and once with frontswap
+ * enabled (zcache) in front of an ordinary swap file or partition, to
+ * compare the bio path through zram with the synchronous frontswap
+ * path. The frontswap counters are printed when they exist, so it is
+ * visible which path the pages took.
+ *
+ *	swap-bench [-c memcg_root] [-l limit_mb] [-s size_mb] [-p passes]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define PAGE_SZ		4096
+#define MEMCG_ROOT	"/dev/memcg"
+#define BENCH_CG	"swap-bench"
+#define FRONTSWAP_DIR	"/sys/kernel/mm/frontswap/"
+
+static const char *memcg_root = MEMCG_ROOT;
+static unsigned long limit_mb = 32;
+static unsigned long size_mb = 64;
+static int passes = 1;
+
+struct swap_counters {
+	unsigned long long pswpin;
+	unsigned long long pswpout;
+	unsigned long long fs_puts;	/* frontswap succ_puts */
+	unsigned long long fs_gets;	/* frontswap gets */
+	int have_frontswap;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_file(const char *path, const char *val)
+{
+	FILE *f = fopen(path, "w");
+	int err = 0;
+
+	if (!f)
+		return errno;
+	if (fputs(val, f) < 0)
+		err = errno;
+	if (fclose(f) && !err)
+		err = errno;
+	return err;
+}
+
+static int read_ull(const char *path, unsigned long long *val)
+{
+	FILE *f = fopen(path, "r");
+	int ret;
+
+	if (!f)
+		return -1;
+	ret = fscanf(f, "%llu", val);
+	fclose(f);
+	return ret == 1 ? 0 : -1;
+}
+
+static void read_counters(struct swap_counters *c)
+{
+	char name[64];
+	unsigned long long val;
+	FILE *f;
+
+	memset(c, 0, sizeof(*c));
+	f = fopen("/proc/vmstat", "r");
+	if (f) {
+		while (fscanf(f, "%63s %llu", name, &val) == 2) {
+			if (!strcmp(name, "pswpin"))
+				c->pswpin = val;
+			else if (!strcmp(name, "pswpout"))
+				c->pswpout = val;
+		}
+		fclose(f);
+	}
+	c->have_frontswap =
+		!read_ull(FRONTSWAP_DIR "succ_puts", &c->fs_puts) &&
+		!read_ull(FRONTSWAP_DIR "gets", &c->fs_gets);
+}
+
+/* Same synthetic data as zram-bench: compresses about 2:1 with LZO. */
+static void fill_page(unsigned char *p, unsigned long long pgno)
+{
+	unsigned int seed = (unsigned int)(pgno * 2654435761u);
+	int i;
+
+	for (i = 0; i < PAGE_SZ / 2; i += 16) {
+		memcpy(p + i, &pgno, sizeof(pgno));
+		memset(p + i + sizeof(pgno), 0x5a, 16 - sizeof(pgno));
+	}
+	for (; i < PAGE_SZ; i++) {
+		seed = seed * 1103515245 + 12345;
+		p[i] = seed >> 16;
+	}
+}
+
+static int check_page(const unsigned char *p, unsigned long long pgno)
+{
+	unsigned long long tag;
+
+	memcpy(&tag, p, sizeof(tag));
+	return tag == pgno && p[sizeof(tag)] == 0x5a;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report(const char *phase, double *lat, size_t n, double elapsed,
+		   unsigned long long swapped, unsigned long long fs)
+{
+	qsort(lat, n, sizeof(*lat), cmp_double);
+	printf("%-8s %8.2f %8.2f %8.2f %9.1f %9llu %9.2f",
+	       phase, elapsed * 1e6 / n, lat[n / 2] * 1e6,
+	       lat[n - n / 100 - 1] * 1e6, lat[n - 1] * 1e6, swapped,
+	       swapped ? elapsed * 1e6 / swapped : 0);
+	if (fs != (unsigned long long)-1)
+		printf(" %9llu", fs);
+	printf("\n");
+}
+
+static int join_memcg(char *cg, size_t len)
+{
+	char path[320], val[32];
+	int err;
+
+	snprintf(cg, len, "%s/%s", memcg_root, BENCH_CG);
+	if (mkdir(cg, 0755) && errno != EEXIST)
+		return errno;
+	snprintf(path, sizeof(path), "%s/memory.limit_in_bytes", cg);
+	snprintf(val, sizeof(val), "%lu", limit_mb << 20);
+	err = write_file(path, val);
+	if (err)
+		return err;
+	snprintf(path, sizeof(path), "%s/tasks", cg);
+	snprintf(val, sizeof(val), "%d", getpid());
+	return write_file(path, val);
+}
+
+static void leave_memcg(const char *cg)
+{
+	char path[320], val[32];
+
+	snprintf(path, sizeof(path), "%s/tasks", memcg_root);
+	snprintf(val, sizeof(val), "%d", getpid());
+	write_file(path, val);
+	rmdir(cg);
+}
+
+static int run(unsigned char *mem, size_t nr_pages, double *lat)
+{
+	struct swap_counters c0, c1;
+	unsigned long long fs;
+	unsigned char *p;
+	double t0, t, elapsed;
+	size_t i, bad = 0;
+
+	/* swap-out: faulting in the tail pushes the head out */
+	read_counters(&c0);
+	t0 = now();
+	for (i = 0; i < nr_pages; i++) {
+		t = now();
+		fill_page(mem + i * PAGE_SZ, i);
+		lat[i] = now() - t;
+	}
+	elapsed = now() - t0;
+	read_counters(&c1);
+	fs = c1.have_frontswap ? c1.fs_puts - c0.fs_puts : -1ULL;
+	report("out", lat, nr_pages, elapsed, c1.pswpout - c0.pswpout, fs);
+
+	/* swap-in: the head comes back in and pushes the tail out */
+	read_counters(&c0);
+	t0 = now();
+	for (i = 0; i < nr_pages; i++) {
+		p = mem + i * PAGE_SZ;
+		t = now();
+		if (!check_page(p, i))
+			bad++;
+		lat[i] = now() - t;
+	}
+	elapsed = now() - t0;
+	read_counters(&c1);
+	fs = c1.have_frontswap ? c1.fs_gets - c0.fs_gets : -1ULL;
+	report("in", lat, nr_pages, elapsed, c1.pswpin - c0.pswpin, fs);
+
+	if (bad) {
+		fprintf(stderr, "%zu pages came back corrupted\n", bad);
+		return EIO;
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-c memcg_root] [-l limit_mb] [-s size_mb] "
+		"[-p passes]\n"
+		"  -c  where the memory cgroup hierarchy is mounted "
+		"(default " MEMCG_ROOT ")\n"
+		"  -l  memory limit of the benchmark, in MB (default 32)\n"
+		"  -s  anonymous memory to write, in MB (default 64)\n"
+		"  -p  number of times to run both passes (default 1)\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct swap_counters c;
+	unsigned char *mem;
+	size_t nr_pages;
+	double *lat;
+	char cg[256];
+	int opt, i, err;
+
+	while ((opt = getopt(argc, argv, "c:l:s:p:")) != -1) {
+		switch (opt) {
+		case 'c':
+			memcg_root = optarg;
+			break;
+		case 'l':
+			limit_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			passes = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || !limit_mb || size_mb <= limit_mb || passes <= 0)
+		usage(argv[0]);
+
+	nr_pages = (size_mb << 20) / PAGE_SZ;
+	lat = calloc(nr_pages, sizeof(*lat));
+	mem = mmap(NULL, nr_pages * PAGE_SZ, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (!lat || mem == MAP_FAILED) {
+		perror("allocating memory");
+		return 1;
+	}
+
+	err = join_memcg(cg, sizeof(cg));
+	if (err) {
+		fprintf(stderr, "%s: %s\n", cg, strerror(err));
+		leave_memcg(cg);
+		return 1;
+	}
+
+	read_counters(&c);
+	printf("%lu MB through a %lu MB memcg, %s\n", size_mb, limit_mb,
+	       c.have_frontswap ? "frontswap present" : "no frontswap");
+	printf("pass     us/touch      p50      p99       max   swapped "
+	       "us/swapped%s\n", c.have_frontswap ? " frontswap" : "");
+	for (i = 0; i < passes && !err; i++)
+		err = run(mem, nr_pages, lat);
+
+	leave_memcg(cg);
+	munmap(mem, nr_pages * PAGE_SZ);
+	free(lat);
+	return err ? 1 : 0;
+}
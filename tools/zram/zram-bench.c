@@ -0,0 +1,251 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -g -o zram-bench zram-bench.c -lpthread */
+
+/*
+ * zram-bench - parallel swap-out / swap-in throughput for zram devices
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Each thread owns a disjoint range of the device and writes it page by
+ * page with O_DIRECT, mimicking swap-out, then reads it back, mimicking
+ * swap-in. Page contents are synthetic but compress roughly like
+ * anonymous memory (about 2:1 with LZO). The aggregate MB/s of both
+ * phases is reported.
+ *
+ * WARNING: this overwrites the device. Do not run it on a zram device
+ * that is in use as swap or holds a filesystem.
+ *
+ *	zram-bench [-t threads] [-s size_mb] [-v] /dev/zram0
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <linux/fs.h>
+
+#define PAGE_SZ		4096
+
+static const char *dev_path;
+static int nr_threads = 2;
+static unsigned long long size_bytes;
+static int verify;
+
+struct bench_thread {
+	pthread_t tid;
+	int idx;
+	unsigned long long start;	/* byte offset of this range */
+	unsigned long long len;		/* bytes */
+	int err;
+};
+
+static pthread_barrier_t barrier;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Half of each page is a small repeated record with a page-specific
+ * tag, half is pseudo-random: roughly what a heap page looks like.
+ */
+static void fill_page(unsigned char *p, unsigned long long pgno)
+{
+	unsigned int seed = (unsigned int)(pgno * 2654435761u);
+	int i;
+
+	for (i = 0; i < PAGE_SZ / 2; i += 16) {
+		memcpy(p + i, &pgno, sizeof(pgno));
+		memset(p + i + sizeof(pgno), 0x5a, 16 - sizeof(pgno));
+	}
+	for (; i < PAGE_SZ; i++) {
+		seed = seed * 1103515245 + 12345;
+		p[i] = seed >> 16;
+	}
+}
+
+static int do_phase(struct bench_thread *t, int fd, int write_phase)
+{
+	unsigned char *buf, *ref = NULL;
+	unsigned long long off;
+	ssize_t ret;
+
+	if (posix_memalign((void **)&buf, PAGE_SZ, PAGE_SZ))
+		return ENOMEM;
+	if (verify && !write_phase && posix_memalign((void **)&ref,
+						     PAGE_SZ, PAGE_SZ)) {
+		free(buf);
+		return ENOMEM;
+	}
+
+	for (off = t->start; off < t->start + t->len; off += PAGE_SZ) {
+		if (write_phase) {
+			fill_page(buf, off / PAGE_SZ);
+			ret = pwrite(fd, buf, PAGE_SZ, off);
+		} else {
+			ret = pread(fd, buf, PAGE_SZ, off);
+		}
+		if (ret != PAGE_SZ) {
+			ret = ret < 0 ? errno : EIO;
+			goto out;
+		}
+		if (ref) {
+			fill_page(ref, off / PAGE_SZ);
+			if (memcmp(buf, ref, PAGE_SZ)) {
+				fprintf(stderr, "thread %d: mismatch at %llu\n",
+					t->idx, off);
+				ret = EIO;
+				goto out;
+			}
+		}
+	}
+	ret = 0;
+out:
+	free(ref);
+	free(buf);
+	return ret;
+}
+
+static void *bench_thread(void *arg)
+{
+	struct bench_thread *t = arg;
+	int fd;
+
+	fd = open(dev_path, O_RDWR | O_DIRECT);
+	if (fd < 0) {
+		t->err = errno;
+		pthread_barrier_wait(&barrier);
+		pthread_barrier_wait(&barrier);
+		pthread_barrier_wait(&barrier);
+		pthread_barrier_wait(&barrier);
+		return NULL;
+	}
+
+	/* swap-out */
+	pthread_barrier_wait(&barrier);
+	if (!t->err)
+		t->err = do_phase(t, fd, 1);
+	pthread_barrier_wait(&barrier);
+
+	/* swap-in */
+	pthread_barrier_wait(&barrier);
+	if (!t->err)
+		t->err = do_phase(t, fd, 0);
+	pthread_barrier_wait(&barrier);
+
+	close(fd);
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t threads] [-s size_mb] [-v] <zram device>\n"
+		"  -t  number of parallel threads (default 2)\n"
+		"  -s  amount of data to write, in MB (default: whole device)\n"
+		"  -v  verify data read back\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_thread *threads;
+	unsigned long long devsize, per_thread;
+	double t0, t_write, t_read;
+	int fd, opt, i, err = 0;
+
+	while ((opt = getopt(argc, argv, "t:s:v")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 's':
+			size_bytes = strtoull(optarg, NULL, 0) << 20;
+			break;
+		case 'v':
+			verify = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1 || nr_threads <= 0)
+		usage(argv[0]);
+	dev_path = argv[optind];
+
+	fd = open(dev_path, O_RDONLY);
+	if (fd < 0 || ioctl(fd, BLKGETSIZE64, &devsize)) {
+		perror(dev_path);
+		return 1;
+	}
+	close(fd);
+
+	if (!size_bytes || size_bytes > devsize)
+		size_bytes = devsize;
+	per_thread = size_bytes / nr_threads / PAGE_SZ * PAGE_SZ;
+	if (!per_thread) {
+		fprintf(stderr, "%s: device too small\n", dev_path);
+		return 1;
+	}
+	size_bytes = per_thread * nr_threads;
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads)
+		return 1;
+	pthread_barrier_init(&barrier, NULL, nr_threads + 1);
+
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].idx = i;
+		threads[i].start = per_thread * i;
+		threads[i].len = per_thread;
+		if (pthread_create(&threads[i].tid, NULL, bench_thread,
+				   &threads[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	pthread_barrier_wait(&barrier);
+	t0 = now();
+	pthread_barrier_wait(&barrier);
+	t_write = now() - t0;
+
+	pthread_barrier_wait(&barrier);
+	t0 = now();
+	pthread_barrier_wait(&barrier);
+	t_read = now() - t0;
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i].tid, NULL);
+		if (threads[i].err) {
+			fprintf(stderr, "thread %d: %s\n", i,
+				strerror(threads[i].err));
+			err = 1;
+		}
+	}
+	if (err)
+		return 1;
+
+	printf("%s: %d threads, %llu MB\n", dev_path, nr_threads,
+	       size_bytes >> 20);
+	printf("  swap-out: %8.1f MB/s\n", (size_bytes >> 20) / t_write);
+	printf("  swap-in:  %8.1f MB/s\n", (size_bytes >> 20) / t_read);
+
+	free(threads);
+	return 0;
+}